@@ -42,86 +42,321 @@
 #define GNOME_SHELL_DBUS_NAME      "org.gnome.Shell"
 #define GNOME_SHELL_DBUS_OBJECT    "/org/gnome/Shell"
 
+/* Proxies are shared by all the callers for as long as one of them
+ * holds a reference. Asynchronous requests made while the proxy is
+ * being created wait for that creation instead of starting another. */
+typedef struct {
+        GObject *proxy;
+        GSList  *tasks;
+} ProxyCache;
+
+static ProxyCache session_cache;
+static ProxyCache screen_saver_cache;
+static ProxyCache shell_cache;
+
+static char *chassis_type = NULL;
+static GSList *chassis_tasks = NULL;
+
+static gpointer
+proxy_cache_lookup (ProxyCache *cache)
+{
+        if (cache->proxy == NULL)
+                return NULL;
+
+        return g_object_ref (cache->proxy);
+}
+
+static void
+proxy_cache_set (ProxyCache *cache,
+                 GObject    *proxy)
+{
+        cache->proxy = proxy;
+        g_object_add_weak_pointer (proxy, (gpointer *) &cache->proxy);
+}
+
+/* Returns TRUE if the caller needs to start creating the proxy */
+static gboolean
+proxy_cache_add_task (ProxyCache *cache,
+                      GTask      *task)
+{
+        if (cache->proxy != NULL) {
+                g_task_return_pointer (task, g_object_ref (cache->proxy), g_object_unref);
+                return FALSE;
+        }
+
+        cache->tasks = g_slist_prepend (cache->tasks, g_object_ref (task));
+
+        return cache->tasks->next == NULL;
+}
+
+static void
+return_pending_tasks (GSList         *tasks,
+                      gpointer        result,
+                      GBoxedCopyFunc  copy_func,
+                      GDestroyNotify  destroy_func,
+                      const GError   *error)
+{
+        GSList *l;
+
+        for (l = tasks; l != NULL; l = l->next) {
+                GTask *task = l->data;
+
+                if (g_task_return_error_if_cancelled (task))
+                        continue;
+
+                if (result != NULL)
+                        g_task_return_pointer (task, copy_func (result), destroy_func);
+                else
+                        g_task_return_error (task, g_error_copy (error));
+        }
+
+        g_slist_free_full (tasks, g_object_unref);
+}
+
+static void
+proxy_cache_resolve (ProxyCache   *cache,
+                     GObject      *proxy,
+                     const GError *error)
+{
+        GSList *tasks;
+
+        /* A synchronous caller might have been quicker */
+        if (proxy != NULL && cache->proxy == NULL)
+                proxy_cache_set (cache, proxy);
+
+        tasks = g_slist_reverse (cache->tasks);
+        cache->tasks = NULL;
+
+        return_pending_tasks (tasks, cache->proxy,
+                              (GBoxedCopyFunc) g_object_ref, g_object_unref,
+                              error);
+}
+
 GsdSessionManager *
 gnome_settings_bus_get_session_proxy (void)
 {
-        static GsdSessionManager *session_proxy;
+        GsdSessionManager *session_proxy;
         GError *error =  NULL;
 
-        if (session_proxy != NULL) {
-                g_object_ref (session_proxy);
+        session_proxy = proxy_cache_lookup (&session_cache);
+        if (session_proxy != NULL)
+                return session_proxy;
+
+        session_proxy = gsd_session_manager_proxy_new_for_bus_sync (G_BUS_TYPE_SESSION,
+                                                                    G_DBUS_PROXY_FLAGS_NONE,
+                                                                    GNOME_SESSION_DBUS_NAME,
+                                                                    GNOME_SESSION_DBUS_OBJECT,
+                                                                    NULL,
+                                                                    &error);
+        if (error) {
+                g_warning ("Failed to connect to the session manager: %s", error->message);
+                g_error_free (error);
         } else {
-                session_proxy = gsd_session_manager_proxy_new_for_bus_sync (G_BUS_TYPE_SESSION,
-                                                                            G_DBUS_PROXY_FLAGS_NONE,
-                                                                            GNOME_SESSION_DBUS_NAME,
-                                                                            GNOME_SESSION_DBUS_OBJECT,
-                                                                            NULL,
-                                                                            &error);
-                if (error) {
-                        g_warning ("Failed to connect to the session manager: %s", error->message);
-                        g_error_free (error);
-                } else {
-                        g_object_add_weak_pointer (G_OBJECT (session_proxy), (gpointer*)&session_proxy);
-                }
+                proxy_cache_set (&session_cache, G_OBJECT (session_proxy));
         }
 
         return session_proxy;
 }
 
+static void
+session_proxy_ready_cb (GObject      *source_object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+        GsdSessionManager *proxy;
+        g_autoptr(GError) error = NULL;
+
+        proxy = gsd_session_manager_proxy_new_for_bus_finish (res, &error);
+        if (proxy == NULL)
+                g_warning ("Failed to connect to the session manager: %s", error->message);
+
+        proxy_cache_resolve (&session_cache, G_OBJECT (proxy), error);
+        g_clear_object (&proxy);
+}
+
+void
+gnome_settings_bus_get_session_proxy_async (GCancellable        *cancellable,
+                                            GAsyncReadyCallback  callback,
+                                            gpointer             user_data)
+{
+        g_autoptr(GTask) task = NULL;
+
+        task = g_task_new (NULL, cancellable, callback, user_data);
+        g_task_set_source_tag (task, gnome_settings_bus_get_session_proxy_async);
+
+        if (!proxy_cache_add_task (&session_cache, task))
+                return;
+
+        gsd_session_manager_proxy_new_for_bus (G_BUS_TYPE_SESSION,
+                                               G_DBUS_PROXY_FLAGS_NONE,
+                                               GNOME_SESSION_DBUS_NAME,
+                                               GNOME_SESSION_DBUS_OBJECT,
+                                               NULL,
+                                               session_proxy_ready_cb,
+                                               NULL);
+}
+
+GsdSessionManager *
+gnome_settings_bus_get_session_proxy_finish (GAsyncResult  *result,
+                                             GError       **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+        return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 GsdScreenSaver *
 gnome_settings_bus_get_screen_saver_proxy (void)
 {
-        static GsdScreenSaver *screen_saver_proxy;
+        GsdScreenSaver *screen_saver_proxy;
         GError *error =  NULL;
 
-        if (screen_saver_proxy != NULL) {
-                g_object_ref (screen_saver_proxy);
+        screen_saver_proxy = proxy_cache_lookup (&screen_saver_cache);
+        if (screen_saver_proxy != NULL)
+                return screen_saver_proxy;
+
+        screen_saver_proxy = gsd_screen_saver_proxy_new_for_bus_sync (G_BUS_TYPE_SESSION,
+                                                                      G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+                                                                      G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                                                                      GNOME_SCREENSAVER_DBUS_NAME,
+                                                                      GNOME_SCREENSAVER_DBUS_OBJECT,
+                                                                      NULL,
+                                                                      &error);
+        if (error) {
+                g_warning ("Failed to connect to the screen saver: %s", error->message);
+                g_error_free (error);
         } else {
-                screen_saver_proxy = gsd_screen_saver_proxy_new_for_bus_sync (G_BUS_TYPE_SESSION,
-                                                                              G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
-                                                                              G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
-                                                                              GNOME_SCREENSAVER_DBUS_NAME,
-                                                                              GNOME_SCREENSAVER_DBUS_OBJECT,
-                                                                              NULL,
-                                                                              &error);
-                if (error) {
-                        g_warning ("Failed to connect to the screen saver: %s", error->message);
-                        g_error_free (error);
-                } else {
-                        g_object_add_weak_pointer (G_OBJECT (screen_saver_proxy), (gpointer*)&screen_saver_proxy);
-                }
+                proxy_cache_set (&screen_saver_cache, G_OBJECT (screen_saver_proxy));
         }
 
         return screen_saver_proxy;
 }
 
+static void
+screen_saver_proxy_ready_cb (GObject      *source_object,
+                             GAsyncResult *res,
+                             gpointer      user_data)
+{
+        GsdScreenSaver *proxy;
+        g_autoptr(GError) error = NULL;
+
+        proxy = gsd_screen_saver_proxy_new_for_bus_finish (res, &error);
+        if (proxy == NULL)
+                g_warning ("Failed to connect to the screen saver: %s", error->message);
+
+        proxy_cache_resolve (&screen_saver_cache, G_OBJECT (proxy), error);
+        g_clear_object (&proxy);
+}
+
+void
+gnome_settings_bus_get_screen_saver_proxy_async (GCancellable        *cancellable,
+                                                 GAsyncReadyCallback  callback,
+                                                 gpointer             user_data)
+{
+        g_autoptr(GTask) task = NULL;
+
+        task = g_task_new (NULL, cancellable, callback, user_data);
+        g_task_set_source_tag (task, gnome_settings_bus_get_screen_saver_proxy_async);
+
+        if (!proxy_cache_add_task (&screen_saver_cache, task))
+                return;
+
+        gsd_screen_saver_proxy_new_for_bus (G_BUS_TYPE_SESSION,
+                                            G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+                                            G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                                            GNOME_SCREENSAVER_DBUS_NAME,
+                                            GNOME_SCREENSAVER_DBUS_OBJECT,
+                                            NULL,
+                                            screen_saver_proxy_ready_cb,
+                                            NULL);
+}
+
+GsdScreenSaver *
+gnome_settings_bus_get_screen_saver_proxy_finish (GAsyncResult  *result,
+                                                  GError       **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+        return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 GsdShell *
 gnome_settings_bus_get_shell_proxy (void)
 {
-        static GsdShell *shell_proxy = NULL;
+        GsdShell *shell_proxy;
         GError *error =  NULL;
 
-        if (shell_proxy != NULL) {
-                g_object_ref (shell_proxy);
+        shell_proxy = proxy_cache_lookup (&shell_cache);
+        if (shell_proxy != NULL)
+                return shell_proxy;
+
+        shell_proxy = gsd_shell_proxy_new_for_bus_sync (G_BUS_TYPE_SESSION,
+                                                        G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+                                                        G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                                                        GNOME_SHELL_DBUS_NAME,
+                                                        GNOME_SHELL_DBUS_OBJECT,
+                                                        NULL,
+                                                        &error);
+        if (error) {
+                g_warning ("Failed to connect to the shell: %s", error->message);
+                g_error_free (error);
         } else {
-                shell_proxy = gsd_shell_proxy_new_for_bus_sync (G_BUS_TYPE_SESSION,
-								G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
-								G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
-								GNOME_SHELL_DBUS_NAME,
-								GNOME_SHELL_DBUS_OBJECT,
-								NULL,
-								&error);
-                if (error) {
-                        g_warning ("Failed to connect to the shell: %s", error->message);
-                        g_error_free (error);
-                } else {
-                        g_object_add_weak_pointer (G_OBJECT (shell_proxy), (gpointer*)&shell_proxy);
-                }
+                proxy_cache_set (&shell_cache, G_OBJECT (shell_proxy));
         }
 
         return shell_proxy;
 }
 
+static void
+shell_proxy_ready_cb (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+        GsdShell *proxy;
+        g_autoptr(GError) error = NULL;
+
+        proxy = gsd_shell_proxy_new_for_bus_finish (res, &error);
+        if (proxy == NULL)
+                g_warning ("Failed to connect to the shell: %s", error->message);
+
+        proxy_cache_resolve (&shell_cache, G_OBJECT (proxy), error);
+        g_clear_object (&proxy);
+}
+
+void
+gnome_settings_bus_get_shell_proxy_async (GCancellable        *cancellable,
+                                          GAsyncReadyCallback  callback,
+                                          gpointer             user_data)
+{
+        g_autoptr(GTask) task = NULL;
+
+        task = g_task_new (NULL, cancellable, callback, user_data);
+        g_task_set_source_tag (task, gnome_settings_bus_get_shell_proxy_async);
+
+        if (!proxy_cache_add_task (&shell_cache, task))
+                return;
+
+        gsd_shell_proxy_new_for_bus (G_BUS_TYPE_SESSION,
+                                     G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+                                     G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                                     GNOME_SHELL_DBUS_NAME,
+                                     GNOME_SHELL_DBUS_OBJECT,
+                                     NULL,
+                                     shell_proxy_ready_cb,
+                                     NULL);
+}
+
+GsdShell *
+gnome_settings_bus_get_shell_proxy_finish (GAsyncResult  *result,
+                                           GError       **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+        return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/* The chassis type does not change while we are running, so it is
+ * only looked up once successfully. */
 char *
 gnome_settings_get_chassis_type (void)
 {
@@ -131,6 +366,9 @@ gnome_settings_get_chassis_type (void)
         GVariant *variant = NULL;
         GDBusConnection *connection;
 
+        if (chassis_type != NULL)
+                return g_strdup (chassis_type);
+
         connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM,
                                      NULL,
                                      &error);
@@ -162,12 +400,113 @@ gnome_settings_get_chassis_type (void)
         g_variant_get (variant, "(v)", &inner);
         ret = g_variant_dup_string (inner, NULL);
         g_variant_unref (inner);
+
+        if (chassis_type == NULL)
+                chassis_type = g_strdup (ret);
 out:
         g_clear_object (&connection);
         g_clear_pointer (&variant, g_variant_unref);
         return ret;
 }
 
+static void
+chassis_type_resolve (const GError *error)
+{
+        GSList *tasks;
+
+        tasks = g_slist_reverse (chassis_tasks);
+        chassis_tasks = NULL;
+
+        return_pending_tasks (tasks, chassis_type,
+                              (GBoxedCopyFunc) g_strdup, g_free,
+                              error);
+}
+
+static void
+chassis_type_get_cb (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+        g_autoptr(GVariant) variant = NULL;
+        g_autoptr(GVariant) inner = NULL;
+        g_autoptr(GError) error = NULL;
+
+        variant = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
+        if (variant == NULL) {
+                g_debug ("Failed to get property '%s': %s", "Chassis", error->message);
+                chassis_type_resolve (error);
+                return;
+        }
+
+        g_variant_get (variant, "(v)", &inner);
+        if (chassis_type == NULL)
+                chassis_type = g_variant_dup_string (inner, NULL);
+
+        chassis_type_resolve (NULL);
+}
+
+static void
+chassis_type_bus_cb (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+        g_autoptr(GDBusConnection) connection = NULL;
+        g_autoptr(GError) error = NULL;
+
+        connection = g_bus_get_finish (res, &error);
+        if (connection == NULL) {
+                g_warning ("system bus not available: %s", error->message);
+                chassis_type_resolve (error);
+                return;
+        }
+
+        g_dbus_connection_call (connection,
+                                "org.freedesktop.hostname1",
+                                "/org/freedesktop/hostname1",
+                                "org.freedesktop.DBus.Properties",
+                                "Get",
+                                g_variant_new ("(ss)",
+                                               "org.freedesktop.hostname1",
+                                               "Chassis"),
+                                G_VARIANT_TYPE ("(v)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                NULL,
+                                chassis_type_get_cb,
+                                NULL);
+}
+
+void
+gnome_settings_get_chassis_type_async (GCancellable        *cancellable,
+                                       GAsyncReadyCallback  callback,
+                                       gpointer             user_data)
+{
+        g_autoptr(GTask) task = NULL;
+
+        task = g_task_new (NULL, cancellable, callback, user_data);
+        g_task_set_source_tag (task, gnome_settings_get_chassis_type_async);
+
+        if (chassis_type != NULL) {
+                g_task_return_pointer (task, g_strdup (chassis_type), g_free);
+                return;
+        }
+
+        chassis_tasks = g_slist_prepend (chassis_tasks, g_object_ref (task));
+        if (chassis_tasks->next != NULL)
+                return;
+
+        g_bus_get (G_BUS_TYPE_SYSTEM, NULL, chassis_type_bus_cb, NULL);
+}
+
+char *
+gnome_settings_get_chassis_type_finish (GAsyncResult  *result,
+                                        GError       **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+        return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 static gpointer
 is_wayland_session (gpointer user_data)
 {
@@ -29,11 +29,31 @@
 
 G_BEGIN_DECLS
 
-GsdSessionManager        *gnome_settings_bus_get_session_proxy       (void);
-GsdScreenSaver           *gnome_settings_bus_get_screen_saver_proxy  (void);
-GsdShell                 *gnome_settings_bus_get_shell_proxy         (void);
-gboolean                  gnome_settings_is_wayland                  (void);
-char *                    gnome_settings_get_chassis_type            (void);
+GsdSessionManager        *gnome_settings_bus_get_session_proxy              (void);
+void                      gnome_settings_bus_get_session_proxy_async        (GCancellable        *cancellable,
+                                                                             GAsyncReadyCallback  callback,
+                                                                             gpointer             user_data);
+GsdSessionManager        *gnome_settings_bus_get_session_proxy_finish       (GAsyncResult        *result,
+                                                                             GError             **error);
+GsdScreenSaver           *gnome_settings_bus_get_screen_saver_proxy         (void);
+void                      gnome_settings_bus_get_screen_saver_proxy_async   (GCancellable        *cancellable,
+                                                                             GAsyncReadyCallback  callback,
+                                                                             gpointer             user_data);
+GsdScreenSaver           *gnome_settings_bus_get_screen_saver_proxy_finish  (GAsyncResult        *result,
+                                                                             GError             **error);
+GsdShell                 *gnome_settings_bus_get_shell_proxy                (void);
+void                      gnome_settings_bus_get_shell_proxy_async          (GCancellable        *cancellable,
+                                                                             GAsyncReadyCallback  callback,
+                                                                             gpointer             user_data);
+GsdShell                 *gnome_settings_bus_get_shell_proxy_finish         (GAsyncResult        *result,
+                                                                             GError             **error);
+gboolean                  gnome_settings_is_wayland                         (void);
+char *                    gnome_settings_get_chassis_type                   (void);
+void                      gnome_settings_get_chassis_type_async             (GCancellable        *cancellable,
+                                                                             GAsyncReadyCallback  callback,
+                                                                             gpointer             user_data);
+char *                    gnome_settings_get_chassis_type_finish            (GAsyncResult        *result,
+                                                                             GError             **error);
 
 G_END_DECLS
 
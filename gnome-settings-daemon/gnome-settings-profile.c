@@ -24,41 +24,213 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
-#include <signal.h>
-#include <time.h>
 #include <unistd.h>
+#include <sys/syscall.h>
 
 #include <glib.h>
-#include <glib/gstdio.h>
 
 #include "gnome-settings-profile.h"
 
+/*
+ * Marks are recorded in per-thread ring buffers when the GSD_PROFILE
+ * environment variable is set, and written out by
+ * gnome_settings_profile_dump() in the Trace Event JSON format, which
+ * Perfetto (ui.perfetto.dev) and chrome://tracing can open.
+ *
+ * Only the owning thread writes to a ring, so recording never takes a
+ * lock. Each slot carries a sequence number that is cleared while the
+ * slot is being written, which lets the dumper skip slots that were
+ * overwritten under its feet.
+ */
+
+#define RING_SIZE   2048
+#define DETAIL_SIZE 64
+
+typedef struct {
+        gint         seq;       /* index + 1 once written, 0 while writing */
+        gint64       time;
+        const char  *func;
+        const char  *note;
+        char         detail[DETAIL_SIZE];
+} ProfileEvent;
+
+typedef struct {
+        gint         tid;
+        gint         head;
+        ProfileEvent events[RING_SIZE];
+} ProfileRing;
+
+static gboolean enabled = FALSE;
+static GPrivate thread_ring;
+/* Rings are never freed, so the events of exited threads still get dumped */
+static GSList *rings = NULL;
+G_LOCK_DEFINE_STATIC (rings);
+
+static gboolean
+profile_enabled (void)
+{
+        static gsize initialized = 0;
+
+        if (g_once_init_enter (&initialized)) {
+                const char *env = g_getenv ("GSD_PROFILE");
+
+                enabled = env != NULL && *env != '\0';
+                g_once_init_leave (&initialized, 1);
+        }
+
+        return enabled;
+}
+
+static ProfileRing *
+get_thread_ring (void)
+{
+        ProfileRing *ring;
+
+        ring = g_private_get (&thread_ring);
+        if (G_LIKELY (ring != NULL))
+                return ring;
+
+        ring = g_new0 (ProfileRing, 1);
+        ring->tid = (gint) syscall (SYS_gettid);
+        g_private_set (&thread_ring, ring);
+
+        G_LOCK (rings);
+        rings = g_slist_prepend (rings, ring);
+        G_UNLOCK (rings);
+
+        return ring;
+}
+
 void
 _gnome_settings_profile_log (const char *func,
                              const char *note,
                              const char *format,
                              ...)
 {
-        va_list args;
-        char   *str;
-        char   *formatted;
+        ProfileRing  *ring;
+        ProfileEvent *event;
+        va_list       args;
+        gint          idx;
+
+        if (G_LIKELY (!profile_enabled ()))
+                return;
+
+        ring = get_thread_ring ();
+        idx = ring->head;
+        event = &ring->events[idx % RING_SIZE];
 
+        g_atomic_int_set (&event->seq, 0);
+
+        event->time = g_get_monotonic_time ();
+        event->func = func;
+        event->note = note;
         if (format == NULL) {
-                formatted = g_strdup ("");
+                event->detail[0] = '\0';
         } else {
                 va_start (args, format);
-                formatted = g_strdup_vprintf (format, args);
+                g_vsnprintf (event->detail, DETAIL_SIZE, format, args);
                 va_end (args);
         }
 
-        if (func != NULL) {
-                str = g_strdup_printf ("MARK: %s %s: %s %s", g_get_prgname(), func, note ? note : "", formatted);
-        } else {
-                str = g_strdup_printf ("MARK: %s: %s %s", g_get_prgname(), note ? note : "", formatted);
+        g_atomic_int_set (&event->seq, idx + 1);
+        g_atomic_int_set (&ring->head, idx + 1);
+}
+
+static void
+append_json_string (GString    *out,
+                    const char *str)
+{
+        const char *p;
+
+        g_string_append_c (out, '"');
+        for (p = str; *p != '\0'; p++) {
+                if (*p == '"' || *p == '\\')
+                        g_string_append_printf (out, "\\%c", *p);
+                else if ((guchar) *p < 0x20)
+                        g_string_append_printf (out, "\\u%04x", (guchar) *p);
+                else
+                        g_string_append_c (out, *p);
         }
+        g_string_append_c (out, '"');
+}
+
+static void
+append_ring (GString     *out,
+             ProfileRing *ring,
+             gint         pid,
+             gboolean    *first)
+{
+        gint head, idx;
+
+        head = g_atomic_int_get (&ring->head);
+        for (idx = MAX (0, head - RING_SIZE); idx < head; idx++) {
+                ProfileEvent *slot = &ring->events[idx % RING_SIZE];
+                ProfileEvent event;
+                const char *phase;
+
+                if (g_atomic_int_get (&slot->seq) != idx + 1)
+                        continue;
+                event = *slot;
+                /* Overwritten while we copied it */
+                if (g_atomic_int_get (&slot->seq) != idx + 1)
+                        continue;
+                event.detail[DETAIL_SIZE - 1] = '\0';
+
+                if (g_strcmp0 (event.note, "start") == 0)
+                        phase = "B";
+                else if (g_strcmp0 (event.note, "end") == 0)
+                        phase = "E";
+                else
+                        phase = "i";
+
+                g_string_append (out, *first ? "\n" : ",\n");
+                *first = FALSE;
+
+                g_string_append (out, "{\"name\":");
+                append_json_string (out, event.func ? event.func : event.detail);
+                g_string_append_printf (out,
+                                        ",\"cat\":\"gsd\",\"ph\":\"%s\",\"ts\":%" G_GINT64_FORMAT
+                                        ",\"pid\":%d,\"tid\":%d",
+                                        phase, event.time, pid, ring->tid);
+                if (*phase == 'i')
+                        g_string_append (out, ",\"s\":\"t\"");
+                if (event.detail[0] != '\0') {
+                        g_string_append (out, ",\"args\":{\"detail\":");
+                        append_json_string (out, event.detail);
+                        g_string_append_c (out, '}');
+                }
+                g_string_append_c (out, '}');
+        }
+}
+
+gboolean
+gnome_settings_profile_dump (const char  *filename,
+                             GError     **error)
+{
+        GString *out;
+        GSList *l;
+        gboolean first = TRUE;
+        gboolean ret;
+        gint pid;
+
+        if (!profile_enabled ()) {
+                g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                     "Profiling is disabled, set GSD_PROFILE to enable it");
+                return FALSE;
+        }
+
+        pid = getpid ();
+        out = g_string_new ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+        G_LOCK (rings);
+        for (l = rings; l != NULL; l = l->next)
+                append_ring (out, l->data, pid, &first);
+        G_UNLOCK (rings);
+
+        g_string_append (out, "\n]}\n");
 
-        g_free (formatted);
+        ret = g_file_set_contents (filename, out->str, out->len, error);
+        g_string_free (out, TRUE);
 
-        g_access (str, F_OK);
-        g_free (str);
+        return ret;
 }
@@ -22,11 +22,12 @@
 #ifndef __GNOME_SETTINGS_PROFILE_H
 #define __GNOME_SETTINGS_PROFILE_H
 
-#include <glib.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
-#ifdef ENABLE_PROFILING
+/* The marks are only recorded when GSD_PROFILE is set in the environment,
+ * and cost a single check otherwise. */
 #ifdef G_HAVE_ISO_VARARGS
 #define gnome_settings_profile_start(...) _gnome_settings_profile_log (G_STRFUNC, "start", __VA_ARGS__)
 #define gnome_settings_profile_end(...)   _gnome_settings_profile_log (G_STRFUNC, "end", __VA_ARGS__)
@@ -35,7 +36,6 @@ G_BEGIN_DECLS
 #define gnome_settings_profile_start(format...) _gnome_settings_profile_log (G_STRFUNC, "start", format)
 #define gnome_settings_profile_end(format...)   _gnome_settings_profile_log (G_STRFUNC, "end", format)
 #define gnome_settings_profile_msg(format...)   _gnome_settings_profile_log (NULL, NULL, format)
-#endif
 #else
 #define gnome_settings_profile_start(...)
 #define gnome_settings_profile_end(...)
@@ -47,6 +47,9 @@ void            _gnome_settings_profile_log    (const char *func,
                                                 const char *format,
                                                 ...) G_GNUC_PRINTF (3, 4);
 
+gboolean        gnome_settings_profile_dump    (const char  *filename,
+                                                GError     **error);
+
 G_END_DECLS
 
 #endif /* __GNOME_SETTINGS_PROFILE_H */
@@ -0,0 +1,379 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Main loop stall reporter, enabled by setting GSD_WATCHDOG to a
+ * threshold in milliseconds.
+ *
+ * A poll function installed on the default main context measures how
+ * long each main loop iteration spends outside of poll(), that is
+ * preparing, checking and dispatching sources. Every duration goes into
+ * a histogram; the ones above the threshold are logged and the worst of
+ * them kept.
+ *
+ * To find out who is blocking, a watchdog thread checks on the main
+ * thread while it is busy. Once an iteration runs past the threshold,
+ * it sends SIGURG to the main thread, whose handler records the name of
+ * the source being dispatched and a backtrace.
+ *
+ * The report can be fetched with the GetReport method of the
+ * org.gnome.SettingsDaemon.Watchdog interface, exported at
+ * /org/gnome/SettingsDaemon/Watchdog on the helper's session bus
+ * connection.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HAVE_BACKTRACE
+#include <execinfo.h>
+#endif
+
+#include <gio/gio.h>
+
+#include "gnome-settings-watchdog.h"
+
+#define WATCHDOG_DBUS_PATH      "/org/gnome/SettingsDaemon/Watchdog"
+#define N_BUCKETS               12      /* <1ms, <2ms, ... <1024ms, more */
+#define MAX_STALLS              10
+#define MAX_FRAMES              32
+
+static const gchar introspection_xml[] =
+"<node>"
+"  <interface name='org.gnome.SettingsDaemon.Watchdog'>"
+"    <method name='GetReport'>"
+"      <arg type='x' name='threshold' direction='out'/>"
+"      <arg type='a(tt)' name='histogram' direction='out'/>"
+"      <arg type='a(sxxs)' name='stalls' direction='out'/>"
+"    </method>"
+"  </interface>"
+"</node>";
+
+typedef struct {
+        gchar  *source;
+        gint64  duration;
+        gint64  time;
+        gchar  *backtrace;
+} Stall;
+
+static GPollFunc orig_poll = NULL;
+static gint64 threshold = 0;
+static pthread_t main_thread;
+
+/* Shared with the watchdog thread */
+static GMutex lock;
+static gint64 iteration_start = 0;      /* 0 while polling */
+static volatile guint iteration = 0;
+
+/* Written by the signal handler, which runs on the main thread */
+static volatile guint sample_iteration = 0;
+static gchar sample_source[64];
+#if HAVE_BACKTRACE
+static void *sample_frames[MAX_FRAMES];
+static volatile gint sample_n_frames = 0;
+#endif
+
+/* Only used from the main thread */
+static guint64 histogram[N_BUCKETS];
+static GArray *stalls = NULL;
+
+static void
+stall_clear (Stall *stall)
+{
+        g_free (stall->source);
+        g_free (stall->backtrace);
+}
+
+static void
+sample_handler (int signum G_GNUC_UNUSED)
+{
+        GSource *source;
+        const gchar *name = NULL;
+
+#if HAVE_BACKTRACE
+        sample_n_frames = backtrace (sample_frames, MAX_FRAMES);
+#endif
+
+        /* Not async-signal-safe strictly speaking, but this only reads
+         * the main context state of the thread we interrupted. */
+        source = g_main_current_source ();
+        if (source != NULL)
+                name = g_source_get_name (source);
+        g_strlcpy (sample_source, name ? name : "(unnamed source)", sizeof (sample_source));
+
+        sample_iteration = iteration;
+}
+
+static gchar *
+format_backtrace (void)
+{
+#if HAVE_BACKTRACE
+        GString *str;
+        gchar **symbols;
+        gint i;
+
+        symbols = backtrace_symbols (sample_frames, sample_n_frames);
+        if (symbols == NULL)
+                return g_strdup ("");
+
+        str = g_string_new (NULL);
+        /* Skip the signal handler and the signal frame */
+        for (i = 2; i < sample_n_frames; i++)
+                g_string_append_printf (str, "%s%s", str->len > 0 ? "\n" : "", symbols[i]);
+        free (symbols);
+
+        return g_string_free (str, FALSE);
+#else
+        return g_strdup ("");
+#endif
+}
+
+static gint
+stall_compare (gconstpointer a,
+               gconstpointer b)
+{
+        const Stall *stall_a = a;
+        const Stall *stall_b = b;
+
+        if (stall_a->duration == stall_b->duration)
+                return 0;
+        return stall_a->duration > stall_b->duration ? -1 : 1;
+}
+
+static void
+record_iteration (gint64 duration)
+{
+        Stall stall;
+        guint64 ms;
+        guint bucket;
+
+        ms = duration / 1000;
+        bucket = ms == 0 ? 0 : MIN (g_bit_storage (ms), N_BUCKETS - 1);
+        histogram[bucket]++;
+
+        if (duration < threshold)
+                return;
+
+        if (sample_iteration == iteration) {
+                stall.source = g_strdup (sample_source);
+                stall.backtrace = format_backtrace ();
+        } else {
+                /* The watchdog thread did not catch it in time */
+                stall.source = g_strdup ("(unknown)");
+                stall.backtrace = g_strdup ("");
+        }
+        stall.duration = duration;
+        stall.time = g_get_real_time ();
+
+        g_message ("Main loop stalled for %" G_GINT64_FORMAT " ms in %s%s%s",
+                   duration / 1000, stall.source,
+                   *stall.backtrace ? ":\n" : "", stall.backtrace);
+
+        if (stalls->len == MAX_STALLS) {
+                Stall *last = &g_array_index (stalls, Stall, stalls->len - 1);
+
+                if (last->duration >= duration) {
+                        stall_clear (&stall);
+                        return;
+                }
+                g_array_remove_index (stalls, stalls->len - 1);
+        }
+        g_array_append_val (stalls, stall);
+        g_array_sort (stalls, stall_compare);
+}
+
+static gint
+watchdog_poll (GPollFD *ufds,
+               guint    nfds,
+               gint     timeout)
+{
+        gint64 start;
+        gint ret;
+
+        g_mutex_lock (&lock);
+        start = iteration_start;
+        iteration_start = 0;
+        g_mutex_unlock (&lock);
+
+        if (start != 0)
+                record_iteration (g_get_monotonic_time () - start);
+
+        ret = orig_poll (ufds, nfds, timeout);
+
+        g_mutex_lock (&lock);
+        iteration++;
+        iteration_start = g_get_monotonic_time ();
+        g_mutex_unlock (&lock);
+
+        return ret;
+}
+
+static gpointer
+watchdog_thread (gpointer user_data G_GNUC_UNUSED)
+{
+        guint sampled_iteration = 0;
+
+        while (TRUE) {
+                gint64 start;
+                guint current;
+
+                g_usleep (threshold / 2);
+
+                g_mutex_lock (&lock);
+                start = iteration_start;
+                current = iteration;
+                g_mutex_unlock (&lock);
+
+                if (start == 0 ||
+                    current == sampled_iteration ||
+                    g_get_monotonic_time () - start < threshold)
+                        continue;
+
+                sampled_iteration = current;
+                pthread_kill (main_thread, SIGURG);
+        }
+
+        return NULL;
+}
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+        GVariantBuilder histogram_builder;
+        GVariantBuilder stalls_builder;
+        guint i;
+
+        if (g_strcmp0 (method_name, "GetReport") != 0)
+                return;
+
+        g_variant_builder_init (&histogram_builder, G_VARIANT_TYPE ("a(tt)"));
+        for (i = 0; i < N_BUCKETS; i++) {
+                guint64 upper_ms = i < N_BUCKETS - 1 ? (guint64) 1 << i : G_MAXUINT64;
+
+                g_variant_builder_add (&histogram_builder, "(tt)", upper_ms, histogram[i]);
+        }
+
+        g_variant_builder_init (&stalls_builder, G_VARIANT_TYPE ("a(sxxs)"));
+        for (i = 0; i < stalls->len; i++) {
+                Stall *stall = &g_array_index (stalls, Stall, i);
+
+                g_variant_builder_add (&stalls_builder, "(sxxs)",
+                                       stall->source, stall->duration,
+                                       stall->time, stall->backtrace);
+        }
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(xa(tt)a(sxxs))",
+                                                              threshold,
+                                                              &histogram_builder,
+                                                              &stalls_builder));
+}
+
+static const GDBusInterfaceVTable interface_vtable =
+{
+        handle_method_call,
+        NULL,
+        NULL
+};
+
+static void
+on_bus_gotten (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data G_GNUC_UNUSED)
+{
+        g_autoptr(GDBusConnection) connection = NULL;
+        g_autoptr(GDBusNodeInfo) introspection_data = NULL;
+        g_autoptr(GError) error = NULL;
+
+        connection = g_bus_get_finish (res, &error);
+        if (connection == NULL) {
+                g_warning ("Could not get session bus: %s", error->message);
+                return;
+        }
+
+        introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+        g_assert (introspection_data != NULL);
+
+        if (g_dbus_connection_register_object (connection,
+                                               WATCHDOG_DBUS_PATH,
+                                               introspection_data->interfaces[0],
+                                               &interface_vtable,
+                                               NULL, NULL,
+                                               &error) == 0)
+                g_warning ("Failed to export the watchdog report: %s", error->message);
+}
+
+void
+gnome_settings_watchdog_start (void)
+{
+        struct sigaction action;
+        const gchar *env;
+        GMainContext *context;
+        gint64 threshold_ms;
+        GThread *thread;
+
+        env = g_getenv ("GSD_WATCHDOG");
+        if (env == NULL || *env == '\0')
+                return;
+
+        threshold_ms = g_ascii_strtoll (env, NULL, 10);
+        if (threshold_ms <= 0) {
+                g_warning ("Invalid GSD_WATCHDOG threshold '%s'", env);
+                return;
+        }
+
+        g_return_if_fail (orig_poll == NULL);
+
+        threshold = threshold_ms * 1000;
+        stalls = g_array_new (FALSE, FALSE, sizeof (Stall));
+        main_thread = pthread_self ();
+
+#if HAVE_BACKTRACE
+        /* backtrace() may allocate the first time it is called, which
+         * must not happen in the signal handler. */
+        sample_n_frames = backtrace (sample_frames, MAX_FRAMES);
+#endif
+
+        memset (&action, 0, sizeof (action));
+        action.sa_handler = sample_handler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset (&action.sa_mask);
+        sigaction (SIGURG, &action, NULL);
+
+        context = g_main_context_default ();
+        orig_poll = g_main_context_get_poll_func (context);
+        g_main_context_set_poll_func (context, watchdog_poll);
+
+        thread = g_thread_new ("gsd-watchdog", watchdog_thread, NULL);
+        g_thread_unref (thread);
+
+        g_bus_get (G_BUS_TYPE_SESSION, NULL, on_bus_gotten, NULL);
+
+        g_debug ("Main loop watchdog started, reporting stalls over %" G_GINT64_FORMAT " ms",
+                 threshold_ms);
+}
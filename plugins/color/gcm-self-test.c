@@ -23,7 +23,10 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "gcm-edid.h"
 #include "gsd-color-state.h"
@@ -49,6 +52,131 @@ quit_mainloop (gpointer user_data)
     return FALSE;
 }
 
+/* See tests/gsdbenchmark.py for the format */
+static void
+benchmark_record (const gchar *name,
+                  gdouble      value,
+                  const gchar *unit)
+{
+        const gchar *output = g_getenv ("GSD_BENCHMARK_OUTPUT");
+        const gchar *version = g_getenv ("GSD_VERSION");
+        gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+        g_autoptr(GString) line = NULL;
+        FILE *f;
+
+        if (output == NULL || *output == '\0')
+                return;
+
+        line = g_string_new (NULL);
+        g_string_append_printf (line, "{\"name\": \"%s\", \"suite\": \"color\", \"unit\": \"%s\", \"value\": %s",
+                                name, unit, g_ascii_formatd (buf, sizeof (buf), "%.3f", value));
+        if (version != NULL)
+                g_string_append_printf (line, ", \"version\": \"%s\"", version);
+        g_string_append (line, "}\n");
+
+        f = fopen (output, "a");
+        g_assert_nonnull (f);
+        fputs (line->str, f);
+        fclose (f);
+}
+
+static void
+on_transition_notify (GsdNightLight *nlight,
+                      GParamSpec    *pspec,
+                      gpointer       user_data)
+{
+        guint *cnt = (guint *) user_data;
+
+        (*cnt)++;
+        if (fabs (gsd_night_light_get_temperature (nlight) - 4000) < 0.5)
+                g_main_loop_quit (mainloop);
+}
+
+static void
+gcm_test_night_light_transition_perf (void)
+{
+        gboolean ret;
+        guint temperature_cnt = 0;
+        clock_t cpu_start;
+        gdouble cpu_ms;
+        gdouble elapsed;
+        guint timeout_id;
+        g_autoptr(GDateTime) datetime_override = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GsdNightLight) nlight = NULL;
+        g_autoptr(GSettings) settings = NULL;
+
+        nlight = gsd_night_light_new ();
+        datetime_override = g_date_time_new_utc (2017, 2, 8, 20, 0, 0);
+        gsd_night_light_set_date_time_now (nlight, datetime_override);
+        gsd_night_light_set_geoclue_enabled (nlight, FALSE);
+
+        settings = g_settings_new ("org.gnome.settings-daemon.plugins.color");
+        g_settings_set_boolean (settings, "night-light-enabled", FALSE);
+        g_settings_set_boolean (settings, "night-light-schedule-automatic", FALSE);
+        g_settings_set_double (settings, "night-light-schedule-from", 16.0);
+        g_settings_set_double (settings, "night-light-schedule-to", 8.0);
+        g_settings_set_uint (settings, "night-light-temperature", 4000);
+
+        ret = gsd_night_light_start (nlight, &error);
+        g_assert_no_error (error);
+        g_assert (ret);
+
+        g_signal_connect (nlight, "notify::temperature",
+                          G_CALLBACK (on_transition_notify), &temperature_cnt);
+
+        /* Enabling night light smoothly transitions to the night temperature */
+        gsd_night_light_set_smooth_enabled (nlight, TRUE);
+        timeout_id = g_timeout_add_seconds (30, quit_mainloop, NULL);
+
+        g_test_timer_start ();
+        cpu_start = clock ();
+        g_settings_set_boolean (settings, "night-light-enabled", TRUE);
+        g_main_loop_run (mainloop);
+        cpu_ms = (clock () - cpu_start) * 1000.0 / CLOCKS_PER_SEC;
+        elapsed = g_test_timer_elapsed ();
+
+        g_source_remove (timeout_id);
+        g_assert_cmpint (gsd_night_light_get_temperature (nlight), ==, 4000);
+
+        g_test_minimized_result (cpu_ms, "transition used %.1f ms of CPU time", cpu_ms);
+        g_test_minimized_result (temperature_cnt, "transition took %u steps in %.1f s",
+                                 temperature_cnt, elapsed);
+
+        benchmark_record ("night-light-transition-cpu", cpu_ms, "ms");
+        benchmark_record ("night-light-transition-steps", temperature_cnt, "count");
+}
+
+static void
+gcm_test_blackbody (void)
+{
+        CdColorRGB expected;
+        CdColorRGB result;
+        guint temperature;
+
+        /* every entry and every interpolated value in between */
+        for (temperature = GSD_COLOR_TEMPERATURE_MIN;
+             temperature <= GSD_COLOR_TEMPERATURE_MAX;
+             temperature += 7) {
+                g_assert (cd_color_get_blackbody_rgb_full (temperature,
+                                                           &expected,
+                                                           CD_COLOR_BLACKBODY_FLAG_USE_PLANCKIAN));
+                g_assert (gsd_night_light_get_blackbody_rgb (temperature, &result));
+                g_assert_cmpfloat (fabs (result.R - expected.R), <, 0.001);
+                g_assert_cmpfloat (fabs (result.G - expected.G), <, 0.001);
+                g_assert_cmpfloat (fabs (result.B - expected.B), <, 0.001);
+        }
+
+        /* the limits */
+        g_assert (gsd_night_light_get_blackbody_rgb (GSD_COLOR_TEMPERATURE_MAX, &result));
+        g_assert (gsd_night_light_get_blackbody_rgb (GSD_COLOR_TEMPERATURE_DEFAULT, &result));
+        g_assert_cmpfloat (fabs (result.R - 1.0), <, 0.01);
+        g_assert_cmpfloat (fabs (result.G - 1.0), <, 0.01);
+        g_assert_cmpfloat (fabs (result.B - 1.0), <, 0.01);
+        g_assert (!gsd_night_light_get_blackbody_rgb (GSD_COLOR_TEMPERATURE_MIN - 1, &result));
+        g_assert (!gsd_night_light_get_blackbody_rgb (GSD_COLOR_TEMPERATURE_MAX + 1, &result));
+}
+
 static void
 gcm_test_night_light (void)
 {
@@ -423,7 +551,10 @@ main (int argc, char **argv)
         g_test_add_func ("/color/sunset-sunrise", gcm_test_sunset_sunrise);
         g_test_add_func ("/color/sunset-sunrise/fractional-timezone", gcm_test_sunset_sunrise_fractional_timezone);
         g_test_add_func ("/color/fractional-day", gcm_test_frac_day);
+        g_test_add_func ("/color/blackbody", gcm_test_blackbody);
         g_test_add_func ("/color/night-light", gcm_test_night_light);
+        if (g_test_perf ())
+                g_test_add_func ("/color/night-light/transition", gcm_test_night_light_transition_perf);
 
         return g_test_run ();
 }
@@ -23,7 +23,9 @@
 #include <glib/gi18n.h>
 #include <colord.h>
 #include <gdk/gdk.h>
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <lcms2.h>
 #include <canberra-gtk.h>
 
@@ -38,6 +40,7 @@
 
 #include "gsd-color-manager.h"
 #include "gsd-color-state.h"
+#include "gsd-night-light-common.h"
 #include "gcm-edid.h"
 
 #define GSD_DBUS_NAME "org.gnome.SettingsDaemon"
@@ -55,10 +58,15 @@ struct _GsdColorState
         CdClient        *client;
         GnomeRRScreen   *state_screen;
         GHashTable      *edid_cache;
+        GHashTable      *edid_profiles_pending;
         GdkWindow       *gdk_window;
+        gchar           *icc_profile_checksum;
         gboolean         session_is_active;
         GHashTable      *device_assign_hash;
+        GHashTable      *xrandr_devices;
         guint            color_temperature;
+        guint            gamma_temperature;
+        GHashTable      *crtc_ramps;
 };
 
 static void     gsd_color_state_class_init  (GsdColorStateClass *klass);
@@ -71,11 +79,41 @@ G_DEFINE_TYPE (GsdColorState, gsd_color_state, G_TYPE_OBJECT)
 #define GCM_ICC_PROFILE_IN_X_VERSION_MAJOR      0
 #define GCM_ICC_PROFILE_IN_X_VERSION_MINOR      3
 
+/* A gamma ramp in the layout gnome_rr_crtc_set_gamma() wants */
 typedef struct {
-        guint32          red;
-        guint32          green;
-        guint32          blue;
-} GnomeRROutputClutItem;
+        guint            size;
+        guint16         *red;
+        guint16         *green;
+        guint16         *blue;
+} GcmGammaRamp;
+
+static GcmGammaRamp *
+gcm_gamma_ramp_new (guint size)
+{
+        GcmGammaRamp *ramp;
+
+        /* one block for the three channels */
+        ramp = g_malloc (sizeof (GcmGammaRamp) + 3 * size * sizeof (guint16));
+        ramp->size = size;
+        ramp->red = (guint16 *) (ramp + 1);
+        ramp->green = ramp->red + size;
+        ramp->blue = ramp->green + size;
+        return ramp;
+}
+
+static void
+gcm_gamma_ramp_free (GcmGammaRamp *ramp)
+{
+        g_free (ramp);
+}
+
+static gboolean
+gcm_gamma_ramp_equal (const GcmGammaRamp *a, const GcmGammaRamp *b)
+{
+        if (a->size != b->size)
+                return FALSE;
+        return memcmp (a->red, b->red, 3 * a->size * sizeof (guint16)) == 0;
+}
 
 GQuark
 gsd_color_state_error_quark (void)
@@ -93,16 +131,8 @@ gcm_session_get_output_edid (GsdColorState *state, GnomeRROutput *output, GError
         gsize size;
         GcmEdid *edid = NULL;
         gboolean ret;
+        gchar *checksum;
 
-        /* can we find it in the cache */
-        edid = g_hash_table_lookup (state->edid_cache,
-                                    gnome_rr_output_get_name (output));
-        if (edid != NULL) {
-                g_object_ref (edid);
-                return edid;
-        }
-
-        /* parse edid */
         data = gnome_rr_output_get_edid_data (output, &size);
         if (data == NULL || size == 0) {
                 g_set_error_literal (error,
@@ -111,16 +141,30 @@ gcm_session_get_output_edid (GsdColorState *state, GnomeRROutput *output, GError
                                      "unable to get EDID for output");
                 return NULL;
         }
+
+        /* can we find it in the cache, by contents so that a different
+         * monitor plugged into the same connector is not mistaken for
+         * the previous one */
+        checksum = g_compute_checksum_for_data (G_CHECKSUM_MD5, data, size);
+        edid = g_hash_table_lookup (state->edid_cache, checksum);
+        if (edid != NULL) {
+                g_free (checksum);
+                g_object_ref (edid);
+                return edid;
+        }
+
+        /* parse edid */
         edid = gcm_edid_new ();
         ret = gcm_edid_parse (edid, data, size, error);
         if (!ret) {
+                g_free (checksum);
                 g_object_unref (edid);
                 return NULL;
         }
 
         /* add to cache */
         g_hash_table_insert (state->edid_cache,
-                             g_strdup (gnome_rr_output_get_name (output)),
+                             checksum,
                              g_object_ref (edid));
 
         return edid;
@@ -131,8 +175,10 @@ gcm_session_screen_set_icc_profile (GsdColorState *state,
                                     const gchar *filename,
                                     GError **error)
 {
-        gchar *data = NULL;
+        GMappedFile *mapped;
+        const gchar *data;
         gsize length;
+        gchar *checksum;
         guint version_data;
 
         g_return_val_if_fail (filename != NULL, FALSE);
@@ -143,11 +189,25 @@ gcm_session_screen_set_icc_profile (GsdColorState *state,
                 return TRUE;
         }
 
-        g_debug ("setting root window ICC profile atom from %s", filename);
-
-        /* get contents of file */
-        if (!g_file_get_contents (filename, &data, &length, error))
+        /* map the file rather than copying it, profiles can be large */
+        mapped = g_mapped_file_new (filename, FALSE, error);
+        if (mapped == NULL)
                 return FALSE;
+        data = g_mapped_file_get_contents (mapped);
+        length = g_mapped_file_get_length (mapped);
+
+        /* colord reassigns the same profile on every device change */
+        checksum = g_compute_checksum_for_data (G_CHECKSUM_MD5,
+                                                (const guchar *) data,
+                                                length);
+        if (g_strcmp0 (checksum, state->icc_profile_checksum) == 0) {
+                g_debug ("root window ICC profile atom already set from %s", filename);
+                g_free (checksum);
+                g_mapped_file_unref (mapped);
+                return TRUE;
+        }
+
+        g_debug ("setting root window ICC profile atom from %s", filename);
 
         /* set profile property */
         gdk_property_change (state->gdk_window,
@@ -156,6 +216,8 @@ gcm_session_screen_set_icc_profile (GsdColorState *state,
                              8,
                              GDK_PROP_MODE_REPLACE,
                              (const guchar *) data, length);
+        g_free (state->icc_profile_checksum);
+        state->icc_profile_checksum = checksum;
 
         /* set version property */
         version_data = GCM_ICC_PROFILE_IN_X_VERSION_MAJOR * 100 +
@@ -167,10 +229,27 @@ gcm_session_screen_set_icc_profile (GsdColorState *state,
                              GDK_PROP_MODE_REPLACE,
                              (const guchar *) &version_data, 1);
 
-        g_free (data);
+        g_mapped_file_unref (mapped);
         return TRUE;
 }
 
+static gboolean
+gcm_session_temperature_changes_ramps (guint old_temperature, guint new_temperature)
+{
+        CdColorRGB old_rgb;
+        CdColorRGB new_rgb;
+        gdouble quantum = 1.f / 0xffff;
+
+        if (!gsd_night_light_get_blackbody_rgb (old_temperature, &old_rgb) ||
+            !gsd_night_light_get_blackbody_rgb (new_temperature, &new_rgb))
+                return TRUE;
+
+        /* the ramps are these factors times at most 0xffff */
+        return fabs (old_rgb.R - new_rgb.R) >= quantum ||
+               fabs (old_rgb.G - new_rgb.G) >= quantum ||
+               fabs (old_rgb.B - new_rgb.B) >= quantum;
+}
+
 void
 gsd_color_state_set_temperature (GsdColorState *state, guint temperature)
 {
@@ -180,6 +259,14 @@ gsd_color_state_set_temperature (GsdColorState *state, guint temperature)
                 return;
 
         state->color_temperature = temperature;
+
+        /* small steps of a transition may not change the ramps at all */
+        if (!gcm_session_temperature_changes_ramps (state->gamma_temperature, temperature)) {
+                g_debug ("change from %uK to %uK is below one gamma step, ignoring",
+                         state->gamma_temperature, temperature);
+                return;
+        }
+
         gcm_session_set_gamma_for_all_devices (state);
 }
 
@@ -291,8 +378,7 @@ out:
 }
 
 static gboolean
-gcm_get_system_icc_profile (GsdColorState *state,
-                            GFile *file)
+gcm_get_system_icc_profile (GFile *file)
 {
         const char efi_path[] = "/sys/firmware/efi/efivars/INTERNAL_PANEL_COLOR_INFO-01e1ada1-79f2-46b3-8d3e-71fc0996ca6b";
         /* efi variables have a 4-byte header */
@@ -343,13 +429,35 @@ gcm_get_system_icc_profile (GsdColorState *state,
         return TRUE;
 }
 
+/* Everything needed to create a profile, as it is done in a thread */
+typedef struct {
+        GcmEdid         *edid;
+        GFile           *file;
+        gchar           *checksum;
+        gchar           *device_id;
+        gchar           *system_model;
+        gchar           *system_vendor;
+        gboolean         is_builtin;
+} GcmSessionProfileJob;
+
+static void
+gcm_session_profile_job_free (GcmSessionProfileJob *job)
+{
+        g_object_unref (job->edid);
+        g_object_unref (job->file);
+        g_free (job->checksum);
+        g_free (job->device_id);
+        g_free (job->system_model);
+        g_free (job->system_vendor);
+        g_free (job);
+}
+
 static gboolean
-gcm_apply_create_icc_profile_for_edid (GsdColorState *state,
-                                       CdDevice *device,
-                                       GcmEdid *edid,
-                                       GFile *file,
+gcm_apply_create_icc_profile_for_edid (GcmSessionProfileJob *job,
                                        GError **error)
 {
+        GcmEdid *edid = job->edid;
+        GFile *file = job->file;
         CdIcc *icc = NULL;
         const gchar *data;
         gboolean ret = FALSE;
@@ -379,7 +487,7 @@ gcm_apply_create_icc_profile_for_edid (GsdColorState *state,
         /* set model and title */
         data = gcm_edid_get_monitor_name (edid);
         if (data == NULL)
-                data = cd_client_get_system_model (state->client);
+                data = job->system_model;
         if (data == NULL)
                 data = "Unknown monitor";
         cd_icc_set_model (icc, NULL, data);
@@ -388,7 +496,7 @@ gcm_apply_create_icc_profile_for_edid (GsdColorState *state,
         /* get manufacturer */
         data = gcm_edid_get_vendor_name (edid);
         if (data == NULL)
-                data = cd_client_get_system_vendor (state->client);
+                data = job->system_vendor;
         if (data == NULL)
                 data = "Unknown vendor";
         cd_icc_set_manufacturer (icc, NULL, data);
@@ -405,7 +513,7 @@ gcm_apply_create_icc_profile_for_edid (GsdColorState *state,
                              PACKAGE_VERSION);
         cd_icc_add_metadata (icc,
                              CD_PROFILE_METADATA_MAPPING_DEVICE_ID,
-                             cd_device_get_id (device));
+                             job->device_id);
 
         /* set 'ICC meta Tag for Monitor Profiles' data */
         cd_icc_add_metadata (icc, CD_PROFILE_METADATA_EDID_MD5, gcm_edid_get_checksum (edid));
@@ -432,11 +540,10 @@ out:
         return ret;
 }
 
-static GPtrArray *
+static GcmGammaRamp *
 gcm_session_generate_vcgt (CdProfile *profile, guint color_temperature, guint size)
 {
-        GnomeRROutputClutItem *tmp;
-        GPtrArray *array = NULL;
+        GcmGammaRamp *ramp = NULL;
         const cmsToneCurve **vcgt;
         cmsFloat32Number in;
         guint i;
@@ -462,9 +569,7 @@ gcm_session_generate_vcgt (CdProfile *profile, guint color_temperature, guint si
         }
 
         /* get the color temperature */
-        if (!cd_color_get_blackbody_rgb_full (color_temperature,
-                                              &temp,
-                                              CD_COLOR_BLACKBODY_FLAG_USE_PLANCKIAN)) {
+        if (!gsd_night_light_get_blackbody_rgb (color_temperature, &temp)) {
                 g_warning ("failed to get blackbody for %uK", color_temperature);
                 cd_color_rgb_set (&temp, 1.0, 1.0, 1.0);
         } else {
@@ -472,103 +577,119 @@ gcm_session_generate_vcgt (CdProfile *profile, guint color_temperature, guint si
                          color_temperature, temp.R, temp.G, temp.B);
         }
 
-        /* create array */
-        array = g_ptr_array_new_with_free_func (g_free);
+        /* create ramp */
+        ramp = gcm_gamma_ramp_new (size);
         for (i = 0; i < size; i++) {
                 in = (gdouble) i / (gdouble) (size - 1);
-                tmp = g_new0 (GnomeRROutputClutItem, 1);
-                tmp->red = cmsEvalToneCurveFloat(vcgt[0], in) * temp.R * (gdouble) 0xffff;
-                tmp->green = cmsEvalToneCurveFloat(vcgt[1], in) * temp.G * (gdouble) 0xffff;
-                tmp->blue = cmsEvalToneCurveFloat(vcgt[2], in) * temp.B * (gdouble) 0xffff;
-                g_ptr_array_add (array, tmp);
+                ramp->red[i] = cmsEvalToneCurveFloat(vcgt[0], in) * temp.R * (gdouble) 0xffff;
+                ramp->green[i] = cmsEvalToneCurveFloat(vcgt[1], in) * temp.G * (gdouble) 0xffff;
+                ramp->blue[i] = cmsEvalToneCurveFloat(vcgt[2], in) * temp.B * (gdouble) 0xffff;
         }
 out:
         if (icc != NULL)
                 g_object_unref (icc);
-        return array;
+        return ramp;
 }
 
 static guint
-gnome_rr_output_get_gamma_size (GnomeRROutput *output)
+gnome_rr_output_get_gamma_size (GsdColorState *state, GnomeRROutput *output)
 {
         GnomeRRCrtc *crtc;
+        GcmGammaRamp *current;
         gint len = 0;
 
         crtc = gnome_rr_output_get_crtc (output);
         if (crtc == NULL)
                 return 0;
+
+        /* avoid the round trip if we wrote a ramp to it already */
+        current = g_hash_table_lookup (state->crtc_ramps,
+                                       GUINT_TO_POINTER (gnome_rr_crtc_get_id (crtc)));
+        if (current != NULL)
+                return current->size;
+
         gnome_rr_crtc_get_gamma (crtc,
                                  &len,
                                  NULL, NULL, NULL);
         return (guint) len;
 }
 
+/* Takes ownership of the ramp */
 static gboolean
-gcm_session_output_set_gamma (GnomeRROutput *output,
-                              GPtrArray *array,
+gcm_session_output_set_gamma (GsdColorState *state,
+                              GnomeRROutput *output,
+                              GcmGammaRamp *ramp,
                               GError **error)
 {
-        gboolean ret = TRUE;
-        guint16 *red = NULL;
-        guint16 *green = NULL;
-        guint16 *blue = NULL;
-        guint i;
-        GnomeRROutputClutItem *data;
+        GcmGammaRamp *current;
         GnomeRRCrtc *crtc;
+        guint32 crtc_id;
 
         /* no length? */
-        if (array->len == 0) {
-                ret = FALSE;
+        if (ramp->size == 0) {
                 g_set_error_literal (error,
                                      GSD_COLOR_MANAGER_ERROR,
                                      GSD_COLOR_MANAGER_ERROR_FAILED,
                                      "no data in the CLUT array");
-                goto out;
-        }
-
-        /* convert to a type X understands */
-        red = g_new (guint16, array->len);
-        green = g_new (guint16, array->len);
-        blue = g_new (guint16, array->len);
-        for (i = 0; i < array->len; i++) {
-                data = g_ptr_array_index (array, i);
-                red[i] = data->red;
-                green[i] = data->green;
-                blue[i] = data->blue;
+                gcm_gamma_ramp_free (ramp);
+                return FALSE;
         }
 
         /* send to LUT */
         crtc = gnome_rr_output_get_crtc (output);
         if (crtc == NULL) {
-                ret = FALSE;
                 g_set_error (error,
                              GSD_COLOR_MANAGER_ERROR,
                              GSD_COLOR_MANAGER_ERROR_FAILED,
                              "failed to get ctrc for %s",
                              gnome_rr_output_get_name (output));
-                goto out;
+                gcm_gamma_ramp_free (ramp);
+                return FALSE;
         }
-        gnome_rr_crtc_set_gamma (crtc, array->len,
-                                 red, green, blue);
-out:
-        g_free (red);
-        g_free (green);
-        g_free (blue);
-        return ret;
+
+        /* the same as last time, or as written for a clone on the same CRTC */
+        crtc_id = gnome_rr_crtc_get_id (crtc);
+        current = g_hash_table_lookup (state->crtc_ramps, GUINT_TO_POINTER (crtc_id));
+        if (current != NULL && gcm_gamma_ramp_equal (current, ramp)) {
+                g_debug ("gamma of CRTC %u for %s is unchanged",
+                         crtc_id, gnome_rr_output_get_name (output));
+                gcm_gamma_ramp_free (ramp);
+                return TRUE;
+        }
+
+        gnome_rr_crtc_set_gamma (crtc, ramp->size,
+                                 ramp->red, ramp->green, ramp->blue);
+        g_hash_table_insert (state->crtc_ramps, GUINT_TO_POINTER (crtc_id), ramp);
+        return TRUE;
+}
+
+/* the ramp of the CRTC is going to be changed behind our back */
+static void
+gcm_session_output_forget_gamma (GsdColorState *state,
+                                 GnomeRROutput *output)
+{
+        GnomeRRCrtc *crtc;
+
+        crtc = gnome_rr_output_get_crtc (output);
+        if (crtc == NULL)
+                return;
+        g_hash_table_remove (state->crtc_ramps,
+                             GUINT_TO_POINTER (gnome_rr_crtc_get_id (crtc)));
 }
 
 static gboolean
-gcm_session_device_set_gamma (GnomeRROutput *output,
+gcm_session_device_set_gamma (GsdColorState *state,
+                              GnomeRROutput *output,
                               CdProfile *profile,
                               guint color_temperature,
                               GError **error)
 {
         gboolean ret = FALSE;
         guint size;
-        GPtrArray *clut = NULL;
+        GcmGammaRamp *clut = NULL;
 
         /* create a lookup table */
-        size = gnome_rr_output_get_gamma_size (output);
+        size = gnome_rr_output_get_gamma_size (state, output);
         if (size == 0) {
                 ret = TRUE;
                 goto out;
@@ -583,41 +704,31 @@ gcm_session_device_set_gamma (GnomeRROutput *output,
         }
 
         /* apply the vcgt to this output */
-        ret = gcm_session_output_set_gamma (output, clut, error);
-        if (!ret)
-                goto out;
+        ret = gcm_session_output_set_gamma (state, output, clut, error);
 out:
-        if (clut != NULL)
-                g_ptr_array_unref (clut);
         return ret;
 }
 
 static gboolean
-gcm_session_device_reset_gamma (GnomeRROutput *output,
+gcm_session_device_reset_gamma (GsdColorState *state,
+                                GnomeRROutput *output,
                                 guint color_temperature,
                                 GError **error)
 {
-        gboolean ret;
         guint i;
         guint size;
         guint32 value;
-        GPtrArray *clut;
-        GnomeRROutputClutItem *data;
+        GcmGammaRamp *clut;
         CdColorRGB temp;
 
         /* create a linear ramp */
         g_debug ("falling back to dummy ramp");
-        clut = g_ptr_array_new_with_free_func (g_free);
-        size = gnome_rr_output_get_gamma_size (output);
-        if (size == 0) {
-                ret = TRUE;
-                goto out;
-        }
+        size = gnome_rr_output_get_gamma_size (state, output);
+        if (size == 0)
+                return TRUE;
 
         /* get the color temperature */
-        if (!cd_color_get_blackbody_rgb_full (color_temperature,
-                                              &temp,
-                                              CD_COLOR_BLACKBODY_FLAG_USE_PLANCKIAN)) {
+        if (!gsd_night_light_get_blackbody_rgb (color_temperature, &temp)) {
                 g_warning ("failed to get blackbody for %uK", color_temperature);
                 cd_color_rgb_set (&temp, 1.0, 1.0, 1.0);
         } else {
@@ -625,22 +736,16 @@ gcm_session_device_reset_gamma (GnomeRROutput *output,
                          color_temperature, temp.R, temp.G, temp.B);
         }
 
+        clut = gcm_gamma_ramp_new (size);
         for (i = 0; i < size; i++) {
                 value = (i * 0xffff) / (size - 1);
-                data = g_new0 (GnomeRROutputClutItem, 1);
-                data->red = value * temp.R;
-                data->green = value * temp.G;
-                data->blue = value * temp.B;
-                g_ptr_array_add (clut, data);
+                clut->red[i] = value * temp.R;
+                clut->green[i] = value * temp.G;
+                clut->blue[i] = value * temp.B;
         }
 
         /* apply the vcgt to this output */
-        ret = gcm_session_output_set_gamma (output, clut, error);
-        if (!ret)
-                goto out;
-out:
-        g_ptr_array_unref (clut);
-        return ret;
+        return gcm_session_output_set_gamma (state, output, clut, error);
 }
 
 static GnomeRROutput *
@@ -817,7 +922,8 @@ gcm_session_device_assign_profile_connect_cb (GObject *object,
         /* create a vcgt for this icc file */
         ret = cd_profile_get_has_vcgt (profile);
         if (ret) {
-                ret = gcm_session_device_set_gamma (output,
+                ret = gcm_session_device_set_gamma (state,
+                                                    output,
                                                     profile,
                                                     state->color_temperature,
                                                     &error);
@@ -829,7 +935,8 @@ gcm_session_device_assign_profile_connect_cb (GObject *object,
                         goto out;
                 }
         } else {
-                ret = gcm_session_device_reset_gamma (output,
+                ret = gcm_session_device_reset_gamma (state,
+                                                      output,
                                                       state->color_temperature,
                                                       &error);
                 if (!ret) {
@@ -870,6 +977,101 @@ out:
         return ret;
 }
 
+static void
+gcm_session_create_profile_thread (GTask        *task,
+                                   gpointer      source_object,
+                                   gpointer      task_data,
+                                   GCancellable *cancellable)
+{
+        GcmSessionProfileJob *job = task_data;
+        g_autofree gchar *path = g_file_get_path (job->file);
+        GError *error = NULL;
+
+        /* check if auto-profile has up-to-date metadata */
+        if (gcm_session_check_profile_device_md (job->file)) {
+                g_debug ("auto-profile edid %s exists with md", path);
+                g_task_return_boolean (task, TRUE);
+                return;
+        }
+
+        g_debug ("auto-profile edid does not exist, creating as %s", path);
+
+        /* check if the system has a built-in profile */
+        if (job->is_builtin && gcm_get_system_icc_profile (job->file)) {
+                g_task_return_boolean (task, TRUE);
+                return;
+        }
+
+        /* try creating one from the EDID */
+        if (!gcm_apply_create_icc_profile_for_edid (job, &error)) {
+                g_task_return_error (task, error);
+                return;
+        }
+
+        g_task_return_boolean (task, TRUE);
+}
+
+static void
+gcm_session_create_profile_cb (GObject      *object,
+                               GAsyncResult *res,
+                               gpointer      user_data)
+{
+        GsdColorState *state = GSD_COLOR_STATE (object);
+        GcmSessionProfileJob *job = g_task_get_task_data (G_TASK (res));
+        GError *error = NULL;
+
+        g_hash_table_remove (state->edid_profiles_pending, job->checksum);
+
+        /* colord picks up the new profile on its own, and lets us know
+         * through the device-changed signal */
+        if (!g_task_propagate_boolean (G_TASK (res), &error)) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("failed to create profile from EDID data: %s",
+                                   error->message);
+                g_error_free (error);
+        }
+}
+
+/* Ensures the auto-profile for the EDID of the output exists, without
+ * blocking, and only once for all the outputs showing the same EDID. */
+static void
+gcm_session_ensure_edid_profile (GsdColorState *state,
+                                 CdDevice *device,
+                                 GnomeRROutput *output,
+                                 GcmEdid *edid)
+{
+        GcmSessionProfileJob *job;
+        g_autoptr(GTask) task = NULL;
+        g_autofree gchar *autogen_filename = NULL;
+        g_autofree gchar *autogen_path = NULL;
+        const gchar *checksum = gcm_edid_get_checksum (edid);
+
+        if (g_hash_table_contains (state->edid_profiles_pending, checksum)) {
+                g_debug ("auto-profile for edid %s already being created", checksum);
+                return;
+        }
+
+        autogen_filename = g_strdup_printf ("edid-%s.icc", checksum);
+        autogen_path = g_build_filename (g_get_user_data_dir (),
+                                         "icc", autogen_filename, NULL);
+
+        job = g_new0 (GcmSessionProfileJob, 1);
+        job->edid = g_object_ref (edid);
+        job->file = g_file_new_for_path (autogen_path);
+        job->checksum = g_strdup (checksum);
+        job->device_id = g_strdup (cd_device_get_id (device));
+        job->system_model = g_strdup (cd_client_get_system_model (state->client));
+        job->system_vendor = g_strdup (cd_client_get_system_vendor (state->client));
+        job->is_builtin = gnome_rr_output_is_builtin_display (output);
+
+        g_hash_table_add (state->edid_profiles_pending, g_strdup (checksum));
+
+        task = g_task_new (state, state->cancellable, gcm_session_create_profile_cb, NULL);
+        g_task_set_source_tag (task, gcm_session_ensure_edid_profile);
+        g_task_set_task_data (task, job, (GDestroyNotify) gcm_session_profile_job_free);
+        g_task_run_in_thread (task, gcm_session_create_profile_thread);
+}
+
 static void
 gcm_session_device_assign_connect_cb (GObject *object,
                                       GAsyncResult *res,
@@ -878,13 +1080,11 @@ gcm_session_device_assign_connect_cb (GObject *object,
         CdDeviceKind kind;
         CdProfile *profile = NULL;
         gboolean ret;
-        gchar *autogen_filename = NULL;
-        gchar *autogen_path = NULL;
         GcmEdid *edid = NULL;
         GnomeRROutput *output = NULL;
         GError *error = NULL;
-        GFile *file = NULL;
         const gchar *xrandr_id;
+        const gchar *xrandr_name;
         GcmSessionAsyncHelper *helper;
         CdDevice *device = CD_DEVICE (object);
         GsdColorState *state = GSD_COLOR_STATE (user_data);
@@ -910,6 +1110,14 @@ gcm_session_device_assign_connect_cb (GObject *object,
         g_debug ("need to assign display device %s",
                  cd_device_get_id (device));
 
+        /* remember it, so outputs can be resolved without asking colord */
+        xrandr_name = cd_device_get_metadata_item (device, CD_DEVICE_METADATA_XRANDR_NAME);
+        if (xrandr_name != NULL) {
+                g_hash_table_insert (state->xrandr_devices,
+                                     g_strdup (xrandr_name),
+                                     g_object_ref (device));
+        }
+
         /* get the GnomeRROutput for the device id */
         xrandr_id = cd_device_get_id (device);
         output = gcm_session_get_state_output_by_id (state,
@@ -932,38 +1140,7 @@ gcm_session_device_assign_connect_cb (GObject *object,
                 g_clear_error (&error);
 
         } else {
-                autogen_filename = g_strdup_printf ("edid-%s.icc",
-                                                    gcm_edid_get_checksum (edid));
-                autogen_path = g_build_filename (g_get_user_data_dir (),
-                                                 "icc", autogen_filename, NULL);
-
-                /* check if auto-profile has up-to-date metadata */
-                file = g_file_new_for_path (autogen_path);
-                if (gcm_session_check_profile_device_md (file)) {
-                        g_debug ("auto-profile edid %s exists with md", autogen_path);
-                } else {
-                        g_debug ("auto-profile edid does not exist, creating as %s",
-                                 autogen_path);
-
-                        /* check if the system has a built-in profile */
-                        ret = gnome_rr_output_is_builtin_display (output) &&
-                              gcm_get_system_icc_profile (state, file);
-
-                        /* try creating one from the EDID */
-                        if (!ret) {
-                                ret = gcm_apply_create_icc_profile_for_edid (state,
-                                                                             device,
-                                                                             edid,
-                                                                             file,
-                                                                             &error);
-                        }
-
-                        if (!ret) {
-                                g_warning ("failed to create profile from EDID data: %s",
-                                             error->message);
-                                g_clear_error (&error);
-                        }
-                }
+                gcm_session_ensure_edid_profile (state, device, output, edid);
         }
 
         /* get the default profile for the device */
@@ -979,12 +1156,18 @@ gcm_session_device_assign_connect_cb (GObject *object,
                                              gdk_atom_intern_static_string ("_ICC_PROFILE"));
                         gdk_property_delete (state->gdk_window,
                                              gdk_atom_intern_static_string ("_ICC_PROFILE_IN_X_VERSION"));
+                        g_clear_pointer (&state->icc_profile_checksum, g_free);
                 }
 
-                /* reset, as we want linear profiles for profiling */
-                ret = gcm_session_device_reset_gamma (output,
+                /* reset, as we want linear profiles for profiling; the
+                 * calibrator owns the CRTC ramp from now on, so always
+                 * write it and don't trust the cached one afterwards */
+                gcm_session_output_forget_gamma (state, output);
+                ret = gcm_session_device_reset_gamma (state,
+                                                      output,
                                                       state->color_temperature,
                                                       &error);
+                gcm_session_output_forget_gamma (state, output);
                 if (!ret) {
                         g_warning ("failed to reset %s gamma tables: %s",
                                    cd_device_get_id (device),
@@ -1005,10 +1188,6 @@ gcm_session_device_assign_connect_cb (GObject *object,
                             gcm_session_device_assign_profile_connect_cb,
                             helper);
 out:
-        g_free (autogen_filename);
-        g_free (autogen_path);
-        if (file != NULL)
-                g_object_unref (file);
         if (edid != NULL)
                 g_object_unref (edid);
         if (profile != NULL)
@@ -1054,6 +1233,43 @@ gcm_session_device_changed_assign_cb (CdClient *client,
         gcm_session_device_assign (state, device);
 }
 
+static gboolean
+gcm_session_device_has_object_path (gpointer key,
+                                    gpointer value,
+                                    gpointer user_data)
+{
+        return g_strcmp0 (cd_device_get_object_path (CD_DEVICE (value)),
+                          (const gchar *) user_data) == 0;
+}
+
+static void
+gcm_session_device_removed_cb (CdClient *client,
+                               CdDevice *device,
+                               GsdColorState *state)
+{
+        /* the client creates a new object for each signal */
+        g_hash_table_foreach_remove (state->xrandr_devices,
+                                     gcm_session_device_has_object_path,
+                                     (gpointer) cd_device_get_object_path (device));
+}
+
+static void
+gcm_session_screen_removed_delete_device_cb (GObject *object, GAsyncResult *res, gpointer user_data)
+{
+        gboolean ret;
+        GError *error = NULL;
+
+        /* deleted device */
+        ret = cd_client_delete_device_finish (CD_CLIENT (object),
+                                              res,
+                                              &error);
+        if (!ret) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("failed to delete device: %s", error->message);
+                g_error_free (error);
+        }
+}
+
 static void
 gcm_session_create_device_cb (GObject *object,
                               GAsyncResult *res,
@@ -1085,6 +1301,7 @@ gcm_session_add_state_output (GsdColorState *state, GnomeRROutput *output)
         const gchar *vendor = NULL;
         gboolean ret;
         gchar *device_id = NULL;
+        CdDevice *device;
         GcmEdid *edid;
         GError *error = NULL;
         GHashTable *device_props = NULL;
@@ -1096,6 +1313,29 @@ gcm_session_add_state_output (GsdColorState *state, GnomeRROutput *output)
                 return;
         }
 
+        device_id = gcm_session_get_output_id (state, output);
+
+        /* colord would only tell us it already exists, unless another
+         * monitor was plugged into the same connector meanwhile */
+        device = output_name != NULL ?
+                g_hash_table_lookup (state->xrandr_devices, output_name) : NULL;
+        if (device != NULL) {
+                if (g_strcmp0 (cd_device_get_id (device), device_id) == 0) {
+                        g_debug ("output %s already has a device", output_name);
+                        g_free (device_id);
+                        return;
+                }
+
+                g_debug ("output %s now has %s instead of %s",
+                         output_name, device_id, cd_device_get_id (device));
+                cd_client_delete_device (state->client,
+                                         device,
+                                         state->cancellable,
+                                         gcm_session_screen_removed_delete_device_cb,
+                                         state);
+                g_hash_table_remove (state->xrandr_devices, output_name);
+        }
+
         /* try to get edid */
         edid = gcm_session_get_output_edid (state, output, &error);
         if (edid == NULL) {
@@ -1130,7 +1370,6 @@ gcm_session_add_state_output (GsdColorState *state, GnomeRROutput *output)
         if (serial == NULL)
                 serial = "unknown";
 
-        device_id = gcm_session_get_output_id (state, output);
         g_debug ("output %s added", device_id);
         device_props = g_hash_table_new_full (g_str_hash, g_str_equal,
                                               NULL, NULL);
@@ -1195,23 +1434,6 @@ gnome_rr_screen_output_added_cb (GnomeRRScreen *screen,
         gcm_session_add_state_output (state, output);
 }
 
-static void
-gcm_session_screen_removed_delete_device_cb (GObject *object, GAsyncResult *res, gpointer user_data)
-{
-        gboolean ret;
-        GError *error = NULL;
-
-        /* deleted device */
-        ret = cd_client_delete_device_finish (CD_CLIENT (object),
-                                              res,
-                                              &error);
-        if (!ret) {
-                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-                        g_warning ("failed to delete device: %s", error->message);
-                g_error_free (error);
-        }
-}
-
 static void
 gcm_session_screen_removed_find_device_cb (GObject *object, GAsyncResult *res, gpointer user_data)
 {
@@ -1243,10 +1465,25 @@ gnome_rr_screen_output_removed_cb (GnomeRRScreen *screen,
                                    GnomeRROutput *output,
                                    GsdColorState *state)
 {
+        CdDevice *device;
+
         g_debug ("output %s removed",
                  gnome_rr_output_get_name (output));
-        g_hash_table_remove (state->edid_cache,
-                             gnome_rr_output_get_name (output));
+
+        device = g_hash_table_lookup (state->xrandr_devices,
+                                      gnome_rr_output_get_name (output));
+        if (device != NULL) {
+                cd_client_delete_device (state->client,
+                                         device,
+                                         state->cancellable,
+                                         gcm_session_screen_removed_delete_device_cb,
+                                         state);
+                g_hash_table_remove (state->xrandr_devices,
+                                     gnome_rr_output_get_name (output));
+                return;
+        }
+
+        /* colord may not have told us about the device yet */
         cd_client_find_device_by_property (state->client,
                                            CD_DEVICE_METADATA_XRANDR_NAME,
                                            gnome_rr_output_get_name (output),
@@ -1280,42 +1517,14 @@ gcm_session_get_devices_cb (GObject *object, GAsyncResult *res, gpointer user_da
                 g_ptr_array_unref (array);
 }
 
-static void
-gcm_session_profile_gamma_find_device_cb (GObject *object,
-                                          GAsyncResult *res,
-                                          gpointer user_data)
-{
-        CdClient *client = CD_CLIENT (object);
-        CdDevice *device = NULL;
-        GError *error = NULL;
-        GsdColorState *state = GSD_COLOR_STATE (user_data);
-
-        device = cd_client_find_device_by_property_finish (client,
-                                                           res,
-                                                           &error);
-        if (device == NULL) {
-                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-                        g_warning ("could not find device: %s", error->message);
-                g_error_free (error);
-                return;
-        }
-
-        /* get properties */
-        cd_device_connect (device,
-                           state->cancellable,
-                           gcm_session_device_assign_connect_cb,
-                           state);
-
-        if (device != NULL)
-                g_object_unref (device);
-}
-
 static void
 gcm_session_set_gamma_for_all_devices (GsdColorState *state)
 {
         GnomeRROutput **outputs;
         guint i;
 
+        state->gamma_temperature = state->color_temperature;
+
         /* setting the temperature before we get the list of devices is fine,
          * as we use the temperature in the calculation */
         if (state->state_screen == NULL)
@@ -1328,13 +1537,14 @@ gcm_session_set_gamma_for_all_devices (GsdColorState *state)
                 return;
         }
         for (i = 0; outputs[i] != NULL; i++) {
-                /* get CdDevice for this output */
-                cd_client_find_device_by_property (state->client,
-                                                   CD_DEVICE_METADATA_XRANDR_NAME,
-                                                   gnome_rr_output_get_name (outputs[i]),
-                                                   state->cancellable,
-                                                   gcm_session_profile_gamma_find_device_cb,
-                                                   state);
+                CdDevice *device;
+
+                /* get CdDevice for this output, devices colord did not
+                 * tell us about yet get assigned when it does */
+                device = g_hash_table_lookup (state->xrandr_devices,
+                                              gnome_rr_output_get_name (outputs[i]));
+                if (device != NULL)
+                        gcm_session_device_assign (state, device);
         }
 }
 
@@ -1345,6 +1555,8 @@ static void
 gnome_rr_screen_output_changed_cb (GnomeRRScreen *screen,
                                    GsdColorState *state)
 {
+        /* the CRTCs may have been reassigned, and their ramps reset */
+        g_hash_table_remove_all (state->crtc_ramps);
         gcm_session_set_gamma_for_all_devices (state);
 }
 
@@ -1390,6 +1602,8 @@ gcm_session_active_changed_cb (GDBusProxy      *session,
          */
         if (is_active && !state->session_is_active) {
                 g_debug ("Done switch to new account, reload devices");
+                /* the other session may have written the ramps meanwhile */
+                g_hash_table_remove_all (state->crtc_ramps);
                 cd_client_get_devices (state->client,
                                        state->cancellable,
                                        gcm_session_get_devices_cb,
@@ -1465,6 +1679,9 @@ gcm_session_client_connect_cb (GObject *source_object,
         g_signal_connect (state->client, "device-changed",
                           G_CALLBACK (gcm_session_device_changed_assign_cb),
                           state);
+        g_signal_connect (state->client, "device-removed",
+                          G_CALLBACK (gcm_session_device_removed_cb),
+                          state);
 
         /* set for each device that already exist */
         cd_client_get_devices (state->client,
@@ -1544,20 +1761,39 @@ gsd_color_state_init (GsdColorState *state)
                 state->gdk_window = gdk_screen_get_root_window (gdk_screen_get_default ());
 #endif
 
-        /* parsing the EDID is expensive */
+        /* parsing the EDID is expensive, keyed by the EDID checksum */
         state->edid_cache = g_hash_table_new_full (g_str_hash,
                                                   g_str_equal,
                                                   g_free,
                                                   g_object_unref);
 
+        /* the EDID checksums auto-profiles are being created for */
+        state->edid_profiles_pending = g_hash_table_new_full (g_str_hash,
+                                                             g_str_equal,
+                                                             g_free,
+                                                             NULL);
+
         /* we don't want to assign devices multiple times at startup */
         state->device_assign_hash = g_hash_table_new_full (g_str_hash,
                                                           g_str_equal,
                                                           g_free,
                                                           NULL);
 
+        /* the display devices colord knows about, keyed by xrandr name */
+        state->xrandr_devices = g_hash_table_new_full (g_str_hash,
+                                                      g_str_equal,
+                                                      g_free,
+                                                      g_object_unref);
+
         /* default color temperature */
         state->color_temperature = GSD_COLOR_TEMPERATURE_DEFAULT;
+        state->gamma_temperature = GSD_COLOR_TEMPERATURE_DEFAULT;
+
+        /* the ramps last written, so that unchanged ones are skipped */
+        state->crtc_ramps = g_hash_table_new_full (g_direct_hash,
+                                                  g_direct_equal,
+                                                  NULL,
+                                                  (GDestroyNotify) gcm_gamma_ramp_free);
 
         state->client = cd_client_new ();
 }
@@ -1577,7 +1813,11 @@ gsd_color_state_finalize (GObject *object)
         g_clear_object (&state->client);
         g_clear_object (&state->session);
         g_clear_pointer (&state->edid_cache, g_hash_table_destroy);
+        g_clear_pointer (&state->edid_profiles_pending, g_hash_table_destroy);
+        g_clear_pointer (&state->crtc_ramps, g_hash_table_destroy);
+        g_clear_pointer (&state->icc_profile_checksum, g_free);
         g_clear_pointer (&state->device_assign_hash, g_hash_table_destroy);
+        g_clear_pointer (&state->xrandr_devices, g_hash_table_destroy);
         g_clear_object (&state->state_screen);
 
         G_OBJECT_CLASS (gsd_color_state_parent_class)->finalize (object);
@@ -22,6 +22,7 @@
 #include <glib.h>
 #include <math.h>
 
+#include "gsd-color-state.h"
 #include "gsd-night-light-common.h"
 
 static gdouble
@@ -135,3 +136,69 @@ gsd_night_light_frac_day_is_between (gdouble  value,
          */
         return value >= start && value < end;
 }
+
+/* The blackbody table is generated from colord's when first used, and
+ * interpolated between its entries */
+#define BLACKBODY_STEP      10      /* Kelvin */
+#define BLACKBODY_SIZE      ((GSD_COLOR_TEMPERATURE_MAX - GSD_COLOR_TEMPERATURE_MIN) / BLACKBODY_STEP + 1)
+
+static const CdColorRGB *
+blackbody_get_table (void)
+{
+        static CdColorRGB *table = NULL;
+
+        if (g_once_init_enter (&table)) {
+                CdColorRGB *tmp;
+                guint i;
+
+                tmp = g_new (CdColorRGB, BLACKBODY_SIZE);
+                for (i = 0; i < BLACKBODY_SIZE; i++) {
+                        guint temperature = GSD_COLOR_TEMPERATURE_MIN + i * BLACKBODY_STEP;
+
+                        if (!cd_color_get_blackbody_rgb_full (temperature,
+                                                              &tmp[i],
+                                                              CD_COLOR_BLACKBODY_FLAG_USE_PLANCKIAN)) {
+                                g_warning ("failed to get blackbody for %uK", temperature);
+                                cd_color_rgb_set (&tmp[i], 1.0, 1.0, 1.0);
+                        }
+                }
+                g_once_init_leave (&table, tmp);
+        }
+
+        return table;
+}
+
+/**
+ * gsd_night_light_get_blackbody_rgb:
+ * @temperature: the color temperature, in Kelvin
+ * @result: (out): the RGB of a blackbody at that temperature
+ *
+ * Same as cd_color_get_blackbody_rgb_full() with
+ * %CD_COLOR_BLACKBODY_FLAG_USE_PLANCKIAN, but using a table.
+ *
+ * Returns: %FALSE if the temperature is out of range
+ **/
+gboolean
+gsd_night_light_get_blackbody_rgb (guint temperature, CdColorRGB *result)
+{
+        const CdColorRGB *table;
+        guint index;
+        guint remainder;
+
+        if (temperature < GSD_COLOR_TEMPERATURE_MIN ||
+            temperature > GSD_COLOR_TEMPERATURE_MAX)
+                return FALSE;
+
+        table = blackbody_get_table ();
+        index = (temperature - GSD_COLOR_TEMPERATURE_MIN) / BLACKBODY_STEP;
+        remainder = (temperature - GSD_COLOR_TEMPERATURE_MIN) % BLACKBODY_STEP;
+        if (remainder == 0) {
+                cd_color_rgb_copy (&table[index], result);
+                return TRUE;
+        }
+
+        cd_color_rgb_interpolate (&table[index], &table[index + 1],
+                                  (gdouble) remainder / BLACKBODY_STEP,
+                                  result);
+        return TRUE;
+}
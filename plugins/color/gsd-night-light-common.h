@@ -21,6 +21,7 @@
 #define __GSD_NIGHT_LIGHT_COMMON_H
 
 #include <glib-object.h>
+#include <colord.h>
 
 G_BEGIN_DECLS
 
@@ -33,6 +34,8 @@ gdouble  gsd_night_light_frac_day_from_dt       (GDateTime      *dt);
 gboolean gsd_night_light_frac_day_is_between    (gdouble         value,
                                                  gdouble         start,
                                                  gdouble         end);
+gboolean gsd_night_light_get_blackbody_rgb      (guint           temperature,
+                                                 CdColorRGB     *result);
 
 G_END_DECLS
 
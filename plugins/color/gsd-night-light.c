@@ -20,6 +20,8 @@
 
 #include "config.h"
 
+#include <math.h>
+
 #include <geoclue.h>
 
 #define GNOME_DESKTOP_USE_UNSTABLE_API
@@ -37,6 +39,7 @@ struct _GsdNightLight {
         gboolean           disabled_until_tmw;
         GDateTime         *disabled_until_tmw_dt;
         gboolean           geoclue_enabled;
+        gboolean           running;
         GSource           *source;
         guint              validate_id;
         GClueClient       *geoclue_client;
@@ -49,6 +52,7 @@ struct _GsdNightLight {
         gboolean           smooth_enabled;
         GTimer            *smooth_timer;
         guint              smooth_id;
+        gdouble            smooth_start_temperature;
         gdouble            smooth_target_temperature;
         GCancellable      *cancellable;
         GDateTime         *datetime_override;
@@ -66,9 +70,11 @@ enum {
 };
 
 #define GSD_NIGHT_LIGHT_SCHEDULE_TIMEOUT      5       /* seconds */
-#define GSD_NIGHT_LIGHT_POLL_TIMEOUT          60      /* seconds */
+#define GSD_NIGHT_LIGHT_POLL_TIMEOUT_MIN      1       /* seconds */
+#define GSD_NIGHT_LIGHT_POLL_TIMEOUT_MAX      3600    /* seconds */
 #define GSD_NIGHT_LIGHT_POLL_SMEAR            1       /* hours */
 #define GSD_NIGHT_LIGHT_SMOOTH_SMEAR          5.f     /* seconds */
+#define GSD_NIGHT_LIGHT_STEP_MIRED            2.f     /* micro reciprocal degrees */
 
 #define GSD_FRAC_DAY_MAX_DELTA                  (1.f/60.f)     /* 1 minute */
 #define GSD_TEMPERATURE_MAX_DELTA               (10.f)          /* Kelvin */
@@ -76,7 +82,7 @@ enum {
 #define DESKTOP_ID "gnome-color-panel"
 
 static void poll_timeout_destroy (GsdNightLight *self);
-static void poll_timeout_create (GsdNightLight *self);
+static void poll_timeout_create (GsdNightLight *self, gdouble seconds);
 static void night_light_recheck (GsdNightLight *self);
 
 G_DEFINE_TYPE (GsdNightLight, gsd_night_light, G_TYPE_OBJECT);
@@ -128,6 +134,25 @@ linear_interpolate (gdouble val1, gdouble val2, gdouble factor)
         return ((val1 - val2) * factor) + val2;
 }
 
+/* The smallest change worth applying around @temperature, as perceived
+ * color differences are roughly uniform in mireds rather than Kelvin */
+static gdouble
+night_light_temperature_step (gdouble temperature)
+{
+        gdouble step = temperature * temperature * GSD_NIGHT_LIGHT_STEP_MIRED / 1000000.f;
+        return MAX (step, GSD_TEMPERATURE_MAX_DELTA + 1.f);
+}
+
+/* hours from @value until the day reaches @end */
+static gdouble
+frac_day_until (gdouble value, gdouble end)
+{
+        gdouble hours = fmod (end - value, 24.f);
+        if (hours < 0.f)
+                hours += 24.f;
+        return hours;
+}
+
 static gboolean
 update_cached_sunrise_sunset (GsdNightLight *self)
 {
@@ -176,38 +201,61 @@ gsd_night_light_set_temperature_internal (GsdNightLight *self, gdouble temperatu
         g_object_notify (G_OBJECT (self), "temperature");
 }
 
+static gboolean gsd_night_light_smooth_cb (gpointer user_data);
+
+/* sleep until the linear transition next moves the temperature by a
+ * perceptible step, rather than waking up at a fixed rate */
+static void
+poll_smooth_schedule (GsdNightLight *self)
+{
+        gdouble delta;
+        gdouble done;
+        gdouble next;
+
+        delta = ABS (self->smooth_target_temperature - self->smooth_start_temperature);
+        done = ABS (self->cached_temperature - self->smooth_start_temperature);
+        next = (done + night_light_temperature_step (self->cached_temperature)) / delta;
+        next = MIN (next, 1.f) * GSD_NIGHT_LIGHT_SMOOTH_SMEAR;
+        next -= g_timer_elapsed (self->smooth_timer, NULL);
+
+        self->smooth_id = g_timeout_add (MAX (ceil (next * 1000.f), 0),
+                                         gsd_night_light_smooth_cb, self);
+        g_source_set_name_by_id (self->smooth_id, "[gnome-settings-daemon] gsd_night_light_smooth_cb");
+}
+
 static gboolean
 gsd_night_light_smooth_cb (gpointer user_data)
 {
         GsdNightLight *self = GSD_NIGHT_LIGHT (user_data);
-        gdouble tmp;
         gdouble frac;
 
+        self->smooth_id = 0;
+
         /* find fraction */
         frac = g_timer_elapsed (self->smooth_timer, NULL) / GSD_NIGHT_LIGHT_SMOOTH_SMEAR;
         if (frac >= 1.f) {
                 gsd_night_light_set_temperature_internal (self,
                                                           self->smooth_target_temperature);
-                self->smooth_id = 0;
                 return G_SOURCE_REMOVE;
         }
 
-        /* set new temperature step using log curve */
-        tmp = self->smooth_target_temperature - self->cached_temperature;
-        tmp *= frac;
-        tmp += self->cached_temperature;
-        gsd_night_light_set_temperature_internal (self, tmp);
+        gsd_night_light_set_temperature_internal (self,
+                                                  linear_interpolate (self->smooth_target_temperature,
+                                                                      self->smooth_start_temperature,
+                                                                      frac));
+        poll_smooth_schedule (self);
 
-        return G_SOURCE_CONTINUE;
+        return G_SOURCE_REMOVE;
 }
 
 static void
 poll_smooth_create (GsdNightLight *self, gdouble temperature)
 {
         g_assert (self->smooth_id == 0);
+        self->smooth_start_temperature = self->cached_temperature;
         self->smooth_target_temperature = temperature;
         self->smooth_timer = g_timer_new ();
-        self->smooth_id = g_timeout_add (50, gsd_night_light_smooth_cb, self);
+        poll_smooth_schedule (self);
 }
 
 static void
@@ -246,13 +294,17 @@ gsd_night_light_set_active (GsdNightLight *self, gboolean active)
         g_object_notify (G_OBJECT (self), "active");
 }
 
-static void
-night_light_recheck (GsdNightLight *self)
+/* Returns the hours until the temperature next needs to change,
+ * or a negative value if only a settings change can do that */
+static gdouble
+night_light_update (GsdNightLight *self)
 {
         gdouble frac_day;
         gdouble schedule_from = -1.f;
         gdouble schedule_to = -1.f;
         gdouble smear = GSD_NIGHT_LIGHT_POLL_SMEAR; /* hours */
+        gdouble next;
+        gdouble rate = 0.f; /* Kelvin per hour */
         guint temperature;
         guint temp_smeared;
         g_autoptr(GDateTime) dt_now = gsd_night_light_get_date_time_now (self);
@@ -262,14 +314,14 @@ night_light_recheck (GsdNightLight *self)
         if (self->forced) {
                 temperature = g_settings_get_uint (self->settings, "night-light-temperature");
                 gsd_night_light_set_temperature (self, temperature);
-                return;
+                return -1.f;
         }
 
         /* enabled */
         if (!g_settings_get_boolean (self->settings, "night-light-enabled")) {
                 g_debug ("night light disabled, resetting");
                 gsd_night_light_set_active (self, FALSE);
-                return;
+                return -1.f;
         }
 
         /* calculate the position of the sun */
@@ -326,7 +378,7 @@ night_light_recheck (GsdNightLight *self)
                         g_debug ("night light still day-disabled, resetting");
                         gsd_night_light_set_temperature (self,
                                                          GSD_COLOR_TEMPERATURE_DEFAULT);
-                        return;
+                        return frac_day_until (frac_day, schedule_to);
                 }
         }
 
@@ -340,7 +392,7 @@ night_light_recheck (GsdNightLight *self)
                                                   schedule_to)) {
                 g_debug ("not time for night-light");
                 gsd_night_light_set_active (self, FALSE);
-                return;
+                return frac_day_until (frac_day, schedule_from - smear);
         }
 
         /* smear the temperature for a short duration before the set limits
@@ -357,25 +409,51 @@ night_light_recheck (GsdNightLight *self)
         if (smear < 0.01) {
                 /* Don't try to smear for extremely short or zero periods */
                 temp_smeared = temperature;
+                next = frac_day_until (frac_day, schedule_to);
         } else if (gsd_night_light_frac_day_is_between (frac_day,
                                                         schedule_from - smear,
                                                         schedule_from)) {
                 gdouble factor = 1.f - ((frac_day - (schedule_from - smear)) / smear);
                 temp_smeared = linear_interpolate (GSD_COLOR_TEMPERATURE_DEFAULT,
                                                    temperature, factor);
+                rate = ABS ((gdouble) GSD_COLOR_TEMPERATURE_DEFAULT - temperature) / smear;
+                next = frac_day_until (frac_day, schedule_from);
         } else if (gsd_night_light_frac_day_is_between (frac_day,
                                                         schedule_to - smear,
                                                         schedule_to)) {
                 gdouble factor = (frac_day - (schedule_to - smear)) / smear;
                 temp_smeared = linear_interpolate (GSD_COLOR_TEMPERATURE_DEFAULT,
                                                    temperature, factor);
+                rate = ABS ((gdouble) GSD_COLOR_TEMPERATURE_DEFAULT - temperature) / smear;
+                next = frac_day_until (frac_day, schedule_to);
         } else {
                 temp_smeared = temperature;
+                next = frac_day_until (frac_day, schedule_to - smear);
         }
+
+        /* within a smear, wake up once the temperature moved by a
+         * perceptible step */
+        if (rate > 0.f)
+                next = MIN (next, night_light_temperature_step (temp_smeared) / rate);
+
         g_debug ("night light mode on, using temperature of %uK (aiming for %uK)",
                  temp_smeared, temperature);
         gsd_night_light_set_active (self, TRUE);
         gsd_night_light_set_temperature (self, temp_smeared);
+        return next;
+}
+
+static void
+night_light_recheck (GsdNightLight *self)
+{
+        gdouble next = night_light_update (self);
+
+        /* aim the poll at the next schedule boundary */
+        if (!self->running)
+                return;
+        poll_timeout_destroy (self);
+        if (next >= 0.f)
+                poll_timeout_create (self, next * 3600.f);
 }
 
 static gboolean
@@ -405,17 +483,15 @@ night_light_recheck_cb (gpointer user_data)
 {
         GsdNightLight *self = GSD_NIGHT_LIGHT (user_data);
 
-        /* recheck parameters, then reschedule a new timeout */
+        /* recheck parameters, which reschedules a new timeout */
         night_light_recheck (self);
-        poll_timeout_destroy (self);
-        poll_timeout_create (self);
 
         /* return value ignored for a one-time watch */
         return G_SOURCE_REMOVE;
 }
 
 static void
-poll_timeout_create (GsdNightLight *self)
+poll_timeout_create (GsdNightLight *self, gdouble seconds)
 {
         g_autoptr(GDateTime) dt_now = NULL;
         g_autoptr(GDateTime) dt_expiry = NULL;
@@ -423,10 +499,17 @@ poll_timeout_create (GsdNightLight *self)
         if (self->source != NULL)
                 return;
 
+        /* The source fires early when the clock is set, but still wake up
+         * once in a while in case the time zone changed */
+        seconds = CLAMP (seconds,
+                         GSD_NIGHT_LIGHT_POLL_TIMEOUT_MIN,
+                         GSD_NIGHT_LIGHT_POLL_TIMEOUT_MAX);
+        g_debug ("next night light recheck in %.1f seconds", seconds);
+
         /* It is not a good idea to make this overridable, it just creates
          * an infinite loop as a fixed date for testing just doesn't work. */
         dt_now = g_date_time_new_now_local ();
-        dt_expiry = g_date_time_add_seconds (dt_now, GSD_NIGHT_LIGHT_POLL_TIMEOUT);
+        dt_expiry = g_date_time_add_seconds (dt_now, seconds);
         self->source = _gnome_datetime_source_new (dt_now,
                                                    dt_expiry,
                                                    TRUE);
@@ -619,8 +702,8 @@ gsd_night_light_set_geoclue_enabled (GsdNightLight *self, gboolean enabled)
 gboolean
 gsd_night_light_start (GsdNightLight *self, GError **error)
 {
+        self->running = TRUE;
         night_light_recheck (self);
-        poll_timeout_create (self);
 
         /* care about changes */
         g_signal_connect (self->settings, "changed",
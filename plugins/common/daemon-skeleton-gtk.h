@@ -6,6 +6,40 @@
  * #define MANAGER GsdMediaKeysManager
  * #include "gsd-media-keys-manager.h"
  *
+ * If the manager has a boolean "ready" property that only becomes TRUE
+ * once it finished starting up asynchronously, also
+ * #define WAIT_FOR_READY
+ * so that the D-Bus name, which marks the service as started, is only
+ * acquired at that point.
+ *
+ * If the manager has a boolean "idle" property that is TRUE while it has
+ * nothing to manage (no devices, for example), also
+ * #define EXIT_WHEN_IDLE
+ * so that the helper can be started on demand and passed
+ * --idle-timeout=SECONDS, after which it exits when the manager stays
+ * idle for that long.
+ *
+ * Such a helper can also start dormant, with
+ * #define DORMANT_UDEV_PROPERTY "ID_INPUT_TABLET"
+ * If no udev device has that property set to 1 when it is started with
+ * --idle-timeout, the manager is not started at all.  The helper takes
+ * its D-Bus name, starts the manager as soon as a matching device is
+ * added, and otherwise exits after the idle timeout.
+ *
+ * When running with GSD_PROFILE set, sending SIGUSR1 to the helper
+ * writes the recorded profiling marks to
+ * $XDG_RUNTIME_DIR/gsd-<plugin>-<pid>.trace.json
+ *
+ * Once the D-Bus name is acquired, the helper reports its startup time,
+ * and READY=1 when running under systemd with NotifyAccess= set.
+ *
+ * Setting GSD_WATCHDOG to a number of milliseconds reports the main
+ * loop iterations that take longer than that, see gnome-settings-watchdog.c
+ *
+ * When built for gsd-plugin-host (PLUGIN_HOST_SYMBOL defined), only a
+ * GsdPluginHostEntry describing the manager is defined, and the host
+ * provides main().
+ *
  * #include "daemon-skeleton-gtk.h"
  */
 
@@ -14,29 +48,102 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <locale.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <glib-unix.h>
+#include <gio/gunixsocketaddress.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 
+#if defined(DORMANT_UDEV_PROPERTY) && !HAVE_GUDEV
+#undef DORMANT_UDEV_PROPERTY
+#endif
+
+#ifdef DORMANT_UDEV_PROPERTY
+#ifndef EXIT_WHEN_IDLE
+#error DORMANT_UDEV_PROPERTY needs EXIT_WHEN_IDLE
+#endif /* !EXIT_WHEN_IDLE */
+#include <gudev/gudev.h>
+#endif /* DORMANT_UDEV_PROPERTY */
+
 #include "gnome-settings-bus.h"
+#include "gnome-settings-profile.h"
+#include "gnome-settings-watchdog.h"
 
 #ifndef PLUGIN_NAME
 #error Include PLUGIN_CFLAGS in the daemon s CFLAGS
 #endif /* !PLUGIN_NAME */
 
+#ifdef PLUGIN_HOST_SYMBOL
+
+#include "gsd-plugin-host.h"
+
+static GObject *
+host_new_manager (void)
+{
+        return G_OBJECT (NEW ());
+}
+
+static gboolean
+host_start (GObject  *object,
+            GError  **error)
+{
+        return START ((MANAGER *) object, error);
+}
+
+static void
+host_stop (GObject *object)
+{
+        STOP ((MANAGER *) object);
+}
+
+const GsdPluginHostEntry PLUGIN_HOST_SYMBOL = {
+        PLUGIN_NAME,
+        PLUGIN_DBUS_NAME,
+        TRUE,
+#ifdef GDK_BACKEND
+        GDK_BACKEND,
+#else
+        NULL,
+#endif
+#ifdef WAIT_FOR_READY
+        TRUE,
+#else
+        FALSE,
+#endif
+        host_new_manager,
+        host_start,
+        host_stop
+};
+
+#else /* !PLUGIN_HOST_SYMBOL */
+
 #define GNOME_SESSION_DBUS_NAME                     "org.gnome.SessionManager"
 #define GNOME_SESSION_CLIENT_PRIVATE_DBUS_INTERFACE "org.gnome.SessionManager.ClientPrivate"
 
 static MANAGER *manager = NULL;
+static guint name_own_id = 0;
 static int timeout = -1;
 static char *dummy_name = NULL;
 static gboolean verbose = FALSE;
+static gint64 start_time = 0;
+static char *notify_socket = NULL;
+#ifdef EXIT_WHEN_IDLE
+static int idle_timeout = 0;
+static guint idle_exit_id = 0;
+#endif /* EXIT_WHEN_IDLE */
+#ifdef DORMANT_UDEV_PROPERTY
+static GUdevClient *dormant_client = NULL;
+#endif /* DORMANT_UDEV_PROPERTY */
 
 static GOptionEntry entries[] = {
         { "exit-time", 0, 0, G_OPTION_ARG_INT, &timeout, "Exit after n seconds time", NULL },
         { "dummy-name", 0, 0, G_OPTION_ARG_STRING, &dummy_name, "Name when using the dummy daemon", NULL },
         { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Verbose", NULL },
+#ifdef EXIT_WHEN_IDLE
+        { "idle-timeout", 0, 0, G_OPTION_ARG_INT, &idle_timeout, "Exit after n seconds with nothing to manage", NULL },
+#endif /* EXIT_WHEN_IDLE */
         {NULL}
 };
 
@@ -173,6 +280,24 @@ handle_sigterm (gpointer user_data)
   return G_SOURCE_REMOVE;
 }
 
+static gboolean
+handle_sigusr1 (gpointer user_data G_GNUC_UNUSED)
+{
+  g_autofree gchar *basename = NULL;
+  g_autofree gchar *filename = NULL;
+  g_autoptr(GError) error = NULL;
+
+  basename = g_strdup_printf ("gsd-%s-%d.trace.json", PLUGIN_NAME, getpid ());
+  filename = g_build_filename (g_get_user_runtime_dir (), basename, NULL);
+
+  if (gnome_settings_profile_dump (filename, &error))
+    g_message ("Wrote profiling marks to %s", filename);
+  else
+    g_warning ("Failed to write profiling marks: %s", error->message);
+
+  return G_SOURCE_CONTINUE;
+}
+
 static void
 install_signal_handler (void)
 {
@@ -182,6 +307,8 @@ install_signal_handler (void)
 
   g_source_set_callback (source, handle_sigterm, NULL, NULL);
   g_source_attach (source, NULL);
+
+  g_unix_signal_add (SIGUSR1, handle_sigusr1, NULL);
 }
 
 static void
@@ -192,12 +319,50 @@ bus_acquired_cb (GDBusConnection *connection,
         g_debug ("%s: acquired bus %p for name %s", G_STRFUNC, connection, name);
 }
 
+static void
+notify_ready (void)
+{
+        g_autoptr(GSocket) socket = NULL;
+        g_autoptr(GSocketAddress) address = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree char *message = NULL;
+        g_autofree char *path = g_steal_pointer (&notify_socket);
+        gint64 elapsed;
+
+        elapsed = (g_get_monotonic_time () - start_time) / 1000;
+        g_debug ("%s started in %" G_GINT64_FORMAT " ms", PLUGIN_NAME, elapsed);
+
+        if (path == NULL || path[0] == '\0')
+                return;
+
+        if (path[0] == '@')
+                address = g_unix_socket_address_new_with_type (path + 1, -1,
+                                                               G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+        else
+                address = g_unix_socket_address_new (path);
+
+        socket = g_socket_new (G_SOCKET_FAMILY_UNIX,
+                               G_SOCKET_TYPE_DATAGRAM,
+                               G_SOCKET_PROTOCOL_DEFAULT,
+                               &error);
+        if (socket == NULL) {
+                g_warning ("Failed to notify service manager: %s", error->message);
+                return;
+        }
+
+        message = g_strdup_printf ("READY=1\nSTATUS=Started in %" G_GINT64_FORMAT " ms", elapsed);
+        if (g_socket_send_to (socket, address, message, strlen (message), NULL, &error) < 0)
+                g_warning ("Failed to notify service manager: %s", error->message);
+}
+
 static void
 name_acquired_cb (GDBusConnection *connection,
                   const gchar *name,
                   gpointer user_data G_GNUC_UNUSED)
 {
         g_debug ("%s: acquired name %s on bus %p", G_STRFUNC, name, connection);
+        gnome_settings_profile_msg ("acquired %s", name);
+        notify_ready ();
 }
 
 static void
@@ -208,11 +373,183 @@ name_lost_cb (GDBusConnection *connection,
         g_debug ("%s: lost name %s on bus %p", G_STRFUNC, name, connection);
 }
 
+static void
+own_name (void)
+{
+	name_own_id = g_bus_own_name (G_BUS_TYPE_SESSION,
+				      PLUGIN_DBUS_NAME,
+				      G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE,
+				      bus_acquired_cb,
+				      name_acquired_cb,
+				      name_lost_cb,
+				      NULL, /* user_data */
+				      NULL /* user_data_free_func */);
+}
+
+#ifdef WAIT_FOR_READY
+static void
+manager_ready_cb (GObject    *object,
+                  GParamSpec *pspec G_GNUC_UNUSED,
+                  gpointer    user_data G_GNUC_UNUSED)
+{
+        gboolean ready;
+
+        g_object_get (object, "ready", &ready, NULL);
+        if (!ready || name_own_id != 0)
+                return;
+
+        g_debug ("Manager is ready, acquiring name %s", PLUGIN_DBUS_NAME);
+        own_name ();
+}
+#endif /* WAIT_FOR_READY */
+
+#ifdef EXIT_WHEN_IDLE
+static gboolean
+idle_exit_cb (gpointer user_data)
+{
+        g_debug ("Nothing to manage for %d seconds, exiting", idle_timeout);
+        idle_exit_id = 0;
+        do_stop ();
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+manager_idle_cb (GObject    *object,
+                 GParamSpec *pspec G_GNUC_UNUSED,
+                 gpointer    user_data)
+{
+        gboolean idle;
+
+        g_object_get (object, "idle", &idle, NULL);
+        if (idle && idle_exit_id == 0) {
+                idle_exit_id = g_timeout_add_seconds (idle_timeout, idle_exit_cb, user_data);
+                g_source_set_name_by_id (idle_exit_id, "[gnome-settings-daemon] idle_exit_cb");
+        } else if (!idle && idle_exit_id != 0) {
+                g_source_remove (idle_exit_id);
+                idle_exit_id = 0;
+        }
+}
+#endif /* EXIT_WHEN_IDLE */
+
+static void
+start_manager (void)
+{
+        GError *error = NULL;
+
+        manager = NEW ();
+
+        gnome_settings_profile_start ("%s", PLUGIN_NAME);
+        if (!START (manager, &error)) {
+                fprintf (stderr, "Failed to start: %s\n", error->message);
+                g_error_free (error);
+                exit (1);
+        }
+        gnome_settings_profile_end ("%s", PLUGIN_NAME);
+
+#ifdef WAIT_FOR_READY
+        g_signal_connect (manager, "notify::ready",
+                          G_CALLBACK (manager_ready_cb), NULL);
+        manager_ready_cb (G_OBJECT (manager), NULL, NULL);
+#else
+        /* already taken while dormant */
+        if (name_own_id == 0)
+                own_name ();
+#endif /* WAIT_FOR_READY */
+
+#ifdef EXIT_WHEN_IDLE
+        if (idle_timeout > 0) {
+                g_signal_connect (manager, "notify::idle",
+                                  G_CALLBACK (manager_idle_cb), NULL);
+                manager_idle_cb (G_OBJECT (manager), NULL, NULL);
+        }
+#endif /* EXIT_WHEN_IDLE */
+}
+
+#ifdef DORMANT_UDEV_PROPERTY
+/* Listens before looking, so that no device added meanwhile is missed */
+static gboolean
+dormant_probe (void)
+{
+        const gchar * const all_subsystems[] = { NULL };
+        GUdevEnumerator *enumerator;
+        GList *devices;
+        gboolean found;
+
+        dormant_client = g_udev_client_new (all_subsystems);
+
+        enumerator = g_udev_enumerator_new (dormant_client);
+        g_udev_enumerator_add_match_property (enumerator, DORMANT_UDEV_PROPERTY, "1");
+        devices = g_udev_enumerator_execute (enumerator);
+        found = devices != NULL;
+
+        g_list_free_full (devices, g_object_unref);
+        g_object_unref (enumerator);
+        if (found)
+                g_clear_object (&dormant_client);
+
+        return found;
+}
+
+static gboolean
+dormant_wake_cb (gpointer user_data G_GNUC_UNUSED)
+{
+        g_clear_object (&dormant_client);
+        if (idle_exit_id != 0) {
+                g_source_remove (idle_exit_id);
+                idle_exit_id = 0;
+        }
+
+        start_manager ();
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+dormant_uevent_cb (GUdevClient *client,
+                   const gchar *action,
+                   GUdevDevice *device,
+                   gpointer     user_data)
+{
+        if (g_strcmp0 (action, "remove") == 0 ||
+            !g_udev_device_get_property_as_boolean (device, DORMANT_UDEV_PROPERTY))
+                return;
+
+        g_debug ("%s has %s, leaving dormant mode",
+                 g_udev_device_get_sysfs_path (device), DORMANT_UDEV_PROPERTY);
+
+        /* not from within the client's signal emission */
+        g_signal_handlers_disconnect_by_func (client, dormant_uevent_cb, user_data);
+        g_idle_add (dormant_wake_cb, user_data);
+}
+
+static void
+dormant_start (void)
+{
+        g_debug ("No device has %s, dormant for %d seconds",
+                 DORMANT_UDEV_PROPERTY, idle_timeout);
+
+        g_signal_connect (dormant_client, "uevent",
+                          G_CALLBACK (dormant_uevent_cb), NULL);
+        idle_exit_id = g_timeout_add_seconds (idle_timeout, idle_exit_cb, NULL);
+        g_source_set_name_by_id (idle_exit_id, "[gnome-settings-daemon] idle_exit_cb");
+
+        own_name ();
+}
+#endif /* DORMANT_UDEV_PROPERTY */
+
 int
 main (int argc, char **argv)
 {
         GError  *error = NULL;
-        guint name_own_id;
+
+        start_time = g_get_monotonic_time ();
+
+        /* Like sd_notify() with unset_environment, so that the processes
+         * we spawn cannot notify the service manager on our behalf; done
+         * before any thread is started or any child is spawned */
+        notify_socket = g_strdup (g_getenv ("NOTIFY_SOCKET"));
+        g_unsetenv ("NOTIFY_SOCKET");
 
         bindtextdomain (GETTEXT_PACKAGE, GNOME_SETTINGS_LOCALEDIR);
         bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
@@ -262,31 +599,30 @@ main (int argc, char **argv)
 	}
 
         install_signal_handler ();
+        gnome_settings_watchdog_start ();
 
-        manager = NEW ();
 	register_with_gnome_session ();
 
-        if (!START (manager, &error)) {
-                fprintf (stderr, "Failed to start: %s\n", error->message);
-                g_error_free (error);
-                exit (1);
-        }
-
-	name_own_id = g_bus_own_name (G_BUS_TYPE_SESSION,
-				      PLUGIN_DBUS_NAME,
-				      G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE,
-				      bus_acquired_cb,
-				      name_acquired_cb,
-				      name_lost_cb,
-				      NULL, /* user_data */
-				      NULL /* user_data_free_func */);
+#ifdef DORMANT_UDEV_PROPERTY
+        if (idle_timeout > 0 && !dormant_probe ())
+                dormant_start ();
+        else
+#endif /* DORMANT_UDEV_PROPERTY */
+                start_manager ();
 
         gtk_main ();
 
-        STOP (manager);
-
-        g_object_unref (manager);
-        g_bus_unown_name (name_own_id);
+        if (manager != NULL) {
+                STOP (manager);
+                g_object_unref (manager);
+        }
+#ifdef DORMANT_UDEV_PROPERTY
+        g_clear_object (&dormant_client);
+#endif /* DORMANT_UDEV_PROPERTY */
+        if (name_own_id != 0)
+                g_bus_unown_name (name_own_id);
 
         return 0;
 }
+
+#endif /* !PLUGIN_HOST_SYMBOL */
@@ -0,0 +1,750 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Runs plugin managers in a few processes instead of one each:
+ *
+ *   gsd-plugin-host power,media-keys sound
+ *
+ * Every argument is a group of comma-separated plugins sharing a child
+ * process, and with it the main context, the session bus connection,
+ * the GSettings backend and the GTK/GDK initialization. A crash only
+ * takes down the plugins of its group.
+ *
+ * The parent process registers with gnome-session and supervises the
+ * children: one that crashes or exits is restarted, with a delay
+ * doubling on each attempt. After MAX_START_ATTEMPTS failures in a row
+ * the group stays stopped. On SIGTERM, the children are stopped first.
+ *
+ * Within a child, each plugin still owns its well-known D-Bus name. A
+ * plugin whose manager fails to start, loses its name, or reports a
+ * failure by its "ready" property going back to FALSE is stopped and
+ * restarted in the same way.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <locale.h>
+
+#include <glib-unix.h>
+#include <glib/gi18n.h>
+#include <gtk/gtk.h>
+
+#include "gnome-settings-bus.h"
+#include "gnome-settings-profile.h"
+#include "gnome-settings-watchdog.h"
+#include "gsd-plugin-host.h"
+
+#define MAX_START_ATTEMPTS      3
+#define START_RETRY_DELAY       5 /* seconds, doubled on each attempt */
+#define STABLE_RUN_TIME         60 /* seconds before attempts are reset */
+#define STOP_TIMEOUT            10 /* seconds before children are killed */
+
+typedef struct {
+        const GsdPluginHostEntry *entry;
+        GObject                  *manager;
+        guint                     name_own_id;
+        guint                     retry_id;
+        guint                     attempts;
+        gboolean                  ready;
+        gint64                    acquired_time;
+} HostedPlugin;
+
+typedef struct {
+        char                     *plugins;
+        GSubprocess              *process;
+        guint                     retry_id;
+        guint                     attempts;
+        gint64                    start_time;
+} PluginGroup;
+
+static GMainLoop *loop = NULL;
+static GPtrArray *groups = NULL;
+static gboolean stopping = FALSE;
+static guint kill_id = 0;
+static gboolean verbose = FALSE;
+static gboolean list_plugins = FALSE;
+static gchar *child_plugins = NULL;
+static gchar **plugin_names = NULL;
+
+static GOptionEntry entries[] = {
+        { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Verbose", NULL },
+        { "list", 'l', 0, G_OPTION_ARG_NONE, &list_plugins, "List the plugins that can be hosted", NULL },
+        { "child", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &child_plugins, NULL, NULL },
+        { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &plugin_names, NULL, "PLUGIN[,PLUGIN…]…" },
+        {NULL}
+};
+
+static void plugin_start (HostedPlugin *plugin);
+static void group_spawn (PluginGroup *group);
+static void plugin_restart (HostedPlugin *plugin);
+
+static const GsdPluginHostEntry *
+find_entry (const char *name)
+{
+        guint i;
+
+        for (i = 0; gsd_plugin_host_entries[i] != NULL; i++) {
+                if (g_strcmp0 (gsd_plugin_host_entries[i]->name, name) == 0)
+                        return gsd_plugin_host_entries[i];
+        }
+
+        return NULL;
+}
+
+static GPtrArray *
+parse_plugins (const char *group)
+{
+        g_autoptr(GPtrArray) plugins = NULL;
+        g_auto(GStrv) names = NULL;
+        const char *gdk_backend = NULL;
+        guint i;
+
+        names = g_strsplit (group, ",", -1);
+        plugins = g_ptr_array_new_with_free_func (g_free);
+        for (i = 0; names[i] != NULL; i++) {
+                const GsdPluginHostEntry *entry;
+                HostedPlugin *plugin;
+
+                entry = find_entry (names[i]);
+                if (entry == NULL) {
+                        fprintf (stderr, "Unknown plugin '%s'\n", names[i]);
+                        return NULL;
+                }
+
+                if (entry->gdk_backend != NULL) {
+                        if (gdk_backend != NULL &&
+                            g_strcmp0 (gdk_backend, entry->gdk_backend) != 0) {
+                                fprintf (stderr, "Plugins requiring different GDK backends can't share a process\n");
+                                return NULL;
+                        }
+                        gdk_backend = entry->gdk_backend;
+                }
+
+                plugin = g_new0 (HostedPlugin, 1);
+                plugin->entry = entry;
+                g_ptr_array_add (plugins, plugin);
+        }
+
+        if (plugins->len == 0) {
+                fprintf (stderr, "No plugin to run\n");
+                return NULL;
+        }
+
+        return g_steal_pointer (&plugins);
+}
+
+static void
+plugin_stop (HostedPlugin *plugin)
+{
+        g_clear_handle_id (&plugin->retry_id, g_source_remove);
+
+        if (plugin->name_own_id != 0) {
+                g_bus_unown_name (plugin->name_own_id);
+                plugin->name_own_id = 0;
+        }
+
+        if (plugin->manager == NULL)
+                return;
+
+        g_debug ("Stopping plugin %s", plugin->entry->name);
+        g_signal_handlers_disconnect_by_data (plugin->manager, plugin);
+        plugin->entry->stop (plugin->manager);
+        g_clear_object (&plugin->manager);
+        plugin->ready = FALSE;
+        plugin->acquired_time = 0;
+}
+
+static gboolean
+plugin_retry_cb (gpointer user_data)
+{
+        HostedPlugin *plugin = user_data;
+
+        plugin->retry_id = 0;
+        plugin_start (plugin);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+plugin_schedule_retry (HostedPlugin *plugin)
+{
+        guint delay;
+
+        if (plugin->attempts >= MAX_START_ATTEMPTS) {
+                g_warning ("Plugin %s failed %u times, giving up",
+                           plugin->entry->name, plugin->attempts);
+                return;
+        }
+
+        delay = START_RETRY_DELAY << (plugin->attempts - 1);
+        g_debug ("Restarting plugin %s in %u seconds", plugin->entry->name, delay);
+        plugin->retry_id = g_timeout_add_seconds (delay, plugin_retry_cb, plugin);
+        g_source_set_name_by_id (plugin->retry_id, "[gnome-settings-daemon] plugin_retry_cb");
+}
+
+static gboolean
+plugin_restart_cb (gpointer user_data)
+{
+        HostedPlugin *plugin = user_data;
+
+        plugin->retry_id = 0;
+
+        /* only failures in a row count towards giving up */
+        if (plugin->acquired_time != 0 &&
+            g_get_monotonic_time () - plugin->acquired_time > STABLE_RUN_TIME * G_USEC_PER_SEC)
+                plugin->attempts = 1;
+
+        plugin_stop (plugin);
+        plugin_schedule_retry (plugin);
+
+        return G_SOURCE_REMOVE;
+}
+
+/* for a plugin that failed after it started successfully, the manager
+ * is not stopped from within its own signal emission */
+static void
+plugin_restart (HostedPlugin *plugin)
+{
+        if (plugin->retry_id != 0)
+                return;
+
+        plugin->retry_id = g_idle_add (plugin_restart_cb, plugin);
+        g_source_set_name_by_id (plugin->retry_id, "[gnome-settings-daemon] plugin_restart_cb");
+}
+
+static void
+name_acquired_cb (GDBusConnection *connection,
+                  const gchar     *name,
+                  gpointer         user_data)
+{
+        HostedPlugin *plugin = user_data;
+
+        g_debug ("%s: acquired name %s on bus %p", G_STRFUNC, name, connection);
+        gnome_settings_profile_msg ("acquired %s", name);
+        plugin->acquired_time = g_get_monotonic_time ();
+}
+
+static void
+name_lost_cb (GDBusConnection *connection,
+              const gchar     *name,
+              gpointer         user_data)
+{
+        HostedPlugin *plugin = user_data;
+
+        g_warning ("Lost name %s, restarting plugin %s", name, plugin->entry->name);
+        plugin_restart (plugin);
+}
+
+static void
+own_name (HostedPlugin *plugin)
+{
+        plugin->name_own_id = g_bus_own_name (G_BUS_TYPE_SESSION,
+                                              plugin->entry->dbus_name,
+                                              G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE,
+                                              NULL,
+                                              name_acquired_cb,
+                                              name_lost_cb,
+                                              plugin,
+                                              NULL);
+}
+
+static void
+manager_ready_cb (GObject    *object,
+                  GParamSpec *pspec,
+                  gpointer    user_data)
+{
+        HostedPlugin *plugin = user_data;
+        gboolean ready;
+
+        g_object_get (object, "ready", &ready, NULL);
+        if (!ready && plugin->ready) {
+                g_warning ("Plugin %s reported a failure, restarting it",
+                           plugin->entry->name);
+                plugin_restart (plugin);
+                return;
+        }
+        plugin->ready = ready;
+        if (!ready || plugin->name_own_id != 0)
+                return;
+
+        g_debug ("Plugin %s is ready, acquiring name %s",
+                 plugin->entry->name, plugin->entry->dbus_name);
+        own_name (plugin);
+}
+
+static void
+plugin_start (HostedPlugin *plugin)
+{
+        g_autoptr(GError) error = NULL;
+
+        plugin->attempts++;
+        g_debug ("Starting plugin %s (attempt %u)", plugin->entry->name, plugin->attempts);
+
+        gnome_settings_profile_start ("%s", plugin->entry->name);
+        plugin->manager = plugin->entry->new_manager ();
+        if (!plugin->entry->start (plugin->manager, &error)) {
+                g_warning ("Failed to start plugin %s: %s",
+                           plugin->entry->name,
+                           error ? error->message : "unknown error");
+                g_clear_object (&plugin->manager);
+
+                plugin_schedule_retry (plugin);
+                gnome_settings_profile_end ("%s", plugin->entry->name);
+                return;
+        }
+        gnome_settings_profile_end ("%s", plugin->entry->name);
+
+        if (plugin->entry->wait_for_ready) {
+                g_signal_connect (plugin->manager, "notify::ready",
+                                  G_CALLBACK (manager_ready_cb), plugin);
+                manager_ready_cb (plugin->manager, NULL, plugin);
+        } else {
+                own_name (plugin);
+        }
+}
+
+static gboolean
+group_retry_cb (gpointer user_data)
+{
+        PluginGroup *group = user_data;
+
+        group->retry_id = 0;
+        group_spawn (group);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+group_schedule_retry (PluginGroup *group)
+{
+        guint delay;
+
+        if (group->attempts >= MAX_START_ATTEMPTS) {
+                g_warning ("Plugins %s failed %u times, giving up",
+                           group->plugins, group->attempts);
+                return;
+        }
+
+        delay = START_RETRY_DELAY << (group->attempts - 1);
+        g_debug ("Restarting plugins %s in %u seconds", group->plugins, delay);
+        group->retry_id = g_timeout_add_seconds (delay, group_retry_cb, group);
+        g_source_set_name_by_id (group->retry_id, "[gnome-settings-daemon] group_retry_cb");
+}
+
+static gboolean
+groups_running (void)
+{
+        guint i;
+
+        for (i = 0; i < groups->len; i++) {
+                PluginGroup *group = g_ptr_array_index (groups, i);
+
+                if (group->process != NULL)
+                        return TRUE;
+        }
+
+        return FALSE;
+}
+
+static void
+group_exited_cb (GObject      *source_object,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+        PluginGroup *group = user_data;
+        g_autoptr(GSubprocess) process = NULL;
+        g_autoptr(GError) error = NULL;
+
+        process = g_steal_pointer (&group->process);
+        if (!g_subprocess_wait_finish (process, res, &error))
+                g_warning ("Failed to wait for plugins %s: %s", group->plugins, error->message);
+
+        if (stopping) {
+                g_debug ("Plugins %s stopped", group->plugins);
+                if (!groups_running ())
+                        g_main_loop_quit (loop);
+                return;
+        }
+
+        if (g_subprocess_get_if_signaled (process))
+                g_warning ("Plugins %s crashed with signal %d",
+                           group->plugins, g_subprocess_get_term_sig (process));
+        else
+                g_warning ("Plugins %s exited with status %d",
+                           group->plugins, g_subprocess_get_exit_status (process));
+
+        /* only failures in a row count towards giving up */
+        if (g_get_monotonic_time () - group->start_time > STABLE_RUN_TIME * G_USEC_PER_SEC)
+                group->attempts = 1;
+
+        group_schedule_retry (group);
+}
+
+static void
+group_spawn (PluginGroup *group)
+{
+        g_autoptr(GError) error = NULL;
+
+        group->attempts++;
+        g_debug ("Starting plugins %s (attempt %u)", group->plugins, group->attempts);
+
+        group->process = g_subprocess_new (G_SUBPROCESS_FLAGS_NONE, &error,
+                                           LIBEXECDIR "/gsd-plugin-host",
+                                           "--child", group->plugins,
+                                           verbose ? "--verbose" : NULL,
+                                           NULL);
+        if (group->process == NULL) {
+                g_warning ("Failed to start plugins %s: %s", group->plugins, error->message);
+                group_schedule_retry (group);
+                return;
+        }
+
+        group->start_time = g_get_monotonic_time ();
+        g_subprocess_wait_async (group->process, NULL, group_exited_cb, group);
+}
+
+static gboolean
+groups_kill_cb (gpointer user_data)
+{
+        guint i;
+
+        kill_id = 0;
+
+        for (i = 0; i < groups->len; i++) {
+                PluginGroup *group = g_ptr_array_index (groups, i);
+
+                if (group->process == NULL)
+                        continue;
+
+                g_warning ("Plugins %s did not stop, killing them", group->plugins);
+                g_subprocess_force_exit (group->process);
+        }
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+groups_stop (void)
+{
+        guint i;
+
+        stopping = TRUE;
+
+        for (i = 0; i < groups->len; i++) {
+                PluginGroup *group = g_ptr_array_index (groups, i);
+
+                g_clear_handle_id (&group->retry_id, g_source_remove);
+                if (group->process != NULL)
+                        g_subprocess_send_signal (group->process, SIGTERM);
+        }
+
+        if (!groups_running ())
+                return;
+
+        kill_id = g_timeout_add_seconds (STOP_TIMEOUT, groups_kill_cb, NULL);
+        g_source_set_name_by_id (kill_id, "[gnome-settings-daemon] groups_kill_cb");
+        g_main_loop_run (loop);
+        g_clear_handle_id (&kill_id, g_source_remove);
+}
+
+static void
+group_free (PluginGroup *group)
+{
+        g_clear_handle_id (&group->retry_id, g_source_remove);
+        g_clear_object (&group->process);
+        g_free (group->plugins);
+        g_free (group);
+}
+
+static gboolean
+handle_sigterm (gpointer user_data)
+{
+        g_debug ("Got SIGTERM; shutting down ...");
+
+        if (g_main_loop_is_running (loop))
+                g_main_loop_quit (loop);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+respond_to_end_session (GDBusProxy *proxy)
+{
+        /* we must answer with "EndSessionResponse" */
+        g_dbus_proxy_call (proxy, "EndSessionResponse",
+                           g_variant_new ("(bs)", TRUE, ""),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1, NULL, NULL, NULL);
+}
+
+static void
+client_proxy_signal_cb (GDBusProxy *proxy,
+                        gchar      *sender_name,
+                        gchar      *signal_name,
+                        GVariant   *parameters,
+                        gpointer    user_data)
+{
+        if (g_strcmp0 (signal_name, "QueryEndSession") == 0 ||
+            g_strcmp0 (signal_name, "EndSession") == 0) {
+                g_debug ("Got %s signal", signal_name);
+                respond_to_end_session (proxy);
+        } else if (g_strcmp0 (signal_name, "Stop") == 0) {
+                g_debug ("Got Stop signal");
+                if (!stopping)
+                        g_main_loop_quit (loop);
+        }
+}
+
+static void
+on_client_registered (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+        g_autoptr(GVariant) variant = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *object_path = NULL;
+        GDBusProxy *client_proxy;
+
+        variant = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+        if (!variant) {
+                g_warning ("Unable to register client: %s", error->message);
+                return;
+        }
+
+        g_variant_get (variant, "(o)", &object_path);
+        g_debug ("Registered client at path %s", object_path);
+
+        client_proxy = g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SESSION, 0, NULL,
+                                                      "org.gnome.SessionManager",
+                                                      object_path,
+                                                      "org.gnome.SessionManager.ClientPrivate",
+                                                      NULL,
+                                                      &error);
+        if (!client_proxy) {
+                g_warning ("Unable to get the session client proxy: %s", error->message);
+                return;
+        }
+
+        g_signal_connect (client_proxy, "g-signal",
+                          G_CALLBACK (client_proxy_signal_cb), NULL);
+}
+
+static void
+register_with_gnome_session (void)
+{
+        GDBusProxy *proxy;
+        const char *startup_id;
+
+        proxy = G_DBUS_PROXY (gnome_settings_bus_get_session_proxy ());
+        startup_id = g_getenv ("DESKTOP_AUTOSTART_ID");
+        g_dbus_proxy_call (proxy,
+                           "RegisterClient",
+                           g_variant_new ("(ss)", "plugin-host", startup_id ? startup_id : ""),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           NULL,
+                           (GAsyncReadyCallback) on_client_registered,
+                           NULL);
+
+        /* See daemon-skeleton.h */
+        g_unsetenv ("DESKTOP_AUTOSTART_ID");
+}
+
+static gboolean
+init_gtk (GPtrArray  *plugins,
+          int        *argc,
+          char     ***argv)
+{
+        const char *gdk_backend = NULL;
+        gboolean needs_gtk = FALSE;
+        g_autofree char *old_gtk_theme = NULL;
+        gboolean ret;
+        guint i;
+
+        /* parse_plugins() checked that they agree on the backend */
+        for (i = 0; i < plugins->len; i++) {
+                HostedPlugin *plugin = g_ptr_array_index (plugins, i);
+
+                needs_gtk |= plugin->entry->needs_gtk;
+                if (plugin->entry->gdk_backend != NULL)
+                        gdk_backend = plugin->entry->gdk_backend;
+        }
+
+        if (!needs_gtk)
+                return TRUE;
+
+        /* Same as daemon-skeleton-gtk.h, skip parsing the Adwaita theme */
+        old_gtk_theme = g_strdup (g_getenv ("GTK_THEME"));
+        g_setenv ("GTK_THEME", "Disabled", TRUE);
+
+        if (gdk_backend != NULL) {
+                const gchar *setup_display = getenv ("GNOME_SETUP_DISPLAY");
+                if (setup_display && *setup_display != '\0')
+                        g_setenv ("DISPLAY", setup_display, TRUE);
+
+                gdk_set_allowed_backends (gdk_backend);
+        }
+
+        ret = gtk_init_check (argc, argv);
+
+        if (old_gtk_theme != NULL)
+                g_setenv ("GTK_THEME", old_gtk_theme, TRUE);
+        else
+                g_unsetenv ("GTK_THEME");
+
+        if (!ret)
+                fprintf (stderr, "Failed to initialize GTK\n");
+
+        return ret;
+}
+
+static int
+run_plugins (const char   *group,
+             int          *argc,
+             char       ***argv)
+{
+        g_autoptr(GPtrArray) plugins = NULL;
+        guint i;
+
+        plugins = parse_plugins (group);
+        if (plugins == NULL)
+                exit (1);
+
+        if (!init_gtk (plugins, argc, argv))
+                exit (1);
+
+        loop = g_main_loop_new (NULL, FALSE);
+        g_unix_signal_add (SIGTERM, handle_sigterm, NULL);
+        gnome_settings_watchdog_start ();
+
+        for (i = 0; i < plugins->len; i++)
+                plugin_start (g_ptr_array_index (plugins, i));
+
+        g_main_loop_run (loop);
+
+        for (i = plugins->len; i > 0; i--)
+                plugin_stop (g_ptr_array_index (plugins, i - 1));
+
+        g_main_loop_unref (loop);
+
+        return 0;
+}
+
+static int
+run_supervisor (void)
+{
+        g_autoptr(GHashTable) seen = NULL;
+        guint i;
+
+        /* validate everything here, rather than have the children
+         * fail over and over again */
+        seen = g_hash_table_new (g_str_hash, g_str_equal);
+        groups = g_ptr_array_new_with_free_func ((GDestroyNotify) group_free);
+        for (i = 0; plugin_names[i] != NULL; i++) {
+                g_autoptr(GPtrArray) plugins = NULL;
+                PluginGroup *group;
+                guint j;
+
+                plugins = parse_plugins (plugin_names[i]);
+                if (plugins == NULL)
+                        exit (1);
+
+                for (j = 0; j < plugins->len; j++) {
+                        HostedPlugin *plugin = g_ptr_array_index (plugins, j);
+
+                        if (!g_hash_table_add (seen, (gpointer) plugin->entry->name)) {
+                                fprintf (stderr, "Plugin '%s' is listed more than once\n",
+                                         plugin->entry->name);
+                                exit (1);
+                        }
+                }
+
+                group = g_new0 (PluginGroup, 1);
+                group->plugins = g_strdup (plugin_names[i]);
+                g_ptr_array_add (groups, group);
+        }
+
+        loop = g_main_loop_new (NULL, FALSE);
+        g_unix_signal_add (SIGTERM, handle_sigterm, NULL);
+
+        register_with_gnome_session ();
+
+        for (i = 0; i < groups->len; i++)
+                group_spawn (g_ptr_array_index (groups, i));
+
+        g_main_loop_run (loop);
+
+        groups_stop ();
+
+        g_clear_pointer (&groups, g_ptr_array_unref);
+        g_main_loop_unref (loop);
+
+        return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+        GOptionContext *context;
+        GError *error = NULL;
+        int ret;
+        guint i;
+
+        bindtextdomain (GETTEXT_PACKAGE, GNOME_SETTINGS_LOCALEDIR);
+        bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
+        textdomain (GETTEXT_PACKAGE);
+        setlocale (LC_ALL, "");
+
+        context = g_option_context_new (NULL);
+        g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+        if (!g_option_context_parse (context, &argc, &argv, &error)) {
+                fprintf (stderr, "%s\n", error->message);
+                g_error_free (error);
+                exit (1);
+        }
+        g_option_context_free (context);
+
+        if (list_plugins) {
+                for (i = 0; gsd_plugin_host_entries[i] != NULL; i++)
+                        printf ("%s\n", gsd_plugin_host_entries[i]->name);
+                return 0;
+        }
+
+        if (child_plugins == NULL && plugin_names == NULL) {
+                fprintf (stderr, "No plugin to run\n");
+                exit (1);
+        }
+
+        if (verbose) {
+                g_setenv ("G_MESSAGES_DEBUG", "all", TRUE);
+                setlinebuf (stdout);
+        }
+
+        if (child_plugins != NULL)
+                ret = run_plugins (child_plugins, &argc, &argv);
+        else
+                ret = run_supervisor ();
+
+        g_free (child_plugins);
+        g_strfreev (plugin_names);
+
+        return ret;
+}
@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_PLUGIN_HOST_H
+#define __GSD_PLUGIN_HOST_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/* When a plugin is built for gsd-plugin-host, PLUGIN_HOST_SYMBOL is
+ * defined and the daemon skeleton defines an entry with that name
+ * instead of main(). */
+typedef struct {
+        const char  *name;
+        const char  *dbus_name;
+        gboolean     needs_gtk;
+        const char  *gdk_backend;      /* NULL for GDK's default */
+        gboolean     wait_for_ready;
+        GObject   *(*new_manager)      (void);
+        gboolean   (*start)            (GObject  *manager,
+                                        GError  **error);
+        void       (*stop)             (GObject  *manager);
+} GsdPluginHostEntry;
+
+extern const GsdPluginHostEntry *gsd_plugin_host_entries[];
+
+G_END_DECLS
+
+#endif /* __GSD_PLUGIN_HOST_H */
@@ -0,0 +1,186 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Creates all the D-Bus proxies a plugin declares at the same time,
+ * instead of one blocking round-trip after the other, and reports how
+ * long each of them took to resolve.
+ *
+ * The proxies are only stored once the whole batch is resolved, and
+ * never if the operation was cancelled, so a plugin stopped while
+ * starting up does not get proxies assigned behind its back.
+ */
+
+#include "config.h"
+
+#include "gnome-settings-profile.h"
+#include "gsd-startup.h"
+
+typedef struct {
+        gchar           *plugin;
+        GsdStartupProxy *proxies;
+        GDBusProxy     **results;
+        GError          *error;
+        guint            n_proxies;
+        guint            n_pending;
+        gint64           start_time;
+} StartupData;
+
+typedef struct {
+        GTask *task;
+        guint  index;
+        gint64 start_time;
+} ProxyRequest;
+
+static void
+startup_data_free (StartupData *data)
+{
+        guint i;
+
+        for (i = 0; i < data->n_proxies; i++)
+                g_clear_object (&data->results[i]);
+        g_free (data->results);
+        g_free (data->proxies);
+        g_clear_error (&data->error);
+        g_free (data->plugin);
+        g_free (data);
+}
+
+static void
+startup_complete (GTask *task)
+{
+        StartupData *data = g_task_get_task_data (task);
+        guint i;
+
+        g_debug ("%s: %u D-Bus proxies resolved in %" G_GINT64_FORMAT " ms",
+                 data->plugin, data->n_proxies,
+                 (g_get_monotonic_time () - data->start_time) / 1000);
+        gnome_settings_profile_msg ("%s: D-Bus proxies resolved", data->plugin);
+
+        if (g_task_return_error_if_cancelled (task))
+                return;
+
+        if (data->error != NULL) {
+                g_task_return_error (task, g_steal_pointer (&data->error));
+                return;
+        }
+
+        for (i = 0; i < data->n_proxies; i++)
+                *data->proxies[i].proxy = g_steal_pointer (&data->results[i]);
+
+        g_task_return_boolean (task, TRUE);
+}
+
+static void
+proxy_ready_cb (GObject      *source_object,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+        ProxyRequest *request = user_data;
+        GTask *task = request->task;
+        StartupData *data = g_task_get_task_data (task);
+        const GsdStartupProxy *proxy = &data->proxies[request->index];
+        GError *error = NULL;
+
+        data->results[request->index] =
+                G_DBUS_PROXY (g_async_initable_new_finish (G_ASYNC_INITABLE (source_object),
+                                                           res, &error));
+
+        if (error != NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_warning ("%s: failed to create proxy for %s: %s",
+                                   data->plugin, proxy->name, error->message);
+                }
+
+                if (proxy->required && data->error == NULL)
+                        data->error = error;
+                else
+                        g_error_free (error);
+        } else {
+                g_debug ("%s: proxy for %s ready after %" G_GINT64_FORMAT " ms",
+                         data->plugin, proxy->name,
+                         (g_get_monotonic_time () - request->start_time) / 1000);
+        }
+
+        if (--data->n_pending == 0)
+                startup_complete (task);
+
+        g_free (request);
+        g_object_unref (task);
+}
+
+void
+gsd_startup_new_proxies (const gchar           *plugin,
+                         const GsdStartupProxy *proxies,
+                         guint                  n_proxies,
+                         GCancellable          *cancellable,
+                         GAsyncReadyCallback    callback,
+                         gpointer               user_data)
+{
+        g_autoptr(GTask) task = NULL;
+        StartupData *data;
+        guint i;
+
+        task = g_task_new (NULL, cancellable, callback, user_data);
+        g_task_set_source_tag (task, gsd_startup_new_proxies);
+
+        data = g_new0 (StartupData, 1);
+        data->plugin = g_strdup (plugin);
+        data->proxies = g_memdup (proxies, n_proxies * sizeof (GsdStartupProxy));
+        data->results = g_new0 (GDBusProxy *, n_proxies);
+        data->n_proxies = n_proxies;
+        data->n_pending = n_proxies;
+        data->start_time = g_get_monotonic_time ();
+        g_task_set_task_data (task, data, (GDestroyNotify) startup_data_free);
+
+        if (n_proxies == 0) {
+                startup_complete (task);
+                return;
+        }
+
+        for (i = 0; i < n_proxies; i++) {
+                ProxyRequest *request;
+
+                request = g_new0 (ProxyRequest, 1);
+                request->task = g_object_ref (task);
+                request->index = i;
+                request->start_time = data->start_time;
+
+                /* same as g_dbus_proxy_new_for_bus(), for any proxy type */
+                g_async_initable_new_async (proxies[i].proxy_type != G_TYPE_INVALID ?
+                                            proxies[i].proxy_type : G_TYPE_DBUS_PROXY,
+                                            G_PRIORITY_DEFAULT,
+                                            cancellable,
+                                            proxy_ready_cb,
+                                            request,
+                                            "g-flags", proxies[i].flags,
+                                            "g-name", proxies[i].name,
+                                            "g-bus-type", proxies[i].bus_type,
+                                            "g-object-path", proxies[i].object_path,
+                                            "g-interface-name", proxies[i].interface_name,
+                                            NULL);
+        }
+}
+
+gboolean
+gsd_startup_new_proxies_finish (GAsyncResult  *result,
+                                GError       **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+        return g_task_propagate_boolean (G_TASK (result), error);
+}
@@ -0,0 +1,52 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_STARTUP_H__
+#define __GSD_STARTUP_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* A D-Bus proxy a plugin needs before it can be considered started.
+ * The resulting proxy is stored in *proxy, which is left NULL when
+ * the proxy could not be created. proxy_type can be set to a
+ * GDBusProxy subclass, such as a gdbus-codegen generated proxy, and
+ * defaults to GDBusProxy itself. */
+typedef struct {
+        GBusType          bus_type;
+        GDBusProxyFlags   flags;
+        const gchar      *name;
+        const gchar      *object_path;
+        const gchar      *interface_name;
+        GDBusProxy      **proxy;
+        gboolean          required;
+        GType             proxy_type;
+} GsdStartupProxy;
+
+void     gsd_startup_new_proxies        (const gchar           *plugin,
+                                         const GsdStartupProxy *proxies,
+                                         guint                  n_proxies,
+                                         GCancellable          *cancellable,
+                                         GAsyncReadyCallback    callback,
+                                         gpointer               user_data);
+gboolean gsd_startup_new_proxies_finish (GAsyncResult          *result,
+                                         GError               **error);
+
+G_END_DECLS
+
+#endif /* __GSD_STARTUP_H__ */
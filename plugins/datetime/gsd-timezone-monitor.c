@@ -21,6 +21,8 @@
 
 #include "gsd-timezone-monitor.h"
 
+#include "gsd-startup.h"
+
 #include "timedated.h"
 #include "tz.h"
 #include "weather-tz.h"
@@ -421,6 +423,54 @@ check_location_settings (GsdTimezoneMonitor *self)
                 stop_geoclue (self);
 }
 
+static void
+startup_proxies_cb (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+        GsdTimezoneMonitor *self;
+        GsdTimezoneMonitorPrivate *priv;
+        g_autoptr(GError) error = NULL;
+
+        if (!gsd_startup_new_proxies_finish (res, &error)) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Could not get proxy for DateTimeMechanism: %s", error->message);
+                return;
+        }
+
+        self = GSD_TIMEZONE_MONITOR (user_data);
+        priv = gsd_timezone_monitor_get_instance_private (self);
+
+        priv->current_timezone = timedate1_dup_timezone (priv->dtm);
+        priv->tzdb = tz_load_db ();
+        priv->weather_tzdb = weather_tz_db_new ();
+
+        priv->location_settings = g_settings_new ("org.gnome.system.location");
+        g_signal_connect_swapped (priv->location_settings, "changed::enabled",
+                                  G_CALLBACK (check_location_settings), self);
+        check_location_settings (self);
+}
+
+static void
+start_proxies (GsdTimezoneMonitor *self)
+{
+        GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (self);
+        const GsdStartupProxy proxies[] = {
+                { G_BUS_TYPE_SYSTEM, G_DBUS_PROXY_FLAGS_NONE,
+                  "org.freedesktop.timedate1",
+                  "/org/freedesktop/timedate1",
+                  "org.freedesktop.timedate1",
+                  (GDBusProxy **) &priv->dtm, TRUE,
+                  TYPE_TIMEDATE1_PROXY },
+        };
+
+        gsd_startup_new_proxies ("datetime",
+                                 proxies, G_N_ELEMENTS (proxies),
+                                 priv->cancellable,
+                                 startup_proxies_cb,
+                                 self);
+}
+
 static void
 gsd_timezone_monitor_init (GsdTimezoneMonitor *self)
 {
@@ -446,24 +496,5 @@ gsd_timezone_monitor_init (GsdTimezoneMonitor *self)
         }
 
         priv->cancellable = g_cancellable_new ();
-        priv->dtm = timedate1_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-                                                      G_DBUS_PROXY_FLAGS_NONE,
-                                                      "org.freedesktop.timedate1",
-                                                      "/org/freedesktop/timedate1",
-                                                      priv->cancellable,
-                                                      &error);
-        if (priv->dtm == NULL) {
-                g_warning ("Could not get proxy for DateTimeMechanism: %s", error->message);
-                g_error_free (error);
-                return;
-        }
-
-        priv->current_timezone = timedate1_dup_timezone (priv->dtm);
-        priv->tzdb = tz_load_db ();
-        priv->weather_tzdb = weather_tz_db_new ();
-
-        priv->location_settings = g_settings_new ("org.gnome.system.location");
-        g_signal_connect_swapped (priv->location_settings, "changed::enabled",
-                                  G_CALLBACK (check_location_settings), self);
-        check_location_settings (self);
+        start_proxies (self);
 }
@@ -62,6 +62,7 @@
 #include "gsd-input-helper.h"
 #include "gsd-enums.h"
 #include "gsd-shell-helper.h"
+#include "gsd-startup.h"
 
 #include <canberra.h>
 #include <pulse/pulseaudio.h>
@@ -235,6 +236,7 @@ typedef struct
         gint             inhibit_keys_fd;
         gint             inhibit_suspend_fd;
         gboolean         inhibit_suspend_taken;
+        gboolean         ready;
 
         /* UPower stuff */
         UpClient        *up_client;
@@ -247,6 +249,12 @@ typedef struct
         GDBusConnection *connection;
         GCancellable    *bus_cancellable;
 
+        /* Keyring environment, passed to launched applications */
+        guint            keyring_watch_id;
+        gboolean         keyring_has_owner;
+        GHashTable      *keyring_env;
+        GCancellable    *keyring_cancellable;
+
         guint            start_idle_id;
 
         /* Multimedia keys */
@@ -254,10 +262,16 @@ typedef struct
         MprisController *mpris_controller;
 } GsdMediaKeysManagerPrivate;
 
+enum {
+        PROP_0,
+        PROP_READY,
+};
+
 static void     gsd_media_keys_manager_class_init  (GsdMediaKeysManagerClass *klass);
 static void     gsd_media_keys_manager_init        (GsdMediaKeysManager      *media_keys_manager);
 static void     gsd_media_keys_manager_finalize    (GObject                  *object);
 static void     register_manager                   (GsdMediaKeysManager      *manager);
+static void     start_proxies                      (GsdMediaKeysManager      *manager);
 static void     custom_binding_changed             (GSettings           *settings,
                                                     const char          *settings_key,
                                                     GsdMediaKeysManager *manager);
@@ -324,52 +338,126 @@ grab_ungrab_data_free (GrabUngrabData *data)
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (GrabUngrabData, grab_ungrab_data_free)
 
+static void keyring_get_environment (GsdMediaKeysManager *manager,
+                                     gboolean             auto_start);
+
 static void
 set_launch_context_env (GsdMediaKeysManager *manager,
 			GAppLaunchContext   *launch_context)
 {
 	GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+	GHashTableIter iter;
+	const char *key, *value;
+
+	if (priv->keyring_env == NULL) {
+		g_debug ("Keyring environment not known yet, launching without it");
+		/* so that the next launch has it */
+		if (priv->keyring_cancellable == NULL && priv->connection != NULL)
+			keyring_get_environment (manager, TRUE);
+		return;
+	}
+
+	g_hash_table_iter_init (&iter, priv->keyring_env);
+	while (g_hash_table_iter_next (&iter, (gpointer *) &key, (gpointer *) &value))
+		g_app_launch_context_setenv (launch_context, key, value);
+}
+
+static void
+keyring_environment_ready_cb (GObject      *source_object,
+                              GAsyncResult *res,
+                              gpointer      user_data)
+{
+	GsdMediaKeysManager *manager = user_data;
+	GsdMediaKeysManagerPrivate *priv;
 	GError *error = NULL;
-	GVariant *variant, *item;
+	GVariant *variant;
 	GVariantIter *iter;
+	char *key, *value;
 
-	variant = g_dbus_connection_call_sync (priv->connection,
-					       GNOME_KEYRING_DBUS_NAME,
-					       GNOME_KEYRING_DBUS_PATH,
-					       GNOME_KEYRING_DBUS_INTERFACE,
-					       "GetEnvironment",
-					       NULL,
-					       NULL,
-					       G_DBUS_CALL_FLAGS_NONE,
-					       -1,
-					       NULL,
-					       &error);
+	variant = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
 	if (variant == NULL) {
-		g_warning ("Failed to call GetEnvironment on keyring daemon: %s", error->message);
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_warning ("Failed to call GetEnvironment on keyring daemon: %s", error->message);
+			/* allow the next launch to retry */
+			priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+			g_clear_object (&priv->keyring_cancellable);
+		}
 		g_error_free (error);
 		return;
 	}
 
+	priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+	g_clear_object (&priv->keyring_cancellable);
+	g_clear_pointer (&priv->keyring_env, g_hash_table_unref);
+	priv->keyring_env = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
 	g_variant_get (variant, "(a{ss})", &iter);
+	while (g_variant_iter_next (iter, "{ss}", &key, &value))
+		g_hash_table_insert (priv->keyring_env, key, value);
 
-	while ((item = g_variant_iter_next_value (iter))) {
-		char *key;
-		char *value;
+	g_debug ("Cached %u keyring environment variables", g_hash_table_size (priv->keyring_env));
 
-		g_variant_get (item,
-			       "{ss}",
-			       &key,
-			       &value);
+	g_variant_iter_free (iter);
+	g_variant_unref (variant);
+}
 
-		g_app_launch_context_setenv (launch_context, key, value);
+static void
+keyring_get_environment (GsdMediaKeysManager *manager,
+                         gboolean             auto_start)
+{
+	GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
 
-		g_variant_unref (item);
-		g_free (key);
-		g_free (value);
-	}
+	if (priv->keyring_cancellable != NULL)
+		g_cancellable_cancel (priv->keyring_cancellable);
+	g_clear_object (&priv->keyring_cancellable);
+	priv->keyring_cancellable = g_cancellable_new ();
+
+	g_dbus_connection_call (priv->connection,
+				GNOME_KEYRING_DBUS_NAME,
+				GNOME_KEYRING_DBUS_PATH,
+				GNOME_KEYRING_DBUS_INTERFACE,
+				"GetEnvironment",
+				NULL,
+				G_VARIANT_TYPE ("(a{ss})"),
+				auto_start ? G_DBUS_CALL_FLAGS_NONE : G_DBUS_CALL_FLAGS_NO_AUTO_START,
+				-1,
+				priv->keyring_cancellable,
+				keyring_environment_ready_cb,
+				manager);
+}
 
-	g_variant_iter_free (iter);
-	g_variant_unref (variant);
+static void
+keyring_appeared_cb (GDBusConnection *connection,
+                     const gchar     *name,
+                     const gchar     *name_owner,
+                     gpointer         user_data)
+{
+	GsdMediaKeysManager *manager = user_data;
+	GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+
+	priv->keyring_has_owner = TRUE;
+
+	/* A new keyring daemon may use a different environment */
+	keyring_get_environment (manager, FALSE);
+}
+
+static void
+keyring_vanished_cb (GDBusConnection *connection,
+                     const gchar     *name,
+                     gpointer         user_data)
+{
+	GsdMediaKeysManager *manager = user_data;
+	GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+
+	/* Not running at startup, keep the call auto-starting it going */
+	if (!priv->keyring_has_owner)
+		return;
+	priv->keyring_has_owner = FALSE;
+
+	if (priv->keyring_cancellable != NULL)
+		g_cancellable_cancel (priv->keyring_cancellable);
+	g_clear_object (&priv->keyring_cancellable);
+	g_clear_pointer (&priv->keyring_env, g_hash_table_unref);
 }
 
 static char *
@@ -2177,6 +2265,9 @@ power_action (GsdMediaKeysManager *manager,
 {
         GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
 
+        if (priv->logind_proxy == NULL)
+                return;
+
         g_dbus_proxy_call (priv->logind_proxy,
                            action,
                            g_variant_new ("(b)", allow_interaction),
@@ -2241,7 +2332,7 @@ supports_power_action (GsdMediaKeysManager *manager,
                 break;
         }
 
-        if (method_name == NULL)
+        if (method_name == NULL || priv->logind_proxy == NULL)
                 return FALSE;
 
         variant = g_dbus_proxy_call_sync (priv->logind_proxy,
@@ -3072,6 +3163,24 @@ on_screencast_proxy_ready (GObject      *source,
         }
 }
 
+static void
+on_chassis_type_ready (GObject      *source,
+                       GAsyncResult *result,
+                       gpointer      data)
+{
+        GsdMediaKeysManager *manager = data;
+        GsdMediaKeysManagerPrivate *priv;
+        g_autoptr(GError) error = NULL;
+        char *chassis_type;
+
+        chassis_type = gnome_settings_get_chassis_type_finish (result, &error);
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                return;
+
+        priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+        priv->chassis_type = chassis_type;
+}
+
 static void
 on_key_grabber_ready (GObject      *source,
                       GAsyncResult *result,
@@ -3122,6 +3231,47 @@ shell_presence_changed (GsdMediaKeysManager *manager)
         }
 }
 
+static void
+on_shell_proxy_ready (GObject      *source,
+                      GAsyncResult *result,
+                      gpointer      data)
+{
+        GsdMediaKeysManager *manager = data;
+        GsdMediaKeysManagerPrivate *priv;
+        GsdShell *shell_proxy;
+
+        /* failures other than cancellation were already warned about */
+        shell_proxy = gnome_settings_bus_get_shell_proxy_finish (result, NULL);
+        if (shell_proxy == NULL)
+                return;
+
+        priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+        priv->shell_proxy = shell_proxy;
+        g_signal_connect_swapped (priv->shell_proxy, "notify::g-name-owner",
+                                  G_CALLBACK (shell_presence_changed), manager);
+        shell_presence_changed (manager);
+}
+
+static void
+on_screen_saver_proxy_ready (GObject      *source,
+                             GAsyncResult *result,
+                             gpointer      data)
+{
+        GsdMediaKeysManager *manager = data;
+        GsdMediaKeysManagerPrivate *priv;
+        GsdScreenSaver *screen_saver_proxy;
+
+        screen_saver_proxy = gnome_settings_bus_get_screen_saver_proxy_finish (result, NULL);
+        if (screen_saver_proxy == NULL)
+                return;
+
+        priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+        if (priv->screen_saver_proxy == NULL)
+                priv->screen_saver_proxy = screen_saver_proxy;
+        else
+                g_object_unref (screen_saver_proxy);
+}
+
 static void
 on_rfkill_proxy_ready (GObject      *source,
                        GAsyncResult *result,
@@ -3184,7 +3334,9 @@ start_media_keys_idle_cb (GsdMediaKeysManager *manager)
 
         /* for the power plugin interface code */
         priv->power_settings = g_settings_new (SETTINGS_POWER_DIR);
-        priv->chassis_type = gnome_settings_get_chassis_type ();
+        gnome_settings_get_chassis_type_async (priv->bus_cancellable,
+                                               on_chassis_type_ready,
+                                               manager);
 
         /* Logic from http://git.gnome.org/browse/gnome-shell/tree/js/ui/status/accessibility.js#n163 */
         priv->interface_settings = g_settings_new (SETTINGS_INTERFACE_DIR);
@@ -3203,10 +3355,14 @@ start_media_keys_idle_cb (GsdMediaKeysManager *manager)
         priv->screencast_cancellable = g_cancellable_new ();
         priv->rfkill_cancellable = g_cancellable_new ();
 
-        priv->shell_proxy = gnome_settings_bus_get_shell_proxy ();
-        g_signal_connect_swapped (priv->shell_proxy, "notify::g-name-owner",
-                                  G_CALLBACK (shell_presence_changed), manager);
-        shell_presence_changed (manager);
+        gnome_settings_bus_get_shell_proxy_async (priv->grab_cancellable,
+                                                  on_shell_proxy_ready,
+                                                  manager);
+
+        /* so that locking the screen does not have to wait for it */
+        gnome_settings_bus_get_screen_saver_proxy_async (priv->bus_cancellable,
+                                                         on_screen_saver_proxy_ready,
+                                                         manager);
 
         g_dbus_proxy_new_for_bus (G_BUS_TYPE_SESSION,
                                   0, NULL,
@@ -3348,6 +3504,7 @@ gsd_media_keys_manager_start (GsdMediaKeysManager *manager,
         g_source_set_name_by_id (priv->start_idle_id, "[gnome-settings-daemon] start_media_keys_idle_cb");
 
         register_manager (manager_object);
+        start_proxies (manager);
 
         gnome_settings_profile_end (NULL);
 
@@ -3397,6 +3554,18 @@ gsd_media_keys_manager_stop (GsdMediaKeysManager *manager)
                 priv->iio_sensor_watch_id = 0;
         }
 
+        if (priv->keyring_watch_id > 0) {
+                g_bus_unwatch_name (priv->keyring_watch_id);
+                priv->keyring_watch_id = 0;
+                priv->keyring_has_owner = FALSE;
+        }
+
+        if (priv->keyring_cancellable != NULL) {
+                g_cancellable_cancel (priv->keyring_cancellable);
+                g_clear_object (&priv->keyring_cancellable);
+        }
+        g_clear_pointer (&priv->keyring_env, g_hash_table_unref);
+
         if (priv->inhibit_suspend_fd != -1) {
                 close (priv->inhibit_suspend_fd);
                 priv->inhibit_suspend_fd = -1;
@@ -3538,6 +3707,8 @@ inhibit_suspend (GsdMediaKeysManager *manager)
                 g_debug ("already inhibited suspend");
                 return;
         }
+        if (priv->logind_proxy == NULL)
+                return;
         g_debug ("Adding suspend delay inhibitor");
         priv->inhibit_suspend_taken = TRUE;
         g_dbus_proxy_call_with_unix_fd_list (priv->logind_proxy,
@@ -3637,12 +3808,40 @@ logind_proxy_signal_cb (GDBusProxy  *proxy,
         }
 }
 
+static void
+gsd_media_keys_manager_get_property (GObject    *object,
+                                     guint       prop_id,
+                                     GValue     *value,
+                                     GParamSpec *pspec)
+{
+        GsdMediaKeysManager *manager = GSD_MEDIA_KEYS_MANAGER (object);
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+
+        switch (prop_id) {
+        case PROP_READY:
+                g_value_set_boolean (value, priv->ready);
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+                break;
+        }
+}
+
 static void
 gsd_media_keys_manager_class_init (GsdMediaKeysManagerClass *klass)
 {
         GObjectClass   *object_class = G_OBJECT_CLASS (klass);
 
+        object_class->get_property = gsd_media_keys_manager_get_property;
         object_class->finalize = gsd_media_keys_manager_finalize;
+
+        g_object_class_install_property (object_class,
+                                         PROP_READY,
+                                         g_param_spec_boolean ("ready",
+                                                               NULL,
+                                                               NULL,
+                                                               FALSE,
+                                                               G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -3677,43 +3876,11 @@ inhibit_done (GObject      *source,
 }
 
 static void
-gsd_media_keys_manager_init (GsdMediaKeysManager *manager)
+setup_logind (GsdMediaKeysManager *manager)
 {
         GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
-        GError *error;
-        GDBusConnection *bus;
-
-        error = NULL;
-        priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
-
-        bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
-        if (bus == NULL) {
-                g_warning ("Failed to connect to system bus: %s",
-                           error->message);
-                g_error_free (error);
-                return;
-        }
-
-        priv->logind_proxy =
-                g_dbus_proxy_new_sync (bus,
-                                       0,
-                                       NULL,
-                                       SYSTEMD_DBUS_NAME,
-                                       SYSTEMD_DBUS_PATH,
-                                       SYSTEMD_DBUS_INTERFACE,
-                                       NULL,
-                                       &error);
-
-        if (priv->logind_proxy == NULL) {
-                g_warning ("Failed to connect to systemd: %s",
-                           error->message);
-                g_error_free (error);
-        }
-
-        g_object_unref (bus);
 
         g_debug ("Adding system inhibitors for power keys");
-        priv->inhibit_keys_fd = -1;
         g_dbus_proxy_call_with_unix_fd_list (priv->logind_proxy,
                                              "Inhibit",
                                              g_variant_new ("(ssss)",
@@ -3729,13 +3896,65 @@ gsd_media_keys_manager_init (GsdMediaKeysManager *manager)
                                              manager);
 
         g_debug ("Adding delay inhibitor for suspend");
-        priv->inhibit_suspend_fd = -1;
         g_signal_connect (priv->logind_proxy, "g-signal",
                           G_CALLBACK (logind_proxy_signal_cb),
                           manager);
         inhibit_suspend (manager);
 }
 
+static void
+startup_proxies_cb (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+        GsdMediaKeysManager *manager;
+        GsdMediaKeysManagerPrivate *priv;
+        g_autoptr(GError) error = NULL;
+
+        if (!gsd_startup_new_proxies_finish (res, &error)) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Failed to start media-keys: %s", error->message);
+                return;
+        }
+
+        manager = GSD_MEDIA_KEYS_MANAGER (user_data);
+        priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+
+        if (priv->logind_proxy != NULL)
+                setup_logind (manager);
+
+        priv->ready = TRUE;
+        g_object_notify (G_OBJECT (manager), "ready");
+}
+
+/* The manager is only ready once logind took over the power keys
+ * inhibitors, the other proxies are created from the idle callback */
+static void
+start_proxies (GsdMediaKeysManager *manager)
+{
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+        const GsdStartupProxy proxies[] = {
+                { G_BUS_TYPE_SYSTEM, G_DBUS_PROXY_FLAGS_NONE,
+                  SYSTEMD_DBUS_NAME, SYSTEMD_DBUS_PATH, SYSTEMD_DBUS_INTERFACE,
+                  &priv->logind_proxy, FALSE },
+        };
+
+        gsd_startup_new_proxies ("media-keys",
+                                 proxies, G_N_ELEMENTS (proxies),
+                                 priv->bus_cancellable,
+                                 startup_proxies_cb,
+                                 manager);
+}
+
+static void
+gsd_media_keys_manager_init (GsdMediaKeysManager *manager)
+{
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+
+        priv->inhibit_keys_fd = -1;
+        priv->inhibit_suspend_fd = -1;
+}
+
 static void
 gsd_media_keys_manager_finalize (GObject *object)
 {
@@ -3901,6 +4120,15 @@ on_bus_gotten (GObject             *source_object,
                                                              G_BUS_NAME_OWNER_FLAGS_NONE,
                                                              NULL, NULL, NULL, NULL);
 
+        priv->keyring_watch_id = g_bus_watch_name_on_connection (priv->connection,
+                                                                 GNOME_KEYRING_DBUS_NAME,
+                                                                 G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                                 keyring_appeared_cb,
+                                                                 keyring_vanished_cb,
+                                                                 manager, NULL);
+        /* The watcher doesn't start the keyring daemon, this does */
+        keyring_get_environment (manager, TRUE);
+
         g_dbus_proxy_new (priv->connection,
                           G_DBUS_PROXY_FLAGS_NONE,
                           NULL,
@@ -0,0 +1,197 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Turns ambient light readings into backlight changes.
+ *
+ * The readings, which do not have to be Lux, are normalized against the
+ * brightness the user last chose and smoothed with a time-weighted moving
+ * average. Changes of that average only result in a new brightness when
+ * they are larger than the dead band, or the hysteresis when the light
+ * changes direction, larger than what the backlight can represent, and
+ * not sooner than GSD_AMBIENT_MIN_INTERVAL after the previous one.
+ *
+ * There is no I/O in here, so that recorded traces can be replayed.
+ */
+
+#include "config.h"
+
+#include "gsd-ambient-light.h"
+
+struct _GsdAmbientLight
+{
+        gboolean norm_required;
+        gdouble  norm_value;
+        gdouble  accumulator;
+        gdouble  last_absolute;
+        gint64   last_time;
+        gdouble  resolution;
+
+        /* the brightness set last, by us or by the user */
+        gint     percentage;
+        gint     direction;
+        gint64   update_time;
+};
+
+GsdAmbientLight *
+gsd_ambient_light_new (void)
+{
+        GsdAmbientLight *ambient;
+
+        ambient = g_new0 (GsdAmbientLight, 1);
+        ambient->norm_required = TRUE;
+        ambient->norm_value = -1.f;
+        ambient->accumulator = -1.f;
+        ambient->last_absolute = -1.f;
+        ambient->resolution = 1.f;
+        ambient->percentage = -1;
+
+        return ambient;
+}
+
+void
+gsd_ambient_light_free (GsdAmbientLight *ambient)
+{
+        g_free (ambient);
+}
+
+/* The smallest change the backlight can represent, in percent */
+void
+gsd_ambient_light_set_resolution (GsdAmbientLight *ambient,
+                                  gdouble          resolution)
+{
+        ambient->resolution = resolution;
+}
+
+/* The brightness was changed by somebody else, the next reading will be
+ * taken as corresponding to it. */
+void
+gsd_ambient_light_set_brightness (GsdAmbientLight *ambient,
+                                  gint             percentage)
+{
+        ambient->percentage = percentage;
+        ambient->direction = 0;
+        ambient->norm_required = TRUE;
+}
+
+static void
+renormalize (GsdAmbientLight *ambient)
+{
+        if (ambient->percentage < 0)
+                return;
+        if (ambient->last_absolute < 0)
+                return;
+        ambient->norm_value = ambient->last_absolute /
+                                (gdouble) ambient->percentage;
+        ambient->norm_value *= 100.f;
+        ambient->norm_required = FALSE;
+}
+
+void
+gsd_ambient_light_add_reading (GsdAmbientLight *ambient,
+                               gdouble          level,
+                               gint64           time)
+{
+        gdouble brightness;
+        gdouble alpha;
+
+        /* not a valid reading */
+        if (level <= 0.f)
+                return;
+
+        ambient->last_absolute = level;
+
+        /* the user has asked to renormalize */
+        if (ambient->norm_required) {
+                g_debug ("Renormalizing light level from old light percentage: %d%%",
+                         ambient->percentage);
+                ambient->accumulator = ambient->percentage;
+                renormalize (ambient);
+        }
+
+        /* time-weighted constant for moving average */
+        if (ambient->last_time && time > ambient->last_time)
+                alpha = 1.0f / (1.0f + (GSD_AMBIENT_TIME_CONSTANT / (time - ambient->last_time)));
+        else
+                alpha = 0.0f;
+        ambient->last_time = time;
+
+        /* calculate exponential weighted moving average */
+        brightness = ambient->last_absolute * 100.f / ambient->norm_value;
+        brightness = MIN (brightness, 100.f);
+        brightness = MAX (brightness, 0.f);
+
+        ambient->accumulator = (alpha * brightness) +
+                (1.0 - alpha) * ambient->accumulator;
+}
+
+/**
+ * gsd_ambient_light_get_update:
+ * @ambient: a #GsdAmbientLight
+ * @time: the current monotonic time
+ * @retry_time: (out): when to call again if a change is being held back
+ *
+ * Returns: the brightness to set, or -1 if it should stay as it is. In
+ * the latter case, @retry_time is set to the time at which a change held
+ * back by the rate limit can be made, and to 0 otherwise.
+ **/
+gint
+gsd_ambient_light_get_update (GsdAmbientLight *ambient,
+                              gint64           time,
+                              gint64          *retry_time)
+{
+        gint target;
+        gint direction;
+        gdouble threshold;
+
+        *retry_time = 0;
+
+        /* no valid readings yet */
+        if (ambient->accumulator < 0.f)
+                return -1;
+
+        target = ambient->accumulator;
+
+        if (ambient->percentage >= 0) {
+                gint diff = target - ambient->percentage;
+
+                if (diff == 0)
+                        return -1;
+                direction = diff > 0 ? 1 : -1;
+
+                /* settled, or too small a change to be worth it */
+                threshold = (ambient->direction == 0 || direction == ambient->direction) ?
+                        GSD_AMBIENT_DEAD_BAND : GSD_AMBIENT_HYSTERESIS;
+                threshold = MAX (threshold, ambient->resolution);
+                if (ABS (diff) < threshold)
+                        return -1;
+        } else {
+                direction = 0;
+        }
+
+        if (ambient->update_time != 0 &&
+            time - ambient->update_time < GSD_AMBIENT_MIN_INTERVAL) {
+                *retry_time = ambient->update_time + GSD_AMBIENT_MIN_INTERVAL;
+                return -1;
+        }
+
+        ambient->update_time = time;
+        ambient->direction = direction;
+        ambient->percentage = target;
+
+        return target;
+}
@@ -0,0 +1,61 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_AMBIENT_LIGHT_H
+#define __GSD_AMBIENT_LIGHT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The bandwidth of the low-pass filter used to smooth ambient light readings,
+ * measured in Hz.  Smaller numbers result in smoother backlight changes.
+ * Larger numbers are more responsive to abrupt changes in ambient light. */
+#define GSD_AMBIENT_BANDWIDTH_HZ        0.1f
+
+/* Convert bandwidth to time constant.  Units of constant are microseconds. */
+#define GSD_AMBIENT_TIME_CONSTANT       (G_USEC_PER_SEC * 1.0f / (2.0f * G_PI * GSD_AMBIENT_BANDWIDTH_HZ))
+
+/* Smallest brightness change, in percent, made when the light keeps
+ * changing in the same direction, and when it changes direction. */
+#define GSD_AMBIENT_DEAD_BAND           2.0f
+#define GSD_AMBIENT_HYSTERESIS          5.0f
+
+/* Minimum time between two brightness changes, in microseconds */
+#define GSD_AMBIENT_MIN_INTERVAL        (G_USEC_PER_SEC / 2)
+
+typedef struct _GsdAmbientLight GsdAmbientLight;
+
+GsdAmbientLight *gsd_ambient_light_new            (void);
+void             gsd_ambient_light_free           (GsdAmbientLight *ambient);
+
+void             gsd_ambient_light_set_resolution (GsdAmbientLight *ambient,
+                                                   gdouble          resolution);
+void             gsd_ambient_light_set_brightness (GsdAmbientLight *ambient,
+                                                   gint             percentage);
+void             gsd_ambient_light_add_reading    (GsdAmbientLight *ambient,
+                                                   gdouble          level,
+                                                   gint64           time);
+gint             gsd_ambient_light_get_update     (GsdAmbientLight *ambient,
+                                                   gint64           time,
+                                                   gint64          *retry_time);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsdAmbientLight, gsd_ambient_light_free)
+
+G_END_DECLS
+
+#endif /* __GSD_AMBIENT_LIGHT_H */
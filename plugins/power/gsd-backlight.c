@@ -459,6 +459,22 @@ gsd_backlight_get_brightness (GsdBacklight *backlight, gint *target)
         return ABS_TO_PERCENTAGE (backlight->brightness_min, backlight->brightness_max, backlight->brightness_val);
 }
 
+/**
+ * gsd_backlight_get_resolution
+ * @backlight: a #GsdBacklight
+ *
+ * Returns: The smallest change of the brightness, in percent, that the
+ * hardware can represent.
+ **/
+gdouble
+gsd_backlight_get_resolution (GsdBacklight *backlight)
+{
+        if (backlight->brightness_max <= backlight->brightness_min)
+                return 100.0;
+
+        return 100.0 / (backlight->brightness_max - backlight->brightness_min);
+}
+
 static void
 gsd_backlight_set_brightness_val_async (GsdBacklight *backlight,
                                         int value,
@@ -35,6 +35,7 @@ G_DECLARE_FINAL_TYPE (GsdBacklight, gsd_backlight, GSD, BACKLIGHT, GObject);
 
 gint gsd_backlight_get_brightness        (GsdBacklight         *backlight,
                                           gint                 *target);
+gdouble gsd_backlight_get_resolution    (GsdBacklight         *backlight);
 
 void gsd_backlight_set_brightness_async  (GsdBacklight         *backlight,
                                           gint                  percentage,
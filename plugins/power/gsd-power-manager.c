@@ -43,10 +43,12 @@
 #include "gsm-presence-flag.h"
 #include "gsm-manager-logout-mode.h"
 #include "gpm-common.h"
+#include "gsd-ambient-light.h"
 #include "gsd-backlight.h"
 #include "gnome-settings-profile.h"
 #include "gnome-settings-bus.h"
 #include "gsd-enums.h"
+#include "gsd-startup.h"
 #include "gsd-power-manager.h"
 
 #define GSD_DBUS_NAME "org.gnome.SettingsDaemon"
@@ -79,13 +81,14 @@
 /* And the time before we stop the warning sound */
 #define GSD_STOP_SOUND_DELAY GSD_ACTION_DELAY - 2
 
-/* The bandwidth of the low-pass filter used to smooth ambient light readings,
- * measured in Hz.  Smaller numbers result in smoother backlight changes.
- * Larger numbers are more responsive to abrupt changes in ambient light. */
-#define GSD_AMBIENT_BANDWIDTH_HZ       0.1f
+/* Number of steps, and time between them, of the keyboard backlight
+ * changes done when going idle and back */
+#define KBD_RAMP_STEPS                  5
+#define KBD_RAMP_INTERVAL               40 /* ms */
 
-/* Convert bandwidth to time constant.  Units of constant are microseconds. */
-#define GSD_AMBIENT_TIME_CONSTANT       (G_USEC_PER_SEC * 1.0f / (2.0f * G_PI * GSD_AMBIENT_BANDWIDTH_HZ))
+/* How long the shell gets to lock the screen before suspending anyway,
+ * this needs to be shorter than logind's InhibitDelayMaxSec (5 s) */
+#define GSD_LOCK_SCREENSAVER_TIMEOUT    3000 /* ms */
 
 static const gchar introspection_xml[] =
 "<node>"
@@ -139,6 +142,8 @@ struct _GsdPowerManager
         GDBusNodeInfo           *introspection_data;
         GDBusConnection         *connection;
         GCancellable            *cancellable;
+        guint                    startup_pending;
+        gboolean                 ready;
 
         /* Settings */
         GSettings               *settings;
@@ -148,13 +153,22 @@ struct _GsdPowerManager
         /* Screensaver */
         GsdScreenSaver          *screensaver_proxy;
         gboolean                 screensaver_active;
+        GQueue                   lock_tasks;
+        GCancellable            *lock_cancellable;
+        guint                    lock_timeout_id;
+        gint64                   lock_start_time;
+        gboolean                 lock_wait_for_active;
+        gboolean                 about_to_suspend;
+        gint64                   about_to_suspend_time;
 
         /* State */
         gboolean                 lid_is_present;
         gboolean                 lid_is_closed;
         gboolean                 session_is_active;
         UpClient                *up_client;
-        GPtrArray               *devices_array;
+        GHashTable              *devices;
+        GPtrArray               *devices_warning_changed;
+        guint                    devices_warning_id;
         UpDevice                *device_composite;
         GnomeRRScreen           *rr_screen;
         NotifyNotification      *notification_ups_discharging;
@@ -170,23 +184,37 @@ struct _GsdPowerManager
         /* Keyboard */
         GDBusProxy              *upower_kbd_proxy;
         gint                     kbd_brightness_now;
+        gint                     kbd_brightness_target;
         gint                     kbd_brightness_max;
         gint                     kbd_brightness_old;
         gint                     kbd_brightness_pre_dim;
+        GTask                   *kbd_active_task;
+        GQueue                   kbd_tasks;
+        guint                    kbd_ramp_id;
+        gint                     kbd_ramp_target;
+        gint                     kbd_ramp_step;
 
         /* Ambient */
         GDBusProxy              *iio_proxy;
+        GCancellable            *iio_proxy_cancellable;
         guint                    iio_proxy_watch_id;
-        gboolean                 ambient_norm_required;
-        gdouble                  ambient_accumulator;
-        gdouble                  ambient_norm_value;
-        gdouble                  ambient_percentage_old;
-        gdouble                  ambient_last_absolute;
-        gint64                   ambient_last_time;
+        gboolean                 iio_light_claimed;
+        GsdAmbientLight         *ambient;
+        gboolean                 ambient_enabled;
+        gboolean                 ambient_available;
+        guint                    ambient_update_id;
 
         /* Sound */
         guint32                  critical_alert_timeout_id;
 
+        /* Breathing LED helper */
+        GSubprocess             *led_helper;
+        GDataInputStream        *led_helper_stdout;
+        GCancellable            *led_cancellable;
+        gboolean                 led_helper_ready;
+        gboolean                 led_write_pending;
+        gint                     led_breathe_wanted; /* -1 if nothing to send */
+
         /* systemd stuff */
         GDBusProxy              *logind_proxy;
         gint                     inhibit_lid_switch_fd;
@@ -213,6 +241,7 @@ struct _GsdPowerManager
 
 enum {
         PROP_0,
+        PROP_READY,
 };
 
 static void     gsd_power_manager_class_init  (GsdPowerManagerClass *klass);
@@ -264,7 +293,9 @@ engine_device_add (GsdPowerManager *manager, UpDevice *device)
             kind == UP_DEVICE_KIND_UPS ||
             kind == UP_DEVICE_KIND_LINE_POWER)
                 return;
-        g_ptr_array_add (manager->devices_array, g_object_ref (device));
+        g_hash_table_insert (manager->devices,
+                             g_strdup (up_device_get_object_path (device)),
+                             g_object_ref (device));
 
         g_signal_connect (device, "notify::warning-level",
                           G_CALLBACK (engine_device_warning_changed_cb), manager);
@@ -272,6 +303,14 @@ engine_device_add (GsdPowerManager *manager, UpDevice *device)
         engine_device_warning_changed_cb (device, NULL, manager);
 }
 
+static void
+engine_device_disconnect (gpointer key,
+                          gpointer value,
+                          gpointer user_data)
+{
+        g_signal_handlers_disconnect_by_func (value, engine_device_warning_changed_cb, user_data);
+}
+
 static gboolean
 engine_coldplug (GsdPowerManager *manager)
 {
@@ -302,16 +341,15 @@ engine_device_added_cb (UpClient *client, UpDevice *device, GsdPowerManager *man
 static void
 engine_device_removed_cb (UpClient *client, const char *object_path, GsdPowerManager *manager)
 {
-        guint i;
+        UpDevice *device;
 
-        for (i = 0; i < manager->devices_array->len; i++) {
-                UpDevice *device = g_ptr_array_index (manager->devices_array, i);
+        device = g_hash_table_lookup (manager->devices, object_path);
+        if (device == NULL)
+                return;
 
-                if (g_strcmp0 (object_path, up_device_get_object_path (device)) == 0) {
-                        g_ptr_array_remove_index (manager->devices_array, i);
-                        break;
-                }
-        }
+        engine_device_disconnect (NULL, device, manager);
+        g_ptr_array_remove (manager->devices_warning_changed, device);
+        g_hash_table_remove (manager->devices, object_path);
 }
 
 static void
@@ -478,7 +516,7 @@ engine_charge_low (GsdPowerManager *manager, UpDevice *device)
         if (kind == UP_DEVICE_KIND_BATTERY) {
 
                 /* if the user has no other batteries, drop the "Laptop" wording */
-                ret = (manager->devices_array->len > 0);
+                ret = (g_hash_table_size (manager->devices) > 0);
                 if (ret) {
                         /* TRANSLATORS: laptop battery low, and we only have one battery */
                         title = _("Battery low");
@@ -628,7 +666,7 @@ engine_charge_critical (GsdPowerManager *manager, UpDevice *device)
         if (kind == UP_DEVICE_KIND_BATTERY) {
 
                 /* if the user has no other batteries, drop the "Laptop" wording */
-                ret = (manager->devices_array->len > 0);
+                ret = (g_hash_table_size (manager->devices) > 0);
                 if (ret) {
                         /* TRANSLATORS: laptop battery critically low, and only have one kind of battery */
                         title = _("Battery critically low");
@@ -892,7 +930,7 @@ engine_charge_action (GsdPowerManager *manager, UpDevice *device)
 }
 
 static void
-engine_device_warning_changed_cb (UpDevice *device, GParamSpec *pspec, GsdPowerManager *manager)
+engine_device_warning_changed (GsdPowerManager *manager, UpDevice *device)
 {
         UpDeviceLevel warning;
         UpDeviceKind kind;
@@ -930,6 +968,41 @@ engine_device_warning_changed_cb (UpDevice *device, GParamSpec *pspec, GsdPowerM
                 main_battery_or_ups_low_changed (manager, (warning != UP_DEVICE_LEVEL_NONE));
 }
 
+static gboolean
+engine_devices_warning_changed_idle_cb (gpointer user_data)
+{
+        GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
+        g_autoptr(GPtrArray) devices = NULL;
+        guint i;
+
+        manager->devices_warning_id = 0;
+
+        /* evaluating may show or close notifications, which could
+         * iterate the main loop */
+        devices = g_steal_pointer (&manager->devices_warning_changed);
+        manager->devices_warning_changed = g_ptr_array_new_with_free_func (g_object_unref);
+
+        for (i = 0; i < devices->len; i++)
+                engine_device_warning_changed (manager, g_ptr_array_index (devices, i));
+
+        return G_SOURCE_REMOVE;
+}
+
+/* Devices tend to change in bursts, only look at each one once per burst,
+ * with its latest warning level */
+static void
+engine_device_warning_changed_cb (UpDevice *device, GParamSpec *pspec, GsdPowerManager *manager)
+{
+        if (!g_ptr_array_find (manager->devices_warning_changed, device, NULL))
+                g_ptr_array_add (manager->devices_warning_changed, g_object_ref (device));
+
+        if (manager->devices_warning_id == 0) {
+                manager->devices_warning_id = g_idle_add (engine_devices_warning_changed_idle_cb, manager);
+                g_source_set_name_by_id (manager->devices_warning_id,
+                                         "[GsdPowerManager] devices warning changed");
+        }
+}
+
 static void
 gnome_session_shutdown_cb (GObject *source_object,
                            GAsyncResult *res,
@@ -1060,10 +1133,33 @@ action_hibernate (GsdPowerManager *manager)
                            "Error calling Hibernate");
 }
 
+static void
+iio_proxy_claim_light_cb (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+        g_autoptr(GVariant) result = NULL;
+        g_autoptr(GError) error = NULL;
+        GsdPowerManager *manager;
+
+        result = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object),
+                                           res,
+                                           &error);
+        if (result == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Call to iio-proxy failed: %s", error->message);
+                return;
+        }
+
+        /* released again in the meantime */
+        manager = GSD_POWER_MANAGER (user_data);
+        if (manager->iio_light_claimed)
+                iio_proxy_changed (manager);
+}
+
 static void
 iio_proxy_claim_light (GsdPowerManager *manager, gboolean active)
 {
-        GError *error = NULL;
         if (manager->iio_proxy == NULL)
                 return;
         if (!manager->backlight)
@@ -1085,19 +1181,183 @@ iio_proxy_claim_light (GsdPowerManager *manager, gboolean active)
                 g_signal_connect (manager->iio_proxy, "g-properties-changed",
                                   G_CALLBACK (iio_proxy_changed_cb), manager);
 
-        if (!g_dbus_proxy_call_sync (manager->iio_proxy,
-                                     active ? "ClaimLight" : "ReleaseLight",
-                                     NULL,
-                                     G_DBUS_CALL_FLAGS_NONE,
-                                     -1,
-                                     NULL,
-                                     &error)) {
-                g_warning ("Call to iio-proxy failed: %s", error->message);
+        manager->iio_light_claimed = active;
+
+        /* Both calls are sent in order on the same connection, so there
+         * is no need to wait for one before sending the other. */
+        if (active) {
+                g_dbus_proxy_call (manager->iio_proxy,
+                                   "ClaimLight",
+                                   NULL,
+                                   G_DBUS_CALL_FLAGS_NONE,
+                                   -1,
+                                   manager->cancellable,
+                                   iio_proxy_claim_light_cb,
+                                   manager);
+        } else {
+                g_dbus_proxy_call (manager->iio_proxy,
+                                   "ReleaseLight",
+                                   NULL,
+                                   G_DBUS_CALL_FLAGS_NONE,
+                                   -1,
+                                   NULL,
+                                   dbus_call_log_error,
+                                   "Call to iio-proxy failed");
+        }
+}
+
+static void
+led_helper_stop (GsdPowerManager *manager)
+{
+        if (manager->led_cancellable != NULL) {
+                g_cancellable_cancel (manager->led_cancellable);
+                g_clear_object (&manager->led_cancellable);
+        }
+
+        /* Closing its stdin makes the helper exit */
+        g_clear_object (&manager->led_helper_stdout);
+        g_clear_object (&manager->led_helper);
+        manager->led_helper_ready = FALSE;
+        manager->led_write_pending = FALSE;
+}
+
+static void led_helper_flush (GsdPowerManager *manager);
+
+static void
+led_helper_write_cb (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+        GsdPowerManager *manager = user_data;
+        GError *error = NULL;
+
+        if (!g_output_stream_write_all_finish (G_OUTPUT_STREAM (source_object),
+                                               res, NULL, &error)) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_warning ("Failed to send command to led-breathe: %s",
+                                   error->message);
+                        led_helper_stop (manager);
+                }
                 g_error_free (error);
+                return;
         }
 
-        if (active)
-                iio_proxy_changed (manager);
+        manager->led_write_pending = FALSE;
+        led_helper_flush (manager);
+}
+
+static void
+led_helper_flush (GsdPowerManager *manager)
+{
+        if (!manager->led_helper_ready ||
+            manager->led_write_pending ||
+            manager->led_breathe_wanted < 0)
+                return;
+
+        /* Only the latest requested state is sent, older ones are dropped */
+        g_output_stream_write_all_async (g_subprocess_get_stdin_pipe (manager->led_helper),
+                                         manager->led_breathe_wanted ? "1" : "0", 1,
+                                         G_PRIORITY_DEFAULT,
+                                         manager->led_cancellable,
+                                         led_helper_write_cb,
+                                         manager);
+        manager->led_write_pending = TRUE;
+        manager->led_breathe_wanted = -1;
+}
+
+static void
+led_helper_ready_cb (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+        GsdPowerManager *manager = user_data;
+        GError *error = NULL;
+        gchar *line;
+
+        line = g_data_input_stream_read_line_finish (G_DATA_INPUT_STREAM (source_object),
+                                                     res, NULL, &error);
+        if (error != NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_warning ("Failed to read from led-breathe: %s", error->message);
+                        led_helper_stop (manager);
+                }
+                g_error_free (error);
+                return;
+        }
+
+        if (g_strcmp0 (line, "ready") != 0) {
+                g_debug ("No breathing LED found");
+                led_helper_stop (manager);
+                g_free (line);
+                return;
+        }
+        g_free (line);
+
+        g_debug ("led-breathe helper ready");
+        manager->led_helper_ready = TRUE;
+        led_helper_flush (manager);
+}
+
+static void
+led_helper_exited_cb (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+        GsdPowerManager *manager = user_data;
+        GError *error = NULL;
+
+        if (!g_subprocess_wait_finish (G_SUBPROCESS (source_object), res, &error)) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Failed to wait for led-breathe: %s", error->message);
+                g_error_free (error);
+                return;
+        }
+
+        g_debug ("led-breathe helper exited");
+        led_helper_stop (manager);
+}
+
+/* The helper stays around so that blanking doesn't wait on a fork and
+ * exec, and so that the Super-IO setup only happens once. */
+static void
+led_helper_start (GsdPowerManager *manager)
+{
+        GError *error = NULL;
+
+        manager->led_breathe_wanted = -1;
+        manager->led_helper = g_subprocess_new (G_SUBPROCESS_FLAGS_STDIN_PIPE |
+                                                G_SUBPROCESS_FLAGS_STDOUT_PIPE,
+                                                &error,
+                                                LIBEXECDIR "/led-breathe", "--daemon",
+                                                NULL);
+        if (manager->led_helper == NULL) {
+                g_debug ("Failed to start led-breathe: %s", error->message);
+                g_error_free (error);
+                return;
+        }
+
+        manager->led_cancellable = g_cancellable_new ();
+        manager->led_helper_stdout = g_data_input_stream_new (g_subprocess_get_stdout_pipe (manager->led_helper));
+        g_data_input_stream_read_line_async (manager->led_helper_stdout,
+                                             G_PRIORITY_DEFAULT,
+                                             manager->led_cancellable,
+                                             led_helper_ready_cb,
+                                             manager);
+        g_subprocess_wait_async (manager->led_helper,
+                                 manager->led_cancellable,
+                                 led_helper_exited_cb,
+                                 manager);
+}
+
+static void
+led_breathe_set (GsdPowerManager *manager,
+                 gboolean         breathe)
+{
+        if (manager->led_helper == NULL)
+                return;
+
+        manager->led_breathe_wanted = breathe;
+        led_helper_flush (manager);
 }
 
 static void
@@ -1116,8 +1376,7 @@ backlight_enable (GsdPowerManager *manager)
                 g_error_free (error);
         }
 
-        g_spawn_command_line_sync (LIBEXECDIR "/led-breathe 0", NULL, NULL,
-                                   NULL, NULL);
+        led_breathe_set (manager, FALSE);
 
         g_debug ("TESTSUITE: Unblanked screen");
 }
@@ -1138,8 +1397,7 @@ backlight_disable (GsdPowerManager *manager)
                 g_error_free (error);
         }
 
-        g_spawn_command_line_sync (LIBEXECDIR "/led-breathe 1", NULL, NULL,
-                                   NULL, NULL);
+        led_breathe_set (manager, TRUE);
 
         g_debug ("TESTSUITE: Blanked screen");
 }
@@ -1209,67 +1467,257 @@ is_action_inhibited (GsdPowerManager *manager, GsdPowerActionType action_type)
         return is_inhibited;
 }
 
-static gboolean
-upower_kbd_set_brightness (GsdPowerManager *manager, guint value, GError **error)
+static void upower_kbd_process_queue (GsdPowerManager *manager);
+
+static void
+upower_kbd_set_brightness_cb (GObject      *source_object,
+                              GAsyncResult *res,
+                              gpointer      user_data)
 {
+        GTask *task = G_TASK (user_data);
+        GsdPowerManager *manager = g_object_ref (g_task_get_source_object (task));
+        gint value = GPOINTER_TO_INT (g_task_get_task_data (task));
         GVariant *retval;
+        GError *error = NULL;
+        GTask *finished_task;
+
+        g_assert (task == manager->kbd_active_task);
+        manager->kbd_active_task = NULL;
+
+        retval = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+        if (retval != NULL) {
+                manager->kbd_brightness_now = value;
+                g_variant_unref (retval);
+        } else if (task == g_queue_peek_tail (&manager->kbd_tasks)) {
+                /* Nothing else is pending, go back to the value in effect */
+                manager->kbd_brightness_target = manager->kbd_brightness_now;
+        }
+
+        /* Return all the pending tasks up and including the one we actually
+         * processed, the older ones were superseded by it. */
+        do {
+                finished_task = g_queue_pop_head (&manager->kbd_tasks);
+
+                if (error)
+                        g_task_return_error (finished_task, g_error_copy (error));
+                else
+                        g_task_return_int (finished_task, value);
+
+                g_object_unref (finished_task);
+        } while (finished_task != task);
+
+        g_clear_error (&error);
+
+        /* Start processing any tasks that were added in the meantime. */
+        upower_kbd_process_queue (manager);
+        g_object_unref (manager);
+}
+
+static void
+upower_kbd_process_queue (GsdPowerManager *manager)
+{
+        GTask *to_run;
+
+        /* There is already a call in flight, nothing to do. */
+        if (manager->kbd_active_task)
+                return;
+
+        /* Get the last added task, thereby compressing the updates into one. */
+        to_run = g_queue_peek_tail (&manager->kbd_tasks);
+        if (to_run == NULL)
+                return;
+
+        /* The manager was stopped, fail everything that was left. */
+        if (manager->upower_kbd_proxy == NULL) {
+                while ((to_run = g_queue_pop_head (&manager->kbd_tasks)) != NULL) {
+                        g_task_return_new_error (to_run, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                                 "The keyboard backlight is gone");
+                        g_object_unref (to_run);
+                }
+                return;
+        }
+
+        manager->kbd_active_task = to_run;
+        g_dbus_proxy_call (manager->upower_kbd_proxy,
+                           "SetBrightness",
+                           g_variant_new ("(i)", GPOINTER_TO_INT (g_task_get_task_data (to_run))),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           manager->cancellable,
+                           upower_kbd_set_brightness_cb,
+                           to_run);
+}
+
+/* Like gsd_backlight_set_brightness_async(), with the value being a level,
+ * not a percentage. The task returns the level that was set. */
+static void
+upower_kbd_set_brightness_async (GsdPowerManager     *manager,
+                                 gint                 value,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+        GTask *task;
+
+        task = g_task_new (manager, NULL, callback, user_data);
+        g_task_set_source_tag (task, upower_kbd_set_brightness_async);
 
         /* same as before */
-        if (manager->kbd_brightness_now == value)
-                return TRUE;
-        if (manager->upower_kbd_proxy == NULL)
-                return TRUE;
+        if (manager->upower_kbd_proxy == NULL ||
+            (manager->kbd_active_task == NULL && manager->kbd_brightness_target == value)) {
+                g_task_return_int (task, value);
+                g_object_unref (task);
+                return;
+        }
 
-        /* update h/w value */
-        retval = g_dbus_proxy_call_sync (manager->upower_kbd_proxy,
-                                         "SetBrightness",
-                                         g_variant_new ("(i)", (gint) value),
-                                         G_DBUS_CALL_FLAGS_NONE,
-                                         -1,
-                                         manager->cancellable,
-                                         error);
-        if (retval == NULL)
-                return FALSE;
+        manager->kbd_brightness_target = value;
+        g_task_set_task_data (task, GINT_TO_POINTER (value), NULL);
 
-        /* save new value */
-        manager->kbd_brightness_now = value;
-        g_variant_unref (retval);
-        return TRUE;
+        /* Task is set up now. Queue it and ensure we are working something. */
+        g_queue_push_tail (&manager->kbd_tasks, task);
+        upower_kbd_process_queue (manager);
 }
 
-static int
-upower_kbd_toggle (GsdPowerManager *manager,
-                   GError **error)
+static gint
+upower_kbd_set_brightness_finish (GsdPowerManager  *manager,
+                                  GAsyncResult     *res,
+                                  GError          **error)
 {
-        gboolean ret;
-        int value = -1;
+        return g_task_propagate_int (G_TASK (res), error);
+}
+
+/* user_data is the message to prefix errors with */
+static void
+upower_kbd_set_brightness_warn_cb (GObject      *object,
+                                   GAsyncResult *res,
+                                   gpointer      user_data)
+{
+        GError *error = NULL;
+
+        if (upower_kbd_set_brightness_finish (GSD_POWER_MANAGER (object), res, &error) < 0) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("%s: %s", (const gchar *) user_data, error->message);
+                g_error_free (error);
+        }
+}
+
+static void
+upower_kbd_toggle_cb (GObject      *object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+        GsdPowerManager *manager = GSD_POWER_MANAGER (object);
+        GTask *task = G_TASK (user_data);
+        GError *error = NULL;
+        gint value;
+
+        value = upower_kbd_set_brightness_finish (manager, res, &error);
+        if (value < 0) {
+                /* failed, restore the toggle state */
+                manager->kbd_brightness_old = GPOINTER_TO_INT (g_task_get_task_data (task));
+                g_task_return_error (task, error);
+        } else {
+                g_task_return_int (task, value);
+        }
+
+        g_object_unref (task);
+}
+
+static void
+upower_kbd_toggle_async (GsdPowerManager     *manager,
+                         GAsyncReadyCallback  callback,
+                         gpointer             user_data)
+{
+        GTask *task;
+        gint value;
+
+        task = g_task_new (manager, NULL, callback, user_data);
+        g_task_set_source_tag (task, upower_kbd_toggle_async);
+        g_task_set_task_data (task, GINT_TO_POINTER (manager->kbd_brightness_old), NULL);
 
         if (manager->kbd_brightness_old >= 0) {
                 g_debug ("keyboard toggle off");
-                ret = upower_kbd_set_brightness (manager,
-                                                 manager->kbd_brightness_old,
-                                                 error);
-                if (ret) {
-                        /* succeeded, set to -1 since now no old value */
-                        manager->kbd_brightness_old = -1;
-                        value = 0;
-                }
+                value = manager->kbd_brightness_old;
+                /* no old value anymore */
+                manager->kbd_brightness_old = -1;
         } else {
                 g_debug ("keyboard toggle on");
                 /* save the current value to restore later when untoggling */
-                manager->kbd_brightness_old = manager->kbd_brightness_now;
-                ret = upower_kbd_set_brightness (manager, 0, error);
-                if (!ret) {
-                        /* failed, reset back to -1 */
-                        manager->kbd_brightness_old = -1;
-                } else {
-                        value = 0;
-                }
+                manager->kbd_brightness_old = manager->kbd_brightness_target;
+                value = 0;
+        }
+
+        upower_kbd_set_brightness_async (manager, value, upower_kbd_toggle_cb, task);
+}
+
+static gint
+upower_kbd_toggle_finish (GsdPowerManager  *manager,
+                          GAsyncResult     *res,
+                          GError          **error)
+{
+        return g_task_propagate_int (G_TASK (res), error);
+}
+
+static void
+kbd_backlight_ramp_stop (GsdPowerManager *manager)
+{
+        if (manager->kbd_ramp_id != 0) {
+                g_source_remove (manager->kbd_ramp_id);
+                manager->kbd_ramp_id = 0;
         }
+}
+
+/* Returns TRUE if more steps are needed */
+static gboolean
+kbd_backlight_ramp_step (GsdPowerManager *manager)
+{
+        gint value = manager->kbd_brightness_target;
+
+        if (value < manager->kbd_ramp_target)
+                value = MIN (value + manager->kbd_ramp_step, manager->kbd_ramp_target);
+        else
+                value = MAX (value - manager->kbd_ramp_step, manager->kbd_ramp_target);
+
+        upower_kbd_set_brightness_async (manager, value,
+                                         upower_kbd_set_brightness_warn_cb,
+                                         "failed to change the kbd backlight");
+
+        return value != manager->kbd_ramp_target;
+}
+
+static gboolean
+kbd_backlight_ramp_cb (gpointer user_data)
+{
+        GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
+
+        if (kbd_backlight_ramp_step (manager))
+                return G_SOURCE_CONTINUE;
+
+        manager->kbd_ramp_id = 0;
+        return G_SOURCE_REMOVE;
+}
+
+/* Changes the level in a few steps, for the idle dim and undim. Steps that
+ * UPower cannot keep up with are coalesced by the queue. */
+static void
+kbd_backlight_ramp_to (GsdPowerManager *manager,
+                       gint             value)
+{
+        gint distance;
+
+        kbd_backlight_ramp_stop (manager);
+
+        distance = ABS (value - manager->kbd_brightness_target);
+        if (distance == 0)
+                return;
+
+        manager->kbd_ramp_target = value;
+        manager->kbd_ramp_step = MAX ((distance + KBD_RAMP_STEPS - 1) / KBD_RAMP_STEPS, 1);
 
-        if (ret)
-                return value;
-        return -1;
+        if (!kbd_backlight_ramp_step (manager))
+                return;
+
+        manager->kbd_ramp_id = g_timeout_add (KBD_RAMP_INTERVAL, kbd_backlight_ramp_cb, manager);
+        g_source_set_name_by_id (manager->kbd_ramp_id, "[GsdPowerManager] kbd ramp");
 }
 
 static gboolean
@@ -1341,52 +1789,188 @@ do_lid_open_action (GsdPowerManager *manager)
 }
 
 static void
-lock_screensaver (GsdPowerManager *manager)
+lock_screensaver_complete (GsdPowerManager *manager,
+                           const GError    *error)
 {
-        gboolean do_lock;
+        GTask *task;
 
-        do_lock = g_settings_get_boolean (manager->settings_screensaver,
-                                          "lock-enabled");
-        if (!do_lock) {
-                g_dbus_proxy_call_sync (G_DBUS_PROXY (manager->screensaver_proxy),
-                                        "SetActive",
-                                        g_variant_new ("(b)", TRUE),
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        -1, NULL, NULL);
-                return;
+        g_debug ("Screen lock finished after %" G_GINT64_FORMAT " ms: %s",
+                 (g_get_monotonic_time () - manager->lock_start_time) / 1000,
+                 error ? error->message : "confirmed");
+
+        if (manager->lock_timeout_id != 0) {
+                g_source_remove (manager->lock_timeout_id);
+                manager->lock_timeout_id = 0;
+        }
+
+        /* a late reply must not complete the next request */
+        if (manager->lock_cancellable != NULL) {
+                g_cancellable_cancel (manager->lock_cancellable);
+                g_clear_object (&manager->lock_cancellable);
         }
+        manager->lock_wait_for_active = FALSE;
 
-        g_dbus_proxy_call_sync (G_DBUS_PROXY (manager->screensaver_proxy),
-                                "Lock",
-                                NULL,
-                                G_DBUS_CALL_FLAGS_NONE,
-                                -1, NULL, NULL);
+        while ((task = g_queue_pop_head (&manager->lock_tasks)) != NULL) {
+                if (error)
+                        g_task_return_error (task, g_error_copy (error));
+                else
+                        g_task_return_boolean (task, TRUE);
+                g_object_unref (task);
+        }
 }
 
-static void
-do_lid_closed_action (GsdPowerManager *manager)
+static gboolean
+lock_screensaver_timeout_cb (gpointer user_data)
 {
-        /* play a sound, using sounds from the naming spec */
-        ca_context_play (ca_gtk_context_get (), 0,
-                         CA_PROP_EVENT_ID, "lid-close",
-                         /* TRANSLATORS: this is the sound description */
-                         CA_PROP_EVENT_DESCRIPTION, _("Lid has been closed"),
-                         NULL);
+        GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
+        GError *error;
 
-        /* refresh RANDR so we get an accurate view of what monitors are plugged in when the lid is closed */
-        gnome_rr_screen_refresh (manager->rr_screen, NULL); /* NULL-GError */
+        manager->lock_timeout_id = 0;
 
-        if (suspend_on_lid_close (manager)) {
-                gboolean is_inhibited;
+        error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                                     "Timed out waiting for the screen to lock");
+        lock_screensaver_complete (manager, error);
+        g_error_free (error);
 
-                idle_is_session_inhibited (manager,
-                                           GSM_INHIBITOR_FLAG_SUSPEND,
-                                           &is_inhibited);
-                if (is_inhibited) {
-                        g_debug ("Suspend is inhibited but lid is closed, locking the screen");
-                        /* We put the screensaver on * as we're not suspending,
-                         * but the lid is closed */
-                        lock_screensaver (manager);
+        return G_SOURCE_REMOVE;
+}
+
+static void
+lock_screensaver_call_cb (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+        GsdPowerManager *manager;
+        GVariant *result;
+        GError *error = NULL;
+
+        result = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+        if (result == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        lock_screensaver_complete (GSD_POWER_MANAGER (user_data), error);
+                g_error_free (error);
+                return;
+        }
+        g_variant_unref (result);
+
+        manager = GSD_POWER_MANAGER (user_data);
+        g_debug ("Screensaver call returned after %" G_GINT64_FORMAT " ms",
+                 (g_get_monotonic_time () - manager->lock_start_time) / 1000);
+
+        /* Lock only returns once the lock screen is up, SetActive right
+         * away, so wait for the ActiveChanged signal in that case. */
+        if (!manager->lock_wait_for_active || manager->screensaver_active)
+                lock_screensaver_complete (manager, NULL);
+}
+
+/* Locks the screen, or only activates the screensaver if locking is
+ * disabled. Completes once the shell confirmed it, or failed to within
+ * GSD_LOCK_SCREENSAVER_TIMEOUT. */
+static void
+lock_screensaver_async (GsdPowerManager     *manager,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data)
+{
+        GTask *task;
+        gboolean do_lock;
+
+        task = g_task_new (manager, NULL, callback, user_data);
+        g_task_set_source_tag (task, lock_screensaver_async);
+
+        if (manager->screensaver_proxy == NULL) {
+                g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED,
+                                         "No screensaver available");
+                g_object_unref (task);
+                return;
+        }
+
+        /* already in progress, share the result */
+        g_queue_push_tail (&manager->lock_tasks, task);
+        if (manager->lock_cancellable != NULL)
+                return;
+
+        manager->lock_start_time = g_get_monotonic_time ();
+        manager->lock_cancellable = g_cancellable_new ();
+        manager->lock_timeout_id = g_timeout_add (GSD_LOCK_SCREENSAVER_TIMEOUT,
+                                                  lock_screensaver_timeout_cb,
+                                                  manager);
+        g_source_set_name_by_id (manager->lock_timeout_id, "[GsdPowerManager] lock timeout");
+
+        do_lock = g_settings_get_boolean (manager->settings_screensaver,
+                                          "lock-enabled");
+        manager->lock_wait_for_active = !do_lock;
+        g_debug ("Requesting the screensaver to %s", do_lock ? "lock" : "activate");
+
+        g_dbus_proxy_call (G_DBUS_PROXY (manager->screensaver_proxy),
+                           do_lock ? "Lock" : "SetActive",
+                           do_lock ? NULL : g_variant_new ("(b)", TRUE),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           GSD_LOCK_SCREENSAVER_TIMEOUT,
+                           manager->lock_cancellable,
+                           lock_screensaver_call_cb,
+                           manager);
+}
+
+static gboolean
+lock_screensaver_finish (GsdPowerManager  *manager,
+                         GAsyncResult     *res,
+                         GError          **error)
+{
+        return g_task_propagate_boolean (G_TASK (res), error);
+}
+
+static void
+lock_screensaver_stop (GsdPowerManager *manager)
+{
+        GError *error;
+
+        if (g_queue_is_empty (&manager->lock_tasks))
+                return;
+
+        error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                     "Operation was cancelled");
+        lock_screensaver_complete (manager, error);
+        g_error_free (error);
+}
+
+static void
+lock_screensaver_cb (GObject      *object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+        GError *error = NULL;
+
+        if (!lock_screensaver_finish (GSD_POWER_MANAGER (object), res, &error)) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Failed to lock the screen: %s", error->message);
+                g_error_free (error);
+        }
+}
+
+static void
+do_lid_closed_action (GsdPowerManager *manager)
+{
+        /* play a sound, using sounds from the naming spec */
+        ca_context_play (ca_gtk_context_get (), 0,
+                         CA_PROP_EVENT_ID, "lid-close",
+                         /* TRANSLATORS: this is the sound description */
+                         CA_PROP_EVENT_DESCRIPTION, _("Lid has been closed"),
+                         NULL);
+
+        /* refresh RANDR so we get an accurate view of what monitors are plugged in when the lid is closed */
+        gnome_rr_screen_refresh (manager->rr_screen, NULL); /* NULL-GError */
+
+        if (suspend_on_lid_close (manager)) {
+                gboolean is_inhibited;
+
+                idle_is_session_inhibited (manager,
+                                           GSM_INHIBITOR_FLAG_SUSPEND,
+                                           &is_inhibited);
+                if (is_inhibited) {
+                        g_debug ("Suspend is inhibited but lid is closed, locking the screen");
+                        /* We put the screensaver on * as we're not suspending,
+                         * but the lid is closed */
+                        lock_screensaver_async (manager, lock_screensaver_cb, NULL);
                 }
         }
 }
@@ -1499,35 +2083,30 @@ display_backlight_dim (GsdPowerManager *manager,
         gsd_backlight_set_brightness_async (manager->backlight, idle_percentage, NULL, NULL, NULL);
 }
 
-static gboolean
+static void
 kbd_backlight_dim (GsdPowerManager *manager,
-                   gint idle_percentage,
-                   GError **error)
+                   gint idle_percentage)
 {
-        gboolean ret;
         gint idle;
         gint max;
         gint now;
 
         if (manager->upower_kbd_proxy == NULL)
-                return TRUE;
+                return;
 
-        now = manager->kbd_brightness_now;
+        now = manager->kbd_brightness_target;
         max = manager->kbd_brightness_max;
         idle = PERCENTAGE_TO_ABS (0, max, idle_percentage);
         if (idle > now) {
                 g_debug ("kbd brightness already now %i/%i, so "
                          "ignoring dim to %i/%i",
                          now, max, idle, max);
-                return TRUE;
+                return;
         }
-        ret = upower_kbd_set_brightness (manager, idle, error);
-        if (!ret)
-                return FALSE;
 
         /* save for undim */
         manager->kbd_brightness_pre_dim = now;
-        return TRUE;
+        kbd_backlight_ramp_to (manager, idle);
 }
 
 static void
@@ -1553,6 +2132,8 @@ upower_kbd_proxy_signal_cb (GDBusProxy  *proxy,
                 return;
 
         manager->kbd_brightness_now = brightness;
+        if (manager->kbd_active_task == NULL)
+                manager->kbd_brightness_target = brightness;
         if (brightness != -1) {
                 percentage = ABS_TO_PERCENTAGE (0,
                                                 manager->kbd_brightness_max,
@@ -1580,8 +2161,6 @@ is_session_active (GsdPowerManager *manager)
 static void
 idle_set_mode (GsdPowerManager *manager, GsdPowerIdleMode mode)
 {
-        gboolean ret = FALSE;
-        GError *error = NULL;
         gint idle_percentage;
         GsdPowerActionType action_type;
 
@@ -1625,13 +2204,7 @@ idle_set_mode (GsdPowerManager *manager, GsdPowerIdleMode mode)
                 display_backlight_dim (manager, idle_percentage);
 
                 /* keyboard backlight */
-                ret = kbd_backlight_dim (manager, idle_percentage, &error);
-                if (!ret) {
-                        g_warning ("failed to set dim kbd backlight to %i%%: %s",
-                                   idle_percentage,
-                                   error->message);
-                        g_clear_error (&error);
-                }
+                kbd_backlight_dim (manager, idle_percentage);
 
         /* turn off screen and kbd */
         } else if (mode == GSD_POWER_IDLE_MODE_BLANK) {
@@ -1641,11 +2214,10 @@ idle_set_mode (GsdPowerManager *manager, GsdPowerIdleMode mode)
                 /* only toggle keyboard if present and not already toggled */
                 if (manager->upower_kbd_proxy &&
                     manager->kbd_brightness_old == -1) {
-                        if (upower_kbd_toggle (manager, &error) < 0) {
-                                g_warning ("failed to turn the kbd backlight off: %s",
-                                           error->message);
-                                g_error_free (error);
-                        }
+                        kbd_backlight_ramp_stop (manager);
+                        upower_kbd_toggle_async (manager,
+                                                 upower_kbd_set_brightness_warn_cb,
+                                                 "failed to turn the kbd backlight off");
                 }
 
         /* sleep */
@@ -1677,24 +2249,15 @@ idle_set_mode (GsdPowerManager *manager, GsdPowerIdleMode mode)
                 /* only toggle keyboard if present and already toggled off */
                 if (manager->upower_kbd_proxy &&
                     manager->kbd_brightness_old != -1) {
-                        if (upower_kbd_toggle (manager, &error) < 0) {
-                                g_warning ("failed to turn the kbd backlight on: %s",
-                                           error->message);
-                                g_clear_error (&error);
-                        }
+                        kbd_backlight_ramp_stop (manager);
+                        upower_kbd_toggle_async (manager,
+                                                 upower_kbd_set_brightness_warn_cb,
+                                                 "failed to turn the kbd backlight on");
                 }
 
                 /* reset kbd brightness if we dimmed */
                 if (manager->kbd_brightness_pre_dim >= 0) {
-                        ret = upower_kbd_set_brightness (manager,
-                                                         manager->kbd_brightness_pre_dim,
-                                                         &error);
-                        if (!ret) {
-                                g_warning ("failed to restore kbd backlight to %i: %s",
-                                           manager->kbd_brightness_pre_dim,
-                                           error->message);
-                                g_error_free (error);
-                        }
+                        kbd_backlight_ramp_to (manager, manager->kbd_brightness_pre_dim);
                         manager->kbd_brightness_pre_dim = -1;
                 }
 
@@ -1982,16 +2545,45 @@ gsd_power_manager_finalize (GObject *object)
                 g_bus_unwatch_name (manager->iio_proxy_watch_id);
         manager->iio_proxy_watch_id = 0;
 
+        g_clear_pointer (&manager->ambient, gsd_ambient_light_free);
+
         G_OBJECT_CLASS (gsd_power_manager_parent_class)->finalize (object);
 }
 
+static void
+gsd_power_manager_get_property (GObject    *object,
+                                guint       prop_id,
+                                GValue     *value,
+                                GParamSpec *pspec)
+{
+        GsdPowerManager *manager = GSD_POWER_MANAGER (object);
+
+        switch (prop_id) {
+        case PROP_READY:
+                g_value_set_boolean (value, manager->ready);
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+                break;
+        }
+}
+
 static void
 gsd_power_manager_class_init (GsdPowerManagerClass *klass)
 {
         GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+        object_class->get_property = gsd_power_manager_get_property;
         object_class->finalize = gsd_power_manager_finalize;
 
+        g_object_class_install_property (object_class,
+                                         PROP_READY,
+                                         g_param_spec_boolean ("ready",
+                                                               NULL,
+                                                               NULL,
+                                                               FALSE,
+                                                               G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
         notify_init ("gnome-settings-daemon");
 }
 
@@ -2007,6 +2599,9 @@ handle_screensaver_active (GsdPowerManager *manager,
                 manager->screensaver_active = active;
                 idle_configure (manager);
 
+                if (active && manager->lock_wait_for_active)
+                        lock_screensaver_complete (manager, NULL);
+
                 /* Setup blank as soon as the screensaver comes on,
                  * and its fade has finished.
                  *
@@ -2036,77 +2631,43 @@ screensaver_signal_cb (GDBusProxy *proxy,
 }
 
 static void
-power_keyboard_proxy_ready_cb (GObject             *source_object,
-                               GAsyncResult        *res,
-                               gpointer             user_data)
+power_keyboard_max_brightness_cb (GObject      *source_object,
+                                  GAsyncResult *res,
+                                  gpointer      user_data)
 {
-        GVariant *k_now = NULL;
-        GVariant *k_max = NULL;
+        GDBusProxy *proxy = G_DBUS_PROXY (source_object);
+        GVariant *k_max;
         GError *error = NULL;
-        GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
+        GsdPowerManager *manager;
         gint percentage;
 
-        manager->upower_kbd_proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
-        if (manager->upower_kbd_proxy == NULL) {
-                g_warning ("Could not connect to UPower: %s",
-                           error->message);
+        k_max = g_dbus_proxy_call_finish (proxy, res, &error);
+        if (k_max == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Failed to get max brightness: %s", error->message);
                 g_error_free (error);
-                goto out;
+                g_object_unref (proxy);
+                return;
         }
 
+        manager = GSD_POWER_MANAGER (user_data);
+        g_variant_get (k_max, "(i)", &manager->kbd_brightness_max);
+        g_variant_unref (k_max);
+
+        /* Only now that the levels are known is the keyboard usable */
+        manager->upower_kbd_proxy = proxy;
+        manager->kbd_brightness_target = manager->kbd_brightness_now;
         g_signal_connect (manager->upower_kbd_proxy, "g-signal",
                           G_CALLBACK (upower_kbd_proxy_signal_cb),
                           manager);
 
-        k_now = g_dbus_proxy_call_sync (manager->upower_kbd_proxy,
-                                        "GetBrightness",
-                                        NULL,
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        -1,
-                                        manager->cancellable,
-                                        &error);
-        if (k_now == NULL) {
-                if (error->domain != G_DBUS_ERROR ||
-                    error->code != G_DBUS_ERROR_UNKNOWN_METHOD) {
-                        g_warning ("Failed to get brightness: %s",
-                                   error->message);
-                } else {
-                        /* Keyboard brightness is not available */
-                        g_clear_object (&manager->upower_kbd_proxy);
-                }
-                g_error_free (error);
-                goto out;
-        }
-
-        k_max = g_dbus_proxy_call_sync (manager->upower_kbd_proxy,
-                                        "GetMaxBrightness",
-                                        NULL,
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        -1,
-                                        manager->cancellable,
-                                        &error);
-        if (k_max == NULL) {
-                g_warning ("Failed to get max brightness: %s", error->message);
-                g_error_free (error);
-                goto out;
-        }
-
-        g_variant_get (k_now, "(i)", &manager->kbd_brightness_now);
-        g_variant_get (k_max, "(i)", &manager->kbd_brightness_max);
-
         /* set brightness to max if not currently set so is something
          * sensible */
         if (manager->kbd_brightness_now < 0) {
-                gboolean ret;
-                ret = upower_kbd_set_brightness (manager,
+                upower_kbd_set_brightness_async (manager,
                                                  manager->kbd_brightness_max,
-                                                 &error);
-                if (!ret) {
-                        g_warning ("failed to initialize kbd backlight to %i: %s",
-                                   manager->kbd_brightness_max,
-                                   error->message);
-                        g_error_free (error);
-                }
+                                                 upower_kbd_set_brightness_warn_cb,
+                                                 "failed to initialize kbd backlight");
         }
 
         /* Tell the front-end that the brightness changed from
@@ -2115,12 +2676,73 @@ power_keyboard_proxy_ready_cb (GObject             *source_object,
                                         manager->kbd_brightness_max,
                                         manager->kbd_brightness_now);
         backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_KEYBOARD, percentage, "initial value");
+}
+
+static void
+power_keyboard_brightness_cb (GObject      *source_object,
+                              GAsyncResult *res,
+                              gpointer      user_data)
+{
+        GDBusProxy *proxy = G_DBUS_PROXY (source_object);
+        GVariant *k_now;
+        GError *error = NULL;
+        GsdPowerManager *manager;
+
+        k_now = g_dbus_proxy_call_finish (proxy, res, &error);
+        if (k_now == NULL) {
+                if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+                        /* Keyboard brightness is not available */
+                } else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_warning ("Failed to get brightness: %s",
+                                   error->message);
+                }
+                g_error_free (error);
+                g_object_unref (proxy);
+                return;
+        }
+
+        manager = GSD_POWER_MANAGER (user_data);
+        g_variant_get (k_now, "(i)", &manager->kbd_brightness_now);
+        g_variant_unref (k_now);
+
+        /* The proxy reference is passed on */
+        g_dbus_proxy_call (proxy,
+                           "GetMaxBrightness",
+                           NULL,
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           manager->cancellable,
+                           power_keyboard_max_brightness_cb,
+                           manager);
+}
+
+static void
+power_keyboard_proxy_ready_cb (GObject             *source_object,
+                               GAsyncResult        *res,
+                               gpointer             user_data)
+{
+        GDBusProxy *proxy;
+        GError *error = NULL;
+        GsdPowerManager *manager;
 
-out:
-        if (k_now != NULL)
-                g_variant_unref (k_now);
-        if (k_max != NULL)
-                g_variant_unref (k_max);
+        proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+        if (proxy == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Could not connect to UPower: %s",
+                                   error->message);
+                g_error_free (error);
+                return;
+        }
+
+        manager = GSD_POWER_MANAGER (user_data);
+        g_dbus_proxy_call (proxy,
+                           "GetBrightness",
+                           NULL,
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           manager->cancellable,
+                           power_keyboard_brightness_cb,
+                           manager);
 }
 
 static void
@@ -2222,19 +2844,6 @@ idle_became_active_cb (GnomeIdleMonitor *monitor,
         manager->user_active_id = 0;
 }
 
-static void
-ch_backlight_renormalize (GsdPowerManager *manager)
-{
-        if (manager->ambient_percentage_old < 0)
-                return;
-        if (manager->ambient_last_absolute < 0)
-                return;
-        manager->ambient_norm_value = manager->ambient_last_absolute /
-                                        (gdouble) manager->ambient_percentage_old;
-        manager->ambient_norm_value *= 100.f;
-        manager->ambient_norm_required = FALSE;
-}
-
 static void
 engine_settings_key_changed_cb (GSettings *settings,
                                 const gchar *key,
@@ -2246,6 +2855,10 @@ engine_settings_key_changed_cb (GSettings *settings,
                 idle_configure (manager);
                 return;
         }
+        if (g_str_equal (key, "ambient-enabled")) {
+                manager->ambient_enabled = g_settings_get_boolean (settings, key);
+                return;
+        }
 }
 
 static void
@@ -2448,16 +3061,47 @@ on_randr_event (GnomeRRScreen *screen, gpointer user_data)
 }
 
 static void
-handle_suspend_actions (GsdPowerManager *manager)
+suspend_lock_screensaver_cb (GObject      *object,
+                             GAsyncResult *res,
+                             gpointer      user_data)
 {
-	/* Lock screen instead of only disabling backlight */
-	lock_screensaver (manager);
+        GsdPowerManager *manager = GSD_POWER_MANAGER (object);
+        GError *error = NULL;
+
+        if (!lock_screensaver_finish (manager, res, &error)) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_error_free (error);
+                        return;
+                }
+                g_warning ("Failed to lock the screen before suspending: %s", error->message);
+                g_error_free (error);
+        }
+
+        /* resumed in the meantime, keep the inhibitor */
+        if (!manager->about_to_suspend)
+                return;
+
+        g_debug ("Releasing the suspend delay inhibitor %" G_GINT64_FORMAT " ms after PrepareForSleep",
+                 (g_get_monotonic_time () - manager->about_to_suspend_time) / 1000);
         uninhibit_suspend (manager);
 }
 
+static void
+handle_suspend_actions (GsdPowerManager *manager)
+{
+        manager->about_to_suspend = TRUE;
+        manager->about_to_suspend_time = g_get_monotonic_time ();
+
+        /* Lock screen instead of only disabling backlight, and only let
+         * the suspend go ahead once it is locked */
+        lock_screensaver_async (manager, suspend_lock_screensaver_cb, NULL);
+}
+
 static void
 handle_resume_actions (GsdPowerManager *manager)
 {
+        manager->about_to_suspend = FALSE;
+
         /* ensure we turn the panel back on after resume */
         backlight_enable (manager);
 
@@ -2486,25 +3130,10 @@ logind_proxy_signal_cb (GDBusProxy  *proxy,
 }
 
 static void
-on_rr_screen_acquired (GObject      *object,
-                       GAsyncResult *result,
-                       gpointer      user_data)
+power_manager_setup (GsdPowerManager *manager)
 {
-        GsdPowerManager *manager = user_data;
-        GError *error = NULL;
-
         gnome_settings_profile_start (NULL);
 
-        manager->rr_screen = gnome_rr_screen_new_finish (result, &error);
-
-        if (error) {
-                g_warning ("Could not create GnomeRRScreen: %s\n", error->message);
-                g_error_free (error);
-                gnome_settings_profile_end (NULL);
-
-                return;
-        }
-
         /* Resolve screen backlight */
         manager->backlight = gsd_backlight_new (manager->rr_screen, NULL);
 
@@ -2521,10 +3150,10 @@ on_rr_screen_acquired (GObject      *object,
         inhibit_suspend (manager);
 
         /* track the active session */
-        manager->session = gnome_settings_bus_get_session_proxy ();
-        g_signal_connect_object (manager->session, "g-properties-changed",
-                                 G_CALLBACK (engine_session_properties_changed_cb),
-                                 manager, 0);
+        if (manager->session != NULL)
+                g_signal_connect_object (manager->session, "g-properties-changed",
+                                         G_CALLBACK (engine_session_properties_changed_cb),
+                                         manager, 0);
         manager->session_is_active = is_session_active (manager);
 
         /* set up the screens */
@@ -2534,10 +3163,9 @@ on_rr_screen_acquired (GObject      *object,
                 on_randr_event (manager->rr_screen, manager);
         }
 
-        manager->screensaver_proxy = gnome_settings_bus_get_screen_saver_proxy ();
-
-        g_signal_connect (manager->screensaver_proxy, "g-signal",
-                          G_CALLBACK (screensaver_signal_cb), manager);
+        if (manager->screensaver_proxy != NULL)
+                g_signal_connect (manager->screensaver_proxy, "g-signal",
+                                  G_CALLBACK (screensaver_signal_cb), manager);
 
         manager->kbd_brightness_old = -1;
         manager->kbd_brightness_pre_dim = -1;
@@ -2557,17 +3185,19 @@ on_rr_screen_acquired (GObject      *object,
 
         /* connect to UPower for keyboard backlight control */
         manager->kbd_brightness_now = -1;
+        manager->kbd_brightness_target = -1;
         g_dbus_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
                                   G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
                                   NULL,
                                   UPOWER_DBUS_NAME,
                                   UPOWER_DBUS_PATH_KBDBACKLIGHT,
                                   UPOWER_DBUS_INTERFACE_KBDBACKLIGHT,
-                                  NULL,
+                                  manager->cancellable,
                                   power_keyboard_proxy_ready_cb,
                                   manager);
 
-        manager->devices_array = g_ptr_array_new_with_free_func (g_object_unref);
+        manager->devices = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+        manager->devices_warning_changed = g_ptr_array_new_with_free_func (g_object_unref);
 
         /* create a fake virtual composite battery */
         manager->device_composite = up_client_get_display_device (manager->up_client);
@@ -2594,83 +3224,191 @@ on_rr_screen_acquired (GObject      *object,
            (likely, considering that to get here we need a reply from gnome-shell)
         */
         if (manager->backlight) {
-                manager->ambient_percentage_old = gsd_backlight_get_brightness (manager->backlight, NULL);
+                gint brightness;
+
+                brightness = gsd_backlight_get_brightness (manager->backlight, NULL);
+                gsd_ambient_light_set_brightness (manager->ambient, brightness);
+                gsd_ambient_light_set_resolution (manager->ambient,
+                                                  gsd_backlight_get_resolution (manager->backlight));
                 backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_SCREEN,
-                                              manager->ambient_percentage_old, NULL);
+                                              brightness, NULL);
         } else {
                 backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_SCREEN, -1, NULL);
         }
 
+        manager->ready = TRUE;
+        g_object_notify (G_OBJECT (manager), "ready");
+
         gnome_settings_profile_end (NULL);
 }
 
+/* logind, the screens, the session and the screensaver are fetched
+ * concurrently */
 static void
-iio_proxy_changed (GsdPowerManager *manager)
+power_manager_startup_step_done (GsdPowerManager *manager)
+{
+        g_assert (manager->startup_pending > 0);
+        if (--manager->startup_pending > 0)
+                return;
+
+        power_manager_setup (manager);
+}
+
+static void
+on_startup_proxies_ready (GObject      *object,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+        GsdPowerManager *manager;
+        g_autoptr(GError) error = NULL;
+
+        if (!gsd_startup_new_proxies_finish (result, &error)) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        return;
+
+                /* never becoming ready, the service is not started */
+                g_warning ("No systemd (logind) support, disabling plugin: %s",
+                           error->message);
+                return;
+        }
+
+        manager = GSD_POWER_MANAGER (user_data);
+        power_manager_startup_step_done (manager);
+}
+
+static void
+on_rr_screen_acquired (GObject      *object,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+        GsdPowerManager *manager = user_data;
+        GError *error = NULL;
+
+        manager->rr_screen = gnome_rr_screen_new_finish (result, &error);
+
+        if (error) {
+                g_warning ("Could not create GnomeRRScreen: %s\n", error->message);
+                g_error_free (error);
+                return;
+        }
+
+        power_manager_startup_step_done (manager);
+}
+
+static void
+on_session_proxy_acquired (GObject      *object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+        GsdPowerManager *manager = user_data;
+        GsdSessionManager *session;
+        g_autoptr(GError) error = NULL;
+
+        session = gnome_settings_bus_get_session_proxy_finish (result, &error);
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                return;
+
+        /* a missing session manager was already warned about */
+        manager->session = session;
+        power_manager_startup_step_done (manager);
+}
+
+static void
+on_screen_saver_proxy_acquired (GObject      *object,
+                                GAsyncResult *result,
+                                gpointer      user_data)
+{
+        GsdPowerManager *manager = user_data;
+        GsdScreenSaver *screensaver;
+        g_autoptr(GError) error = NULL;
+
+        screensaver = gnome_settings_bus_get_screen_saver_proxy_finish (result, &error);
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                return;
+
+        manager->screensaver_proxy = screensaver;
+        power_manager_startup_step_done (manager);
+}
+
+static void ambient_light_update (GsdPowerManager *manager);
+
+static gboolean
+ambient_light_update_cb (gpointer user_data)
+{
+        GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
+
+        manager->ambient_update_id = 0;
+        ambient_light_update (manager);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+ambient_light_update (GsdPowerManager *manager)
 {
-        GVariant *val_has = NULL;
-        GVariant *val_als = NULL;
-        gdouble brightness;
-        gdouble alpha;
         gint64 current_time;
+        gint64 retry_time;
         gint pc;
 
+        if (!manager->backlight || !manager->ambient_enabled)
+                return;
+
+        current_time = g_get_monotonic_time ();
+        pc = gsd_ambient_light_get_update (manager->ambient, current_time, &retry_time);
+
+        /* held back by the rate limit, try again once it allows it */
+        if (pc < 0) {
+                if (retry_time > 0 && manager->ambient_update_id == 0) {
+                        manager->ambient_update_id =
+                                g_timeout_add ((retry_time - current_time) / 1000 + 1,
+                                               ambient_light_update_cb, manager);
+                        g_source_set_name_by_id (manager->ambient_update_id,
+                                                 "[GsdPowerManager] ambient update");
+                }
+                return;
+        }
+
+        if (manager->ambient_update_id != 0) {
+                g_source_remove (manager->ambient_update_id);
+                manager->ambient_update_id = 0;
+        }
+
+        /* set new value */
+        g_debug ("Setting brightness from ambient %d%%", pc);
+        gsd_backlight_set_brightness_async (manager->backlight, pc, NULL, NULL, NULL);
+}
+
+static void
+ambient_light_add_reading (GsdPowerManager *manager,
+                           gdouble          level)
+{
         /* no display hardware */
         if (!manager->backlight)
                 return;
 
         /* disabled */
-        if (!g_settings_get_boolean (manager->settings, "ambient-enabled"))
+        if (!manager->ambient_enabled || !manager->ambient_available)
                 return;
 
+        /* latest result, which does not have to be Lux */
+        g_debug ("Read last absolute light level: %f", level);
+        gsd_ambient_light_add_reading (manager->ambient, level, g_get_monotonic_time ());
+        ambient_light_update (manager);
+}
+
+static void
+iio_proxy_changed (GsdPowerManager *manager)
+{
+        GVariant *val_has = NULL;
+        GVariant *val_als = NULL;
+
         /* get latest results, which do not have to be Lux */
         val_has = g_dbus_proxy_get_cached_property (manager->iio_proxy, "HasAmbientLight");
-        if (val_has == NULL || !g_variant_get_boolean (val_has))
-                goto out;
+        manager->ambient_available = val_has != NULL && g_variant_get_boolean (val_has);
         val_als = g_dbus_proxy_get_cached_property (manager->iio_proxy, "LightLevel");
-        if (val_als == NULL || g_variant_get_double (val_als) == 0.0)
-                goto out;
-        manager->ambient_last_absolute = g_variant_get_double (val_als);
-        g_debug ("Read last absolute light level: %f", manager->ambient_last_absolute);
-
-        /* the user has asked to renormalize */
-        if (manager->ambient_norm_required) {
-                g_debug ("Renormalizing light level from old light percentage: %.1f%%",
-                         manager->ambient_percentage_old);
-                manager->ambient_accumulator = manager->ambient_percentage_old;
-                ch_backlight_renormalize (manager);
-        }
-
-        /* time-weighted constant for moving average */
-        current_time = g_get_monotonic_time();
-        if (manager->ambient_last_time)
-                alpha = 1.0f / (1.0f + (GSD_AMBIENT_TIME_CONSTANT / (current_time - manager->ambient_last_time)));
-        else
-                alpha = 0.0f;
-        manager->ambient_last_time = current_time;
-
-        /* calculate exponential weighted moving average */
-        brightness = manager->ambient_last_absolute * 100.f / manager->ambient_norm_value;
-        brightness = MIN (brightness, 100.f);
-        brightness = MAX (brightness, 0.f);
-
-        manager->ambient_accumulator = (alpha * brightness) +
-                (1.0 - alpha) * manager->ambient_accumulator;
-
-        /* no valid readings yet */
-        if (manager->ambient_accumulator < 0.f)
-                goto out;
+        if (val_als != NULL)
+                ambient_light_add_reading (manager, g_variant_get_double (val_als));
 
-        /* set new value */
-        g_debug ("Setting brightness from ambient %.1f%%",
-                 manager->ambient_accumulator);
-        pc = manager->ambient_accumulator;
-
-        if (manager->backlight)
-                gsd_backlight_set_brightness_async (manager->backlight, pc, NULL, NULL, NULL);
-
-        /* Assume setting worked. */
-        manager->ambient_percentage_old = pc;
-out:
         g_clear_pointer (&val_has, g_variant_unref);
         g_clear_pointer (&val_als, g_variant_unref);
 }
@@ -2681,7 +3419,45 @@ iio_proxy_changed_cb (GDBusProxy *proxy,
                       GStrv       invalidated_properties,
                       gpointer    user_data)
 {
-        iio_proxy_changed ((GsdPowerManager *) user_data);
+        GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
+        gdouble level;
+
+        /* Only look at what changed, the proxy also reports the other
+         * sensors of iio-sensor-proxy */
+        g_variant_lookup (changed_properties, "HasAmbientLight", "b", &manager->ambient_available);
+        if (g_variant_lookup (changed_properties, "LightLevel", "d", &level))
+                ambient_light_add_reading (manager, level);
+}
+
+static void
+iio_proxy_ready_cb (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+        GsdPowerManager *manager;
+        GDBusProxy *proxy;
+        g_autoptr(GError) error = NULL;
+
+        proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+        if (proxy == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Could not connect to iio-sensor-proxy: %s", error->message);
+                return;
+        }
+
+        manager = GSD_POWER_MANAGER (user_data);
+        g_clear_object (&manager->iio_proxy_cancellable);
+        manager->iio_proxy = proxy;
+        iio_proxy_claim_light (manager, TRUE);
+}
+
+static void
+iio_proxy_cancel (GsdPowerManager *manager)
+{
+        if (manager->iio_proxy_cancellable != NULL) {
+                g_cancellable_cancel (manager->iio_proxy_cancellable);
+                g_clear_object (&manager->iio_proxy_cancellable);
+        }
 }
 
 static void
@@ -2691,16 +3467,20 @@ iio_proxy_appeared_cb (GDBusConnection *connection,
                        gpointer user_data)
 {
         GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
-        manager->iio_proxy =
-                g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-                                               0,
-                                               NULL,
-                                               "net.hadess.SensorProxy",
-                                               "/net/hadess/SensorProxy",
-                                               "net.hadess.SensorProxy",
-                                               NULL,
-                                               NULL);
-        iio_proxy_claim_light (manager, TRUE);
+
+        iio_proxy_cancel (manager);
+        g_clear_object (&manager->iio_proxy);
+
+        manager->iio_proxy_cancellable = g_cancellable_new ();
+        g_dbus_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
+                                  0,
+                                  NULL,
+                                  "net.hadess.SensorProxy",
+                                  "/net/hadess/SensorProxy",
+                                  "net.hadess.SensorProxy",
+                                  manager->iio_proxy_cancellable,
+                                  iio_proxy_ready_cb,
+                                  manager);
 }
 
 static void
@@ -2709,6 +3489,8 @@ iio_proxy_vanished_cb (GDBusConnection *connection,
                        gpointer user_data)
 {
         GsdPowerManager *manager = GSD_POWER_MANAGER (user_data);
+
+        iio_proxy_cancel (manager);
         g_clear_object (&manager->iio_proxy);
 }
 
@@ -2716,33 +3498,40 @@ gboolean
 gsd_power_manager_start (GsdPowerManager *manager,
                          GError **error)
 {
+        const GsdStartupProxy proxies[] = {
+                { G_BUS_TYPE_SYSTEM, G_DBUS_PROXY_FLAGS_NONE,
+                  SYSTEMD_DBUS_NAME, SYSTEMD_DBUS_PATH, SYSTEMD_DBUS_INTERFACE,
+                  &manager->logind_proxy, TRUE },
+        };
+
         g_debug ("Starting power manager");
         gnome_settings_profile_start (NULL);
 
+        manager->ready = FALSE;
+
         /* Check whether we have a lid first */
         manager->up_client = up_client_new ();
         manager->lid_is_present = up_client_get_lid_is_present (manager->up_client);
         if (manager->lid_is_present)
                 manager->lid_is_closed = up_client_get_lid_is_closed (manager->up_client);
 
-        /* Set up the logind proxy */
-        manager->logind_proxy =
-                g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-                                               0,
-                                               NULL,
-                                               SYSTEMD_DBUS_NAME,
-                                               SYSTEMD_DBUS_PATH,
-                                               SYSTEMD_DBUS_INTERFACE,
-                                               NULL,
-                                               error);
-        if (manager->logind_proxy == NULL) {
-                g_debug ("No systemd (logind) support, disabling plugin");
-                return FALSE;
-        }
+        /* Set up the logind proxy, without it we are never ready */
+        manager->startup_pending = 4;
+        gsd_startup_new_proxies ("power",
+                                 proxies, G_N_ELEMENTS (proxies),
+                                 manager->cancellable,
+                                 on_startup_proxies_ready,
+                                 manager);
 
-        /* coldplug the list of screens */
+        /* coldplug the list of screens, while connecting to the session */
         gnome_rr_screen_new_async (gdk_screen_get_default (),
                                    on_rr_screen_acquired, manager);
+        gnome_settings_bus_get_session_proxy_async (manager->cancellable,
+                                                    on_session_proxy_acquired,
+                                                    manager);
+        gnome_settings_bus_get_screen_saver_proxy_async (manager->cancellable,
+                                                         on_screen_saver_proxy_acquired,
+                                                         manager);
 
         manager->settings = g_settings_new (GSD_POWER_SETTINGS_SCHEMA);
         manager->settings_screensaver = g_settings_new ("org.gnome.desktop.screensaver");
@@ -2756,12 +3545,11 @@ gsd_power_manager_start (GsdPowerManager *manager,
                                   iio_proxy_appeared_cb,
                                   iio_proxy_vanished_cb,
                                   manager, NULL);
-        manager->ambient_norm_required = TRUE;
-        manager->ambient_accumulator = -1.f;
-        manager->ambient_norm_value = -1.f;
-        manager->ambient_percentage_old = -1.f;
-        manager->ambient_last_absolute = -1.f;
-        manager->ambient_last_time = 0;
+        g_clear_pointer (&manager->ambient, gsd_ambient_light_free);
+        manager->ambient = gsd_ambient_light_new ();
+        manager->ambient_enabled = g_settings_get_boolean (manager->settings, "ambient-enabled");
+
+        led_helper_start (manager);
 
         gnome_settings_profile_end (NULL);
         return TRUE;
@@ -2793,9 +3581,15 @@ gsd_power_manager_stop (GsdPowerManager *manager)
         g_clear_object (&manager->settings_bus);
         g_clear_object (&manager->up_client);
 
+        iio_proxy_cancel (manager);
         iio_proxy_claim_light (manager, FALSE);
         g_clear_object (&manager->iio_proxy);
 
+        if (manager->ambient_update_id != 0) {
+                g_source_remove (manager->ambient_update_id);
+                manager->ambient_update_id = 0;
+        }
+
         if (manager->inhibit_lid_switch_fd != -1) {
                 close (manager->inhibit_lid_switch_fd);
                 manager->inhibit_lid_switch_fd = -1;
@@ -2810,14 +3604,29 @@ gsd_power_manager_stop (GsdPowerManager *manager)
         g_clear_object (&manager->logind_proxy);
         g_clear_object (&manager->rr_screen);
 
-        g_clear_pointer (&manager->devices_array, g_ptr_array_unref);
+        if (manager->devices_warning_id != 0) {
+                g_source_remove (manager->devices_warning_id);
+                manager->devices_warning_id = 0;
+        }
+        g_clear_pointer (&manager->devices_warning_changed, g_ptr_array_unref);
+        if (manager->devices != NULL)
+                g_hash_table_foreach (manager->devices, engine_device_disconnect, manager);
+        g_clear_pointer (&manager->devices, g_hash_table_unref);
+        if (manager->device_composite != NULL)
+                engine_device_disconnect (NULL, manager->device_composite, manager);
         g_clear_object (&manager->device_composite);
 
+        lock_screensaver_stop (manager);
         g_clear_object (&manager->screensaver_proxy);
 
         play_loop_stop (&manager->critical_alert_timeout_id);
 
+        led_helper_stop (manager);
+
         g_clear_object (&manager->idle_monitor);
+
+        /* the pending keyboard changes fail once the proxy is gone */
+        kbd_backlight_ramp_stop (manager);
         g_clear_object (&manager->upower_kbd_proxy);
 
         if (manager->xscreensaver_watchdog_timer_id > 0) {
@@ -2831,10 +3640,46 @@ gsd_power_manager_init (GsdPowerManager *manager)
 {
         manager->inhibit_lid_switch_fd = -1;
         manager->inhibit_suspend_fd = -1;
+        manager->led_breathe_wanted = -1;
         manager->cancellable = g_cancellable_new ();
+        g_queue_init (&manager->kbd_tasks);
+        g_queue_init (&manager->lock_tasks);
+        manager->ambient = gsd_ambient_light_new ();
+}
+
+static void
+upower_kbd_method_call_cb (GObject      *object,
+                           GAsyncResult *res,
+                           gpointer      user_data)
+{
+        GsdPowerManager *manager = GSD_POWER_MANAGER (object);
+        GDBusMethodInvocation *invocation = G_DBUS_METHOD_INVOCATION (user_data);
+        const gchar *method_name = g_dbus_method_invocation_get_method_name (invocation);
+        GError *error = NULL;
+        guint percentage;
+        gint value;
+
+        if (g_strcmp0 (method_name, "Toggle") == 0)
+                value = upower_kbd_toggle_finish (manager, res, &error);
+        else
+                value = upower_kbd_set_brightness_finish (manager, res, &error);
+
+        /* return value */
+        if (value < 0) {
+                backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_KEYBOARD, -1, method_name);
+                g_dbus_method_invocation_take_error (invocation,
+                                                     error);
+        } else {
+                percentage = ABS_TO_PERCENTAGE (0,
+                                                manager->kbd_brightness_max,
+                                                value);
+                backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_KEYBOARD, percentage, method_name);
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(i)",
+                                                                      percentage));
+        }
 }
 
-/* returns new level */
 static void
 handle_method_call_keyboard (GsdPowerManager *manager,
                              const gchar *method_name,
@@ -2842,46 +3687,32 @@ handle_method_call_keyboard (GsdPowerManager *manager,
                              GDBusMethodInvocation *invocation)
 {
         gint step;
-        gint value = -1;
-        gboolean ret;
-        guint percentage;
-        GError *error = NULL;
+        gint value;
+
+        /* the user takes over from any idle dim or undim */
+        kbd_backlight_ramp_stop (manager);
 
         if (g_strcmp0 (method_name, "StepUp") == 0) {
                 g_debug ("keyboard step up");
                 step = BRIGHTNESS_STEP_AMOUNT (manager->kbd_brightness_max);
-                value = MIN (manager->kbd_brightness_now + step,
+                value = MIN (manager->kbd_brightness_target + step,
                              manager->kbd_brightness_max);
-                ret = upower_kbd_set_brightness (manager, value, &error);
+                upower_kbd_set_brightness_async (manager, value,
+                                                 upower_kbd_method_call_cb, invocation);
 
         } else if (g_strcmp0 (method_name, "StepDown") == 0) {
                 g_debug ("keyboard step down");
                 step = BRIGHTNESS_STEP_AMOUNT (manager->kbd_brightness_max);
-                value = MAX (manager->kbd_brightness_now - step, 0);
-                ret = upower_kbd_set_brightness (manager, value, &error);
+                value = MAX (manager->kbd_brightness_target - step, 0);
+                upower_kbd_set_brightness_async (manager, value,
+                                                 upower_kbd_method_call_cb, invocation);
 
         } else if (g_strcmp0 (method_name, "Toggle") == 0) {
-                value = upower_kbd_toggle (manager, &error);
-                ret = (value >= 0);
+                upower_kbd_toggle_async (manager, upower_kbd_method_call_cb, invocation);
 
         } else {
                 g_assert_not_reached ();
         }
-
-        /* return value */
-        if (!ret) {
-                g_dbus_method_invocation_take_error (invocation,
-                                                     error);
-                backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_KEYBOARD, -1, method_name);
-        } else {
-                percentage = ABS_TO_PERCENTAGE (0,
-                                                manager->kbd_brightness_max,
-                                                value);
-                g_dbus_method_invocation_return_value (invocation,
-                                                       g_variant_new ("(i)",
-                                                                      percentage));
-                backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_KEYBOARD, percentage, method_name);
-        }
 }
 
 static void
@@ -2900,8 +3731,7 @@ backlight_brightness_step_cb (GObject *object,
         brightness = gsd_backlight_set_brightness_finish (backlight, res, &error);
 
         /* ambient brightness no longer valid */
-        manager->ambient_percentage_old = brightness;
-        manager->ambient_norm_required = TRUE;
+        gsd_ambient_light_set_brightness (manager->ambient, brightness);
 
         if (error) {
                 g_dbus_method_invocation_take_error (invocation,
@@ -2929,10 +3759,8 @@ backlight_brightness_set_cb (GObject *object,
         /* Return the invocation. */
         brightness = gsd_backlight_set_brightness_finish (backlight, res, NULL);
 
-        if (brightness >= 0) {
-                manager->ambient_percentage_old = brightness;
-                manager->ambient_norm_required = TRUE;
-        }
+        if (brightness >= 0)
+                gsd_ambient_light_set_brightness (manager->ambient, brightness);
 
         g_object_unref (manager);
 }
@@ -3071,6 +3899,29 @@ handle_get_property (GDBusConnection *connection,
         }
 }
 
+static void
+upower_kbd_set_property_cb (GObject      *object,
+                            GAsyncResult *res,
+                            gpointer      user_data)
+{
+        GsdPowerManager *manager = GSD_POWER_MANAGER (object);
+        GError *error = NULL;
+        gint value;
+
+        /* See handle_set_property_other(), nobody reads the result */
+        value = upower_kbd_set_brightness_finish (manager, res, &error);
+        if (value < 0) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Setting keyboard brightness failed: %s", error->message);
+                g_error_free (error);
+                return;
+        }
+
+        backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_KEYBOARD,
+                                      ABS_TO_PERCENTAGE (0, manager->kbd_brightness_max, value),
+                                      "set property");
+}
+
 static gboolean
 handle_set_property_other (GsdPowerManager *manager,
                            const gchar *interface_name,
@@ -3106,15 +3957,10 @@ handle_set_property_other (GsdPowerManager *manager,
                 g_variant_get (value, "i", &brightness_value);
                 brightness_value = PERCENTAGE_TO_ABS (0, manager->kbd_brightness_max,
                                                       brightness_value);
-                if (upower_kbd_set_brightness (manager, brightness_value, error)) {
-                        brightness_value = ABS_TO_PERCENTAGE (0,
-                                                              manager->kbd_brightness_max,
-                                                              manager->kbd_brightness_now);
-                        backlight_iface_emit_changed (manager, GSD_POWER_DBUS_INTERFACE_KEYBOARD, brightness_value, "set property");
-                        return TRUE;
-                } else {
-                        return FALSE;
-                }
+                kbd_backlight_ramp_stop (manager);
+                upower_kbd_set_brightness_async (manager, brightness_value,
+                                                 upower_kbd_set_property_cb, NULL);
+                return TRUE;
         }
 
         g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
@@ -3,6 +3,13 @@
  *
  * This is done by manipulating the GP37 output of the IT8772 Super-IO
  * chip found on the board.
+ *
+ * Run as "led-breathe <0/1>" to set the state once, or as
+ * "led-breathe --daemon" to keep running: the helper then prints
+ * "ready" on stdout once it found a supported board, and applies each
+ * '0' or '1' read from stdin until stdin is closed.  The Super-IO
+ * configuration sequence is only run for the first command; later ones
+ * just flip the GPIO output level.
  */
 
 #include <stdio.h>
@@ -10,6 +17,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/io.h>
 #include <unistd.h>
 
@@ -79,7 +87,19 @@ static bool isapnp_check_devid(void)
 	return false;
 }
 
-static void it8772_gp37_setup(bool high)
+static void it8772_gp37_set(uint16_t gpio_control_reg, bool high)
+{
+	uint8_t tmp;
+
+	tmp = inb(gpio_control_reg);
+	if (high)
+		outb(tmp | (1 << 7), gpio_control_reg);
+	else
+		outb(tmp & ~(1 << 7), gpio_control_reg);
+}
+
+/* Returns the GPIO control register, or 0 if it can't be accessed */
+static uint16_t it8772_gp37_setup(bool high)
 {
 	uint8_t tmp;
 	uint16_t gpio_control_reg;
@@ -100,18 +120,17 @@ static void it8772_gp37_setup(bool high)
 
 	if (ioperm(gpio_control_reg, 1, 1) == 0) {
 		/* Set GP37 output level */
-		tmp = inb(gpio_control_reg);
-		if (high)
-			outb(tmp | (1 << 7), gpio_control_reg);
-		else
-			outb(tmp & ~(1 << 7), gpio_control_reg);
+		it8772_gp37_set(gpio_control_reg, high);
 	} else {
 		perror("No GPIO IO permission\n");
+		gpio_control_reg = 0;
 	}
 
 	/* Set GP37 to output */
 	tmp = superio_inb(IT8772_GPIO3_OUTPUT_EN);
 	superio_outb(tmp | (1 << 7), IT8772_GPIO3_OUTPUT_EN);
+
+	return gpio_control_reg;
 }
 
 static bool ec100_detect(void)
@@ -128,19 +147,31 @@ static bool ec100_detect(void)
 	return strncmp(compatible, "endless,ec100", sizeof(compatible)) == 0;
 }
 
-static void ec100_breathe(int enable)
+static int ec100_open(void)
 {
-	FILE *fd;
-
 	if (access("/sys/class/meson_gpio", F_OK) != 0)
-		return;
+		return -1;
 
-	fd = fopen("/sys/class/meson_gpio/breathing", "w");
-	if (!fd)
+	return open("/sys/class/meson_gpio/breathing", O_WRONLY | O_CLOEXEC);
+}
+
+static void ec100_write(int fd, int enable)
+{
+	if (lseek(fd, 0, SEEK_SET) < 0 ||
+	    write(fd, enable ? "0" : "1", 1) != 1)
+		perror("breathing");
+}
+
+static void ec100_breathe(int enable)
+{
+	int fd;
+
+	fd = ec100_open();
+	if (fd < 0)
 		return;
 
-	fputs(enable ? "0" : "1", fd);
-	fclose(fd);
+	ec100_write(fd, enable);
+	close(fd);
 }
 
 static bool ec200_detect(void)
@@ -159,7 +190,7 @@ static bool ec200_detect(void)
 	return strncmp(product_name, "EC-200\n", sizeof(product_name)) == 0;
 }
 
-static int ec200_breathe(int enable)
+static int ec200_request_ports(void)
 {
 	/* Request access to required ports */
 	if (ioperm(PORT_ADDR, 1, 1)) {
@@ -172,6 +203,13 @@ static int ec200_breathe(int enable)
 		return 1;
 	}
 
+	return 0;
+}
+
+static int ec200_configure(int enable, uint16_t *gpio_control_reg)
+{
+	uint16_t reg;
+
 	isapnp_exit(); /* reset state */
 
 	isapnp_enter();
@@ -180,21 +218,92 @@ static int ec200_breathe(int enable)
 		return 1;
 	}
 
-	it8772_gp37_setup(enable);
+	reg = it8772_gp37_setup(enable);
+	if (gpio_control_reg)
+		*gpio_control_reg = reg;
 
 	isapnp_exit();
 	return 0;
 }
 
+static int ec200_breathe(int enable)
+{
+	if (ec200_request_ports())
+		return 1;
+
+	return ec200_configure(enable, NULL);
+}
+
+static int run_daemon(void)
+{
+	bool is_ec100, is_ec200;
+	uint16_t gpio_control_reg = 0;
+	int ec100_fd = -1;
+	int c;
+
+	is_ec100 = ec100_detect();
+	is_ec200 = !is_ec100 && ec200_detect();
+
+	if (is_ec100) {
+		ec100_fd = ec100_open();
+		if (ec100_fd < 0)
+			return 1;
+	} else if (is_ec200) {
+		bool found;
+
+		if (ec200_request_ports())
+			return 1;
+
+		isapnp_exit(); /* reset state */
+		isapnp_enter();
+		found = isapnp_check_devid();
+		isapnp_exit();
+		if (!found)
+			return 1;
+	} else {
+		/* No breathing LED on this board */
+		return 0;
+	}
+
+	printf("ready\n");
+	fflush(stdout);
+
+	while ((c = getchar()) != EOF) {
+		int enable;
+
+		if (c != '0' && c != '1')
+			continue;
+		enable = c == '1';
+
+		if (is_ec100) {
+			ec100_write(ec100_fd, enable);
+		} else if (gpio_control_reg != 0) {
+			it8772_gp37_set(gpio_control_reg, enable);
+		} else {
+			/* Keep reading on failure, the parent would get
+			 * SIGPIPE otherwise */
+			ec200_configure(enable, &gpio_control_reg);
+		}
+	}
+
+	if (ec100_fd >= 0)
+		close(ec100_fd);
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int enable;
 
 	if (argc < 2) {
-		fprintf(stderr, "Usage: %s <0/1>\n", argv[0]);
+		fprintf(stderr, "Usage: %s <0/1|--daemon>\n", argv[0]);
 		return 1;
 	}
 
+	if (strcmp(argv[1], "--daemon") == 0)
+		return run_daemon();
+
 	enable = !!atoi(argv[1]);
 
 	if (ec100_detect())
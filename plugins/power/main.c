@@ -2,6 +2,7 @@
 #define START gsd_power_manager_start
 #define STOP gsd_power_manager_stop
 #define MANAGER GsdPowerManager
+#define WAIT_FOR_READY
 #include "gsd-power-manager.h"
 
 #include "daemon-skeleton-gtk.h"
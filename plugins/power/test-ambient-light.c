@@ -0,0 +1,193 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gsd-ambient-light.h"
+
+typedef struct {
+        guint  n_writes;
+        gint   brightness;
+        gint   max_brightness;
+        gint64 last_write;
+        gint64 min_interval;
+} ReplayResult;
+
+static void
+replay_apply (ReplayResult *result,
+              gint          brightness,
+              gint64        time)
+{
+        if (result->last_write != 0)
+                result->min_interval = MIN (result->min_interval, time - result->last_write);
+        result->last_write = time;
+        result->n_writes++;
+        result->brightness = brightness;
+        result->max_brightness = MAX (result->max_brightness, brightness);
+}
+
+/* Feeds a trace of "<time in ms> <light level>" lines, calling the
+ * controller again at the retry times like the power plugin does. */
+static void
+replay_trace (const gchar  *name,
+              gint          brightness,
+              ReplayResult *result)
+{
+        g_autoptr(GsdAmbientLight) ambient = NULL;
+        g_autofree gchar *path = NULL;
+        g_autofree gchar *contents = NULL;
+        g_auto(GStrv) lines = NULL;
+        g_autoptr(GError) error = NULL;
+        gint64 retry_time = 0;
+        guint i;
+
+        path = g_build_filename (TESTDATADIR, name, NULL);
+        g_file_get_contents (path, &contents, NULL, &error);
+        g_assert_no_error (error);
+
+        memset (result, 0, sizeof (ReplayResult));
+        result->brightness = brightness;
+        result->min_interval = G_MAXINT64;
+
+        ambient = gsd_ambient_light_new ();
+        gsd_ambient_light_set_brightness (ambient, brightness);
+
+        lines = g_strsplit (contents, "\n", -1);
+        for (i = 0; lines[i] != NULL; i++) {
+                gchar *end;
+                gint64 time;
+                gdouble level;
+                gint pc;
+
+                if (lines[i][0] == '\0' || lines[i][0] == '#')
+                        continue;
+
+                /* monotonic time is never 0 */
+                time = g_ascii_strtoll (lines[i], &end, 10) * 1000 + 1;
+                level = g_ascii_strtod (end, NULL);
+
+                if (retry_time != 0 && retry_time <= time) {
+                        gint64 timeout_time = retry_time;
+
+                        pc = gsd_ambient_light_get_update (ambient, timeout_time, &retry_time);
+                        if (pc >= 0)
+                                replay_apply (result, pc, timeout_time);
+                }
+
+                gsd_ambient_light_add_reading (ambient, level, time);
+                pc = gsd_ambient_light_get_update (ambient, time, &retry_time);
+                if (pc >= 0)
+                        replay_apply (result, pc, time);
+        }
+}
+
+static void
+ambient_test_office (void)
+{
+        ReplayResult result;
+
+        /* the sensor noise alone never changes the brightness much */
+        replay_trace ("ambient-office.trace", 50, &result);
+        g_assert_cmpuint (result.n_writes, <=, 3);
+        g_assert_cmpint (ABS (result.brightness - 50), <=, 5);
+}
+
+static void
+ambient_test_lamp (void)
+{
+        ReplayResult result;
+
+        replay_trace ("ambient-lamp.trace", 25, &result);
+
+        /* follows the lamp to full brightness and back */
+        g_assert_cmpint (result.max_brightness, >=, 95);
+        g_assert_cmpint (ABS (result.brightness - 25), <=, 3);
+
+        /* in a limited number of changes, at a limited rate */
+        g_assert_cmpuint (result.n_writes, <=, 30);
+        g_assert_cmpint (result.min_interval, >=, GSD_AMBIENT_MIN_INTERVAL);
+}
+
+static void
+ambient_test_resolution (void)
+{
+        g_autoptr(GsdAmbientLight) ambient = NULL;
+        gint64 retry_time;
+
+        ambient = gsd_ambient_light_new ();
+        gsd_ambient_light_set_resolution (ambient, 10.0);
+        gsd_ambient_light_set_brightness (ambient, 50);
+
+        /* no reading yet */
+        g_assert_cmpint (gsd_ambient_light_get_update (ambient, 1, &retry_time), ==, -1);
+        g_assert_cmpint (retry_time, ==, 0);
+
+        /* the first reading is taken as matching the current brightness */
+        gsd_ambient_light_add_reading (ambient, 100.0, 1);
+        g_assert_cmpint (gsd_ambient_light_get_update (ambient, 1, &retry_time), ==, -1);
+
+        /* ~59%, more than the dead band but less than a backlight step */
+        gsd_ambient_light_add_reading (ambient, 120.0, 100 * G_USEC_PER_SEC);
+        g_assert_cmpint (gsd_ambient_light_get_update (ambient, 100 * G_USEC_PER_SEC, &retry_time), ==, -1);
+        g_assert_cmpint (retry_time, ==, 0);
+
+        /* ~99%, worth a change */
+        gsd_ambient_light_add_reading (ambient, 200.0, 200 * G_USEC_PER_SEC);
+        g_assert_cmpint (gsd_ambient_light_get_update (ambient, 200 * G_USEC_PER_SEC, &retry_time), >=, 90);
+}
+
+static void
+ambient_test_rate_limit (void)
+{
+        g_autoptr(GsdAmbientLight) ambient = NULL;
+        gint64 time = G_USEC_PER_SEC;
+        gint64 retry_time;
+
+        ambient = gsd_ambient_light_new ();
+        gsd_ambient_light_set_brightness (ambient, 20);
+        gsd_ambient_light_add_reading (ambient, 100.0, time);
+
+        time += 100 * G_USEC_PER_SEC;
+        gsd_ambient_light_add_reading (ambient, 400.0, time);
+        g_assert_cmpint (gsd_ambient_light_get_update (ambient, time, &retry_time), >=, 75);
+
+        /* a second change right away is held back */
+        time += G_USEC_PER_SEC / 5;
+        gsd_ambient_light_add_reading (ambient, 10.0, time);
+        g_assert_cmpint (gsd_ambient_light_get_update (ambient, time, &retry_time), ==, -1);
+        g_assert_cmpint (retry_time, ==, time - G_USEC_PER_SEC / 5 + GSD_AMBIENT_MIN_INTERVAL);
+
+        /* and made at the retry time */
+        g_assert_cmpint (gsd_ambient_light_get_update (ambient, retry_time, &retry_time), >=, 0);
+}
+
+int
+main (int argc, char **argv)
+{
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add_func ("/power/ambient/replay/office", ambient_test_office);
+        g_test_add_func ("/power/ambient/replay/lamp", ambient_test_lamp);
+        g_test_add_func ("/power/ambient/resolution", ambient_test_resolution);
+        g_test_add_func ("/power/ambient/rate-limit", ambient_test_rate_limit);
+
+        return g_test_run ();
+}
@@ -20,6 +20,7 @@ builddir = os.environ.get('BUILDDIR', os.path.dirname(__file__))
 sys.path.insert(0, os.path.join(project_root, 'tests'))
 sys.path.insert(0, builddir)
 import gsdtestcase
+import gsdbenchmark
 import gsdpowerconstants
 import gsdpowerenums
 
@@ -1298,5 +1299,40 @@ class PowerPluginTest8(PowerPluginBase):
 
         self.assertEqual(exc.exception.get_dbus_message(), 'No usable backlight could be found!')
 
+@gsdbenchmark.skip_unless_enabled
+class PowerPluginBenchmark(PowerPluginBase, gsdbenchmark.BenchmarkMixin):
+    BENCHMARK_SUITE = 'power'
+
+    def setUp(self):
+        # Measure the plugin, not the simulated slowness of the helper
+        os.environ['GSD_TEST_BACKLIGHT_DELAY'] = '0'
+        super().setUp()
+
+    def tearDown(self):
+        del os.environ['GSD_TEST_BACKLIGHT_DELAY']
+        super().tearDown()
+
+    def test_benchmark(self):
+        self.record_startup(self.plugin_log_write.name)
+        self.record_idle()
+
+        if self.skip_sysfs_backlight:
+            self.skipTest("sysfs backlight support required for the brightness benchmark")
+
+        obj_gsd_power = self.session_bus_con.get_object(
+            'org.gnome.SettingsDaemon.Power', '/org/gnome/SettingsDaemon/Power')
+        obj_gsd_power_screen_iface = dbus.Interface(obj_gsd_power, 'org.gnome.SettingsDaemon.Power.Screen')
+
+        # Go back and forth between 50% and 75%, each step call only
+        # returns once the value was written
+        def step(i):
+            if (i // 5) % 2 == 0:
+                obj_gsd_power_screen_iface.StepUp()
+            else:
+                obj_gsd_power_screen_iface.StepDown()
+
+        self.record_storm('brightness-step', 100, step)
+        self.assertEqual(self.get_brightness(), 50)
+
 # avoid writing to stderr
 unittest.main(testRunner=unittest.TextTestRunner(stream=sys.stdout, verbosity=2))
@@ -620,6 +620,26 @@ static const GDBusInterfaceVTable interface_vtable =
         handle_set_property
 };
 
+static void
+on_session_proxy_gotten (GObject      *source,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+        GsdRfkillManager *manager = user_data;
+        GsdSessionManager *session;
+
+        /* failures other than cancellation were already warned about */
+        session = gnome_settings_bus_get_session_proxy_finish (result, NULL);
+        if (session != NULL) {
+                manager->session = session;
+                manager->rfkill_input_inhibit_binding = g_object_bind_property (manager->session, "session-is-active",
+                                                                                manager->rfkill, "rfkill-input-inhibited",
+                                                                                G_BINDING_SYNC_CREATE);
+        }
+
+        g_object_unref (manager);
+}
+
 static void
 on_bus_gotten (GObject               *source_object,
                GAsyncResult          *res,
@@ -653,10 +673,9 @@ on_bus_gotten (GObject               *source_object,
                                                                NULL,
                                                                NULL);
 
-        manager->session = gnome_settings_bus_get_session_proxy ();
-        manager->rfkill_input_inhibit_binding = g_object_bind_property (manager->session, "session-is-active",
-                                                                              manager->rfkill, "rfkill-input-inhibited",
-                                                                              G_BINDING_SYNC_CREATE);
+        gnome_settings_bus_get_session_proxy_async (manager->cancellable,
+                                                    on_session_proxy_gotten,
+                                                    g_object_ref (manager));
 }
 
 static void
@@ -734,6 +753,24 @@ on_nm_proxy_gotten (GObject      *source,
         g_object_unref (manager);
 }
 
+static void
+on_chassis_type_gotten (GObject      *source,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+        GsdRfkillManager *manager = user_data;
+        g_autoptr(GError) error = NULL;
+        char *chassis_type;
+
+        chassis_type = gnome_settings_get_chassis_type_finish (result, &error);
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                manager->chassis_type = chassis_type;
+                engine_properties_changed (manager);
+        }
+
+        g_object_unref (manager);
+}
+
 static void
 sync_wwan_interesting (GDBusObjectManager *object_manager,
                        GDBusObject        *object,
@@ -808,7 +845,9 @@ gsd_rfkill_manager_start (GsdRfkillManager *manager,
 
         manager->cancellable = g_cancellable_new ();
 
-        manager->chassis_type = gnome_settings_get_chassis_type ();
+        gnome_settings_get_chassis_type_async (manager->cancellable,
+                                               on_chassis_type_gotten,
+                                               g_object_ref (manager));
 
         g_dbus_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
                                   G_DBUS_PROXY_FLAGS_NONE,
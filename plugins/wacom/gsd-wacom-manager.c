@@ -80,6 +80,8 @@ struct _GsdWacomManager
         guint start_idle_id;
         GdkSeat *seat;
         guint device_added_id;
+        guint device_removed_id;
+        gboolean idle;
 
         GsdShell *shell_proxy;
 
@@ -104,6 +106,11 @@ static void     gsd_wacom_manager_finalize    (GObject              *object);
 static gboolean is_opaque_tablet (GsdWacomManager *manager,
                                   GdkDevice       *device);
 
+enum {
+        PROP_0,
+        PROP_IDLE,
+};
+
 G_DEFINE_TYPE (GsdWacomManager, gsd_wacom_manager, G_TYPE_OBJECT)
 
 static gpointer manager_object = NULL;
@@ -170,12 +177,40 @@ migrate_tablet_settings (GsdWacomManager *manager,
         g_free (new_path);
 }
 
+static void
+gsd_wacom_manager_get_property (GObject    *object,
+                                guint       prop_id,
+                                GValue     *value,
+                                GParamSpec *pspec)
+{
+        GsdWacomManager *manager = GSD_WACOM_MANAGER (object);
+
+        switch (prop_id) {
+        case PROP_IDLE:
+                g_value_set_boolean (value, manager->idle);
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+                break;
+        }
+}
+
 static void
 gsd_wacom_manager_class_init (GsdWacomManagerClass *klass)
 {
         GObjectClass   *object_class = G_OBJECT_CLASS (klass);
 
+        object_class->get_property = gsd_wacom_manager_get_property;
         object_class->finalize = gsd_wacom_manager_finalize;
+
+        /* TRUE while no tablet is plugged in */
+        g_object_class_install_property (object_class,
+                                         PROP_IDLE,
+                                         g_param_spec_boolean ("idle",
+                                                               "Idle",
+                                                               "Whether there are no tablets to manage",
+                                                               FALSE,
+                                                               G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 }
 
 static gchar *
@@ -271,16 +306,17 @@ handle_method_call (GDBusConnection       *connection,
         GdkDevice *device;
 
         if (g_strcmp0 (method_name, "SetOLEDLabels") == 0) {
-                gchar *device_path, *label;
+                gchar *device_path;
+                gchar **labels;
                 gboolean left_handed;
                 GSettings *settings;
-                GVariantIter *iter;
-                gint i = 0;
 
-		g_variant_get (parameters, "(sas)", &device_path, &iter);
+		g_variant_get (parameters, "(s^as)", &device_path, &labels);
                 device = lookup_device_by_path (self, device_path);
                 if (!device) {
                         g_dbus_method_invocation_return_value (invocation, NULL);
+                        g_free (device_path);
+                        g_strfreev (labels);
                         return;
                 }
 
@@ -288,15 +324,11 @@ handle_method_call (GDBusConnection       *connection,
                 left_handed = g_settings_get_boolean (settings, LEFT_HANDED_KEY);
                 g_object_unref (settings);
 
-                while (g_variant_iter_loop (iter, "s", &label)) {
-                        if (!set_oled (device_path, left_handed, i, label, &error)) {
-                                g_free (label);
-                                break;
-                        }
-                        i++;
-                }
+                set_oled_labels (device_path, left_handed,
+                                 (const gchar * const *) labels, &error);
 
-                g_variant_iter_free (iter);
+                g_free (device_path);
+                g_strfreev (labels);
 
                 if (error)
                         g_dbus_method_invocation_return_gerror (invocation, error);
@@ -312,6 +344,24 @@ static const GDBusInterfaceVTable interface_vtable =
 	NULL, /* Set Property */
 };
 
+static void
+update_idle (GsdWacomManager *manager)
+{
+        GList *devices;
+        gboolean idle;
+
+        devices = gdk_seat_get_slaves (manager->seat, GDK_SEAT_CAPABILITY_TABLET_STYLUS);
+        idle = devices == NULL;
+        g_list_free (devices);
+
+        if (idle == manager->idle)
+                return;
+
+        g_debug ("%s", idle ? "No tablets left" : "Tablets present");
+        manager->idle = idle;
+        g_object_notify (G_OBJECT (manager), "idle");
+}
+
 static void
 device_added_cb (GdkSeat         *seat,
                  GdkDevice       *device,
@@ -320,9 +370,18 @@ device_added_cb (GdkSeat         *seat,
         if (gdk_device_get_source (device) == GDK_SOURCE_PEN &&
             gdk_device_get_device_type (device) == GDK_DEVICE_TYPE_SLAVE) {
                 migrate_tablet_settings (manager, device);
+                update_idle (manager);
         }
 }
 
+static void
+device_removed_cb (GdkSeat         *seat,
+                   GdkDevice       *device,
+                   GsdWacomManager *manager)
+{
+        update_idle (manager);
+}
+
 static void
 add_devices (GsdWacomManager     *manager,
              GdkSeatCapabilities  capabilities)
@@ -343,6 +402,8 @@ set_devicepresence_handler (GsdWacomManager *manager)
         seat = gdk_display_get_default_seat (gdk_display_get_default ());
         manager->device_added_id = g_signal_connect (seat, "device-added",
                                                            G_CALLBACK (device_added_cb), manager);
+        manager->device_removed_id = g_signal_connect (seat, "device-removed",
+                                                       G_CALLBACK (device_removed_cb), manager);
         manager->seat = seat;
 }
 
@@ -362,6 +423,7 @@ gsd_wacom_manager_idle_cb (GsdWacomManager *manager)
         set_devicepresence_handler (manager);
 
         add_devices (manager, GDK_SEAT_CAPABILITY_TABLET_STYLUS);
+        update_idle (manager);
 
         gnome_settings_profile_end (NULL);
 
@@ -483,6 +545,7 @@ gsd_wacom_manager_stop (GsdWacomManager *manager)
 
         if (manager->seat != NULL) {
                 g_signal_handler_disconnect (manager->seat, manager->device_added_id);
+                g_signal_handler_disconnect (manager->seat, manager->device_removed_id);
                 manager->seat = NULL;
         }
 }
@@ -333,19 +333,20 @@ int main (int argc, char **argv)
 	int uid, euid;
 	char *filename;
 	GError *error = NULL;
+	guint i;
 	const char * const subsystems[] = { "input", NULL };
 	int ret = 1;
 	gboolean usb;
 	GsdWacomOledType type;
 
 	char *path = NULL;
-	char *buffer = NULL;
+	char **buffers = NULL;
 	int button_num = -1;
 
 	const GOptionEntry options[] = {
 		{ "path", '\0', 0, G_OPTION_ARG_FILENAME, &path, "Device path for the Wacom device", NULL },
-		{ "buffer", '\0', 0, G_OPTION_ARG_STRING, &buffer, "Image to set base64 encoded", NULL },
-		{ "button", '\0', 0, G_OPTION_ARG_INT, &button_num, "Which button icon to set", NULL },
+		{ "buffer", '\0', 0, G_OPTION_ARG_STRING_ARRAY, &buffers, "Image to set base64 encoded, repeat to set consecutive buttons", NULL },
+		{ "button", '\0', 0, G_OPTION_ARG_INT, &button_num, "Which button icon to set first", NULL },
 		{ NULL}
 	};
 
@@ -364,7 +365,7 @@ int main (int argc, char **argv)
 
 	if (path == NULL ||
 	    button_num < 0 ||
-	    buffer == NULL) {
+	    buffers == NULL) {
 		char *txt;
 
 		txt = g_option_context_get_help (context, FALSE, NULL);
@@ -395,25 +396,27 @@ int main (int argc, char **argv)
 	else
 		usb = TRUE;
 
-	filename = get_oled_sys_path (client, device, button_num, usb, &type);
-	if (!filename)
-		goto out;
+	for (i = 0; buffers[i] != NULL; i++) {
+		filename = get_oled_sys_path (client, device, button_num + i, usb, &type);
+		if (!filename)
+			goto out;
 
-	if (gsd_wacom_oled_helper_write (filename, buffer, type, &error) == FALSE) {
-		g_critical ("Could not set OLED icon for '%s': %s", path, error->message);
-		g_error_free (error);
+		if (gsd_wacom_oled_helper_write (filename, buffers[i], type, &error) == FALSE) {
+			g_critical ("Could not set OLED icon for '%s': %s", path, error->message);
+			g_error_free (error);
+			g_free (filename);
+			goto out;
+		}
 		g_free (filename);
-		goto out;
-	}
-	g_free (filename);
 
-	g_debug ("Successfully set OLED icon for '%s', button %d", path, button_num);
+		g_debug ("Successfully set OLED icon for '%s', button %d", path, button_num + i);
+	}
 
 	ret = 0;
 
 out:
 	g_free (path);
-	g_free (buffer);
+	g_strfreev (buffers);
 
 	g_clear_object (&device);
 	g_clear_object (&client);
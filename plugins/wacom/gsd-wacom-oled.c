@@ -32,25 +32,37 @@
 #define MAGIC_BASE64		"base64:"		/*Label starting with base64: is treated as already encoded*/
 #define MAGIC_BASE64_LEN	strlen(MAGIC_BASE64)
 
+#define MAX_CACHED_LABELS	64			/*Number of encoded labels kept around*/
+
+/* Encoded images, keyed by handedness and label text */
+static GHashTable *label_cache = NULL;
+
+/* Pack two ARGB32 pixels into one byte, 4 bits per pixel. Each row is
+ * handled as a flat, fixed-length loop without index arithmetic across
+ * rows so that the compiler can vectorise it. */
+static inline void
+oled_pack_row (guchar       * restrict dest,
+	       const guchar * restrict src)
+{
+	int x;
+
+	for (x = 0; x < (OLED_WIDTH / 2); x++)
+		dest[x] = (src[8 * x + 1] & 0xf0) | (src[8 * x + 5] >> 4);
+}
+
 static void
 oled_surface_to_image (guchar          *image,
 		       cairo_surface_t *surface)
 {
-	unsigned char *csurf;
-	int i, x, y;
-	unsigned char lo, hi;
+	const guchar *csurf;
+	int stride, y;
 
 	cairo_surface_flush (surface);
 	csurf = cairo_image_surface_get_data (surface);
-	i = 0;
-	for (y = 0; y < OLED_HEIGHT; y++) {
-		for (x = 0; x < (OLED_WIDTH / 2); x++) {
-			hi = 0xf0 & csurf[4 * OLED_WIDTH * y + 8 * x + 1];
-			lo = 0x0f & (csurf[4 * OLED_WIDTH * y + 8 * x + 5] >> 4);
-			image[i] = hi | lo;
-			i++;
-		}
-	}
+	stride = cairo_image_surface_get_stride (surface);
+
+	for (y = 0; y < OLED_HEIGHT; y++)
+		oled_pack_row (image + y * (OLED_WIDTH / 2), csurf + y * stride);
 }
 
 static void
@@ -93,14 +105,27 @@ oled_split_text (char *label,
 	return;
 }
 
+static const PangoFontDescription *
+oled_get_font_description (void)
+{
+	static PangoFontDescription *desc = NULL;
+
+	if (desc == NULL) {
+		desc = pango_font_description_new ();
+		pango_font_description_set_family (desc, "Terminal");
+		pango_font_description_set_absolute_size (desc, PANGO_SCALE * 11);
+	}
+
+	return desc;
+}
+
 static void
-oled_render_text (char             *label,
+oled_render_text (const char       *label,
 		  guchar	   *image,
                   gboolean          left_handed)
 {
 	cairo_t *cr;
 	cairo_surface_t *surface;
-	PangoFontDescription *desc;
 	PangoLayout *layout;
 	int width, height;
 	double dx, dy;
@@ -108,7 +133,7 @@ oled_render_text (char             *label,
 	char line2[LABEL_SIZE + 1] = "";
 	char *buf;
 
-	oled_split_text (label ,line1, line2);
+	oled_split_text ((char *) label, line1, line2);
 
 	buf = g_strdup_printf ("%s\n%s", line1, line2);
 
@@ -130,12 +155,7 @@ oled_render_text (char             *label,
 	pango_layout_set_alignment (layout, PANGO_ALIGN_CENTER);
 	pango_layout_set_text (layout, buf, - 1);
 	g_free (buf);
-	desc = pango_font_description_new ();
-
-	pango_font_description_set_family (desc, "Terminal");
-	pango_font_description_set_absolute_size (desc, PANGO_SCALE * 11);
-	pango_layout_set_font_description (layout, desc);
-	pango_font_description_free (desc);
+	pango_layout_set_font_description (layout, oled_get_font_description ());
 	pango_layout_get_size (layout, &width, &height);
 	width = width/PANGO_SCALE;
 	cairo_new_path (cr);
@@ -203,56 +223,103 @@ gsd_wacom_oled_gdkpixbuf_to_base64 (GdkPixbuf *pixbuf)
 }
 
 static char *
-oled_encode_image (char             *label,
+oled_encode_image (const char       *label,
                    gboolean          left_handed)
 {
 	unsigned char *image;
+	char *base64;
 
 	image = g_malloc (MAX_IMAGE_SIZE);
 
 	/* convert label to image */
 	oled_render_text (label, image, left_handed);
 
-	return (g_base64_encode (image, MAX_IMAGE_SIZE));
+	base64 = g_base64_encode (image, MAX_IMAGE_SIZE);
+	g_free (image);
+
+	return base64;
+}
+
+static const char *
+oled_get_encoded_label (const char *label,
+			gboolean    left_handed)
+{
+	char *key, *buffer;
+
+	if (g_str_has_prefix (label, MAGIC_BASE64))
+		return label + MAGIC_BASE64_LEN;
+
+	key = g_strdup_printf ("%c%s", left_handed ? 'L' : 'R', label);
+	buffer = g_hash_table_lookup (label_cache, key);
+	if (buffer != NULL) {
+		g_free (key);
+		return buffer;
+	}
+
+	buffer = oled_encode_image (label, left_handed);
+	g_hash_table_insert (label_cache, key, buffer);
+
+	return buffer;
 }
 
 gboolean
-set_oled (const gchar  *device_path,
-          gboolean      left_handed,
-          guint         button,
-          char	       *label,
-          GError      **error)
+set_oled_labels (const gchar         *device_path,
+		 gboolean             left_handed,
+		 const gchar * const *labels,
+		 GError             **error)
 {
-	char *command;
+	GPtrArray *argv;
 	gboolean ret;
-	char *buffer;
-        gint status;
+	gint status;
+	guint i;
 
 #ifndef HAVE_GUDEV
 	/* Not implemented on non-Linux systems */
 	return TRUE;
 #endif
 
-	if (g_str_has_prefix (label, MAGIC_BASE64)) {
-		buffer = g_strdup (label + MAGIC_BASE64_LEN);
-        } else {
-		buffer = oled_encode_image (label, left_handed);
+	if (labels == NULL || labels[0] == NULL)
+		return TRUE;
+
+	/* Trim the cache before looking anything up, as the returned
+	 * buffers are borrowed from it */
+	if (label_cache == NULL)
+		label_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	else if (g_hash_table_size (label_cache) >= MAX_CACHED_LABELS)
+		g_hash_table_remove_all (label_cache);
+
+	/* Write all the buttons with a single helper invocation, buttons
+	 * are numbered consecutively from the one passed in --button */
+	argv = g_ptr_array_new ();
+	g_ptr_array_add (argv, "pkexec");
+	g_ptr_array_add (argv, LIBEXECDIR "/gsd-wacom-oled-helper");
+	g_ptr_array_add (argv, "--path");
+	g_ptr_array_add (argv, (gpointer) device_path);
+	g_ptr_array_add (argv, "--button");
+	g_ptr_array_add (argv, "0");
+
+	for (i = 0; labels[i] != NULL; i++) {
+		g_debug ("Setting OLED label '%s' on button %d (device %s)", labels[i], i, device_path);
+		g_ptr_array_add (argv, "--buffer");
+		g_ptr_array_add (argv, (gpointer) oled_get_encoded_label (labels[i], left_handed));
 	}
-
-	g_debug ("Setting OLED label '%s' on button %d (device %s)", label, button, device_path);
-
-	command = g_strdup_printf ("pkexec " LIBEXECDIR "/gsd-wacom-oled-helper --path %s --button %d --buffer %s",
-				   device_path, button, buffer);
-	ret = g_spawn_command_line_sync (command,
-					 NULL,
-					 NULL,
-					 &status,
-					 error);
-
-        if (ret == TRUE && status != 0)
-                ret = FALSE;
-
-	g_free (command);
+	g_ptr_array_add (argv, NULL);
+
+	ret = g_spawn_sync (NULL,
+			    (gchar **) argv->pdata,
+			    NULL,
+			    G_SPAWN_SEARCH_PATH,
+			    NULL,
+			    NULL,
+			    NULL,
+			    NULL,
+			    &status,
+			    error);
+
+        if (ret == TRUE)
+                ret = g_spawn_check_exit_status (status, error);
+
+	g_ptr_array_free (argv, TRUE);
 
         return ret;
 }
@@ -26,7 +26,7 @@
 
 G_BEGIN_DECLS
 
-gboolean set_oled (const gchar *device_path, gboolean left_handed, guint button, char *label, GError **error);
+gboolean set_oled_labels (const gchar *device_path, gboolean left_handed, const gchar * const *labels, GError **error);
 char *gsd_wacom_oled_gdkpixbuf_to_base64 (GdkPixbuf *pixbuf);
 
 G_END_DECLS
@@ -2,6 +2,8 @@
 #define START gsd_wacom_manager_start
 #define STOP gsd_wacom_manager_stop
 #define MANAGER GsdWacomManager
+#define EXIT_WHEN_IDLE
+#define DORMANT_UDEV_PROPERTY "ID_INPUT_TABLET"
 #include "gsd-wacom-manager.h"
 
 #include "daemon-skeleton-gtk.h"
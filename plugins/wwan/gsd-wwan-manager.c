@@ -47,9 +47,14 @@ struct _GsdWwanManager
         gboolean   unlock;
         GSettings *settings;
 
-        /* List of all devices not in ‘devices_to_unlock’ */
-        GPtrArray *devices;
-        GPtrArray *devices_to_unlock;
+        /* All modems exported by ModemManager, indexed by object path */
+        GHashTable *modems;
+        /* Devices created for modems which required a SIM unlock at some
+         * point, indexed by object path.  Other modems never get a
+         * #CcWwanDevice as creating one is expensive. */
+        GHashTable *devices;
+        /* Queue of devices waiting for the unlock prompt */
+        GPtrArray  *devices_to_unlock;
 
         /* Currently shown prompt and device being unlocked */
         GcrPrompt    *prompt;
@@ -60,15 +65,21 @@ struct _GsdWwanManager
 
         MMManager *mm1;
         gboolean  mm1_running;
+        gboolean  mm1_resolved;
+
+        gboolean  idle;
 };
 
 enum {
         PROP_0,
         PROP_UNLOCK_SIM,
+        PROP_IDLE,
         PROP_LAST_PROP,
 };
 static GParamSpec *props[PROP_LAST_PROP];
 
+static void wwan_manager_update_idle (GsdWwanManager *self);
+
 #define GSD_WWAN_SCHEMA_DIR "org.gnome.settings-daemon.plugins.wwan"
 #define GSD_WWAN_SCHEMA_UNLOCK_SIM "unlock-sim"
 
@@ -80,9 +91,6 @@ static gpointer manager_object = NULL;
 static void wwan_manager_ensure_unlocking   (GsdWwanManager *self);
 static void wwan_manager_unlock_device      (CcWwanDevice   *device,
                                              gpointer        user_data);
-static void wwan_manager_unlock_required_cb (GsdWwanManager *self,
-                                             GParamSpec     *pspec,
-                                             CcWwanDevice   *device);
 
 static void
 manager_unlock_prompt_new (GsdWwanManager *self,
@@ -364,9 +372,8 @@ wwan_manager_unlock_device_cb (GObject      *object,
 
         wwan_manager_unlock_device_finish (device, result, &error);
 
-        /* Move the device from devices to unlock to the list of devices */
-        if (g_ptr_array_remove (self->devices_to_unlock, device))
-                g_ptr_array_add (self->devices, g_object_ref (device));
+        /* The device is done, whether it was unlocked or not */
+        g_ptr_array_remove (self->devices_to_unlock, device);
 
         g_clear_pointer (&self->puk_code, gcr_secure_memory_free);
         g_clear_object (&self->prompt);
@@ -375,8 +382,8 @@ wwan_manager_unlock_device_cb (GObject      *object,
         g_clear_handle_id (&self->prompt_timeout_id, g_source_remove);
 
         /* Unlock the next device */
-        if (self->devices_to_unlock->len)
-                wwan_manager_unlock_required_cb (self, NULL, self->devices_to_unlock->pdata[0]);
+        wwan_manager_ensure_unlocking (self);
+        wwan_manager_update_idle (self);
 
         if (error)
                 g_debug ("Error unlocking device: %s", error->message);
@@ -386,151 +393,148 @@ wwan_manager_unlock_device_cb (GObject      *object,
 }
 
 static void
-wwan_manager_unlock_required_cb (GsdWwanManager *self,
-                                 GParamSpec     *pspec,
-                                 CcWwanDevice   *device)
+wwan_manager_ensure_unlocking (GsdWwanManager *self)
 {
+        CcWwanDevice *device;
+        GTask *task;
+
+        g_assert (GSD_WWAN_MANAGER (self));
+
+        if (!self->unlock || self->unlocking_device)
+                return;
+
+        if (self->devices_to_unlock->len == 0)
+                return;
+
+        g_warn_if_fail (!self->cancellable);
+        g_clear_object (&self->cancellable);
+
+        device = self->devices_to_unlock->pdata[0];
+        self->cancellable = g_cancellable_new ();
+        task = g_task_new (device, self->cancellable,
+                           wwan_manager_unlock_device_cb,
+                           g_object_ref (self));
+        g_task_set_task_data (task, g_object_ref (self), g_object_unref);
+
+        wwan_manager_unlock_device (device, task);
+}
+
+static void
+wwan_manager_update_modem_lock (GsdWwanManager *self,
+                                MMObject       *object)
+{
+        const gchar *object_path;
+        CcWwanDevice *device;
+        MMModem *modem;
         MMModemLock lock;
 
-        g_assert (GSD_IS_WWAN_MANAGER (self));
-        g_assert (CC_IS_WWAN_DEVICE (device));
+        object_path = mm_object_get_path (object);
+        modem = mm_object_peek_modem (object);
+        g_return_if_fail (modem != NULL);
 
-        lock = cc_wwan_device_get_lock (device);
+        device = g_hash_table_lookup (self->devices, object_path);
+        lock = mm_modem_get_unlock_required (modem);
 
         if (lock != MM_MODEM_LOCK_SIM_PIN &&
             lock != MM_MODEM_LOCK_SIM_PUK) {
-                g_object_ref (device);
+                if (!device)
+                        return;
 
-                /* Move the device from devices to unlock to the list of devices */
-                if (g_ptr_array_remove (self->devices_to_unlock, device))
-                        g_ptr_array_add (self->devices, device);
+                g_ptr_array_remove (self->devices_to_unlock, device);
 
                 /* If the device is the device being unlocked, cancel the process */
                 if (device == self->unlocking_device)
                         g_cancellable_cancel (self->cancellable);
-        } else if (lock == MM_MODEM_LOCK_SIM_PIN ||
-                   lock == MM_MODEM_LOCK_SIM_PUK) {
-                g_object_ref (device);
-
-                /* Move the device to devices to unlock from the list of devices */
-                if (g_ptr_array_remove (self->devices, device)) {
-                        g_ptr_array_add (self->devices_to_unlock, device);
-                        wwan_manager_ensure_unlocking (self);
-                }
-        }
-}
-
 
-static gboolean
-device_match_by_object (CcWwanDevice *device, GDBusObject *object)
-{
-        const char *device_path, *object_path;
+                return;
+        }
 
-        g_return_val_if_fail (G_IS_DBUS_OBJECT (object), FALSE);
-        g_return_val_if_fail (CC_IS_WWAN_DEVICE (device), FALSE);
+        if (!device) {
+                g_debug ("Device at %s requires unlocking", object_path);
+                device = cc_wwan_device_new (object, NULL);
+                g_hash_table_insert (self->devices, g_strdup (object_path), device);
+        }
 
-        device_path = cc_wwan_device_get_path (device);
-        object_path = mm_object_get_path (MM_OBJECT (object));
+        if (!g_ptr_array_find (self->devices_to_unlock, device, NULL))
+                g_ptr_array_add (self->devices_to_unlock, g_object_ref (device));
 
-        return g_strcmp0 (device_path, object_path) == 0;
+        wwan_manager_ensure_unlocking (self);
 }
 
-/*
- * @array: (out) (nullable):
- * @index: (out) (nullable):
- *
- * Returns: %TRUE if found.  %FALSE otherwise
- */
-static gboolean
-wwan_manager_find_match (GsdWwanManager  *self,
-                         GDBusObject     *object,
-                         GPtrArray      **array,
-                         guint           *index)
+static void
+wwan_manager_unlock_required_cb (GsdWwanManager *self,
+                                 GParamSpec     *pspec,
+                                 MMModem        *modem)
 {
-        GPtrArray *devices = NULL;
-        guint i = 0;
-
-        g_return_val_if_fail (G_IS_DBUS_OBJECT (object), FALSE);
-
-        if (g_ptr_array_find_with_equal_func (self->devices,
-                                              object,
-                                              (GEqualFunc) device_match_by_object,
-                                              &i))
-                devices = self->devices;
-        else if (g_ptr_array_find_with_equal_func (self->devices_to_unlock,
-                                                     object,
-                                                     (GEqualFunc) device_match_by_object,
-                                                     &i))
-                devices = self->devices_to_unlock;
-
-        if (index && i >= 0)
-                *index = i;
-        if (array)
-                *array = devices;
-
-        if (devices)
-                return TRUE;
+        MMObject *object;
 
-        return FALSE;
-}
+        g_assert (GSD_IS_WWAN_MANAGER (self));
+        g_assert (MM_IS_MODEM (modem));
 
+        object = g_hash_table_lookup (self->modems, mm_modem_get_path (modem));
+        if (object)
+                wwan_manager_update_modem_lock (self, object);
+}
 
 static void
-wwan_manager_ensure_unlocking (GsdWwanManager *self)
+wwan_manager_update_idle (GsdWwanManager *self)
 {
-        CcWwanDevice *device;
-        GTask *task;
-
-        g_assert (GSD_WWAN_MANAGER (self));
-
-        if (!self->unlock || self->unlocking_device)
-                return;
+        gboolean idle;
 
-        if (self->devices_to_unlock->len == 0)
+        idle = self->mm1_resolved &&
+               g_hash_table_size (self->modems) == 0 &&
+               self->unlocking_device == NULL;
+        if (idle == self->idle)
                 return;
 
-        g_warn_if_fail (!self->cancellable);
-        g_clear_object (&self->cancellable);
-
-        device = self->devices_to_unlock->pdata[0];
-        self->cancellable = g_cancellable_new ();
-        task = g_task_new (device, self->cancellable,
-                           wwan_manager_unlock_device_cb,
-                           g_object_ref (self));
-        g_task_set_task_data (task, g_object_ref (self), g_object_unref);
-
-        wwan_manager_unlock_device (device, task);
+        self->idle = idle;
+        g_object_notify_by_pspec (G_OBJECT (self), props[PROP_IDLE]);
 }
 
 static void
 gsd_wwan_manager_cache_mm_object (GsdWwanManager *self, MMObject *obj)
 {
         const gchar *modem_object_path;
-        CcWwanDevice *wwan_device;
-        MMModemLock lock;
+        MMModem *modem;
 
         modem_object_path = g_dbus_object_get_object_path (G_DBUS_OBJECT (obj));
         g_return_if_fail (modem_object_path);
 
         /* This shouldn’t happen, so warn and return if this happen. */
-        if (wwan_manager_find_match (self, G_DBUS_OBJECT (obj), NULL, NULL)) {
+        if (g_hash_table_contains (self->modems, modem_object_path)) {
                 g_warning("Device %s already tracked", modem_object_path);
                 return;
         }
 
+        modem = mm_object_peek_modem (obj);
+        if (!modem) {
+                g_debug ("Ignoring object without modem interface at: %s", modem_object_path);
+                return;
+        }
+
         g_debug ("Tracking device at: %s", modem_object_path);
-        wwan_device = cc_wwan_device_new (MM_OBJECT (obj), NULL);
-        lock = cc_wwan_device_get_lock (wwan_device);
-        if (lock == MM_MODEM_LOCK_SIM_PIN ||
-            lock == MM_MODEM_LOCK_SIM_PUK)
-                g_ptr_array_add (self->devices_to_unlock, wwan_device);
-        else
-                g_ptr_array_add (self->devices, wwan_device);
+        g_hash_table_insert (self->modems, g_strdup (modem_object_path), g_object_ref (obj));
 
-        g_signal_connect_object (wwan_device, "notify::unlock-required",
+        g_signal_connect_object (modem, "notify::unlock-required",
                                  G_CALLBACK (wwan_manager_unlock_required_cb),
                                  self, G_CONNECT_SWAPPED);
-        wwan_manager_ensure_unlocking (self);
+        wwan_manager_update_modem_lock (self, obj);
+        wwan_manager_update_idle (self);
+}
+
+static void
+wwan_manager_untrack_all (GsdWwanManager *self)
+{
+        GHashTableIter iter;
+        MMObject *object;
+
+        g_hash_table_iter_init (&iter, self->modems);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &object))
+                g_signal_handlers_disconnect_by_data (mm_object_peek_modem (object), self);
+
+        g_hash_table_remove_all (self->modems);
+        g_hash_table_remove_all (self->devices);
+        g_ptr_array_set_size (self->devices_to_unlock, 0);
 }
 
 
@@ -550,21 +554,31 @@ object_removed_cb (GsdWwanManager     *self,
                    GDBusObjectManager *obj_manager)
 {
         CcWwanDevice *device;
-        GPtrArray *devices;
-        guint index;
+        const gchar *object_path;
+        MMObject *modem_object;
 
         g_return_if_fail (GSD_IS_WWAN_MANAGER (self));
         g_return_if_fail (G_IS_DBUS_OBJECT_MANAGER (obj_manager));
 
-        if (!wwan_manager_find_match (self, object, &devices, &index))
-                g_return_if_reached ();
+        object_path = g_dbus_object_get_object_path (object);
+        modem_object = g_hash_table_lookup (self->modems, object_path);
+        if (!modem_object)
+                return;
 
-        device = g_ptr_array_index (devices, index);
+        g_signal_handlers_disconnect_by_data (mm_object_peek_modem (modem_object), self);
 
-        g_ptr_array_remove_index (devices, index);
+        device = g_hash_table_lookup (self->devices, object_path);
+        if (device) {
+                g_ptr_array_remove (self->devices_to_unlock, device);
 
-        if (device == self->unlocking_device)
-                g_cancellable_cancel (self->cancellable);
+                if (device == self->unlocking_device)
+                        g_cancellable_cancel (self->cancellable);
+
+                g_hash_table_remove (self->devices, object_path);
+        }
+
+        g_hash_table_remove (self->modems, object_path);
+        wwan_manager_update_idle (self);
 }
 
 
@@ -579,12 +593,12 @@ mm1_name_owner_changed_cb (GDBusObjectManagerClient *client, GParamSpec *pspec,
 
         if (!self->mm1_running) {
                 /* Drop all devices when MM goes away */
-                g_ptr_array_set_size (self->devices, 0);
-                g_ptr_array_set_size (self->devices_to_unlock, 0);
+                wwan_manager_untrack_all (self);
 
                 g_clear_object (&self->prompt);
                 g_clear_pointer (&self->puk_code, gcr_secure_memory_free);
                 g_clear_object (&self->unlocking_device);
+                wwan_manager_update_idle (self);
 
                 return;
         }
@@ -636,6 +650,9 @@ mm1_manager_new_cb (GDBusConnection *connection, GAsyncResult *res, GsdWwanManag
         } else {
                 g_warning ("Error connecting to D-Bus: %s", error->message);
         }
+
+        self->mm1_resolved = TRUE;
+        wwan_manager_update_idle (self);
 }
 
 
@@ -655,6 +672,8 @@ set_modem_manager (GsdWwanManager *self)
                 g_object_unref (system_bus);
         } else {
                 g_warning ("Error connecting to system D-Bus: %s", error->message);
+                self->mm1_resolved = TRUE;
+                wwan_manager_update_idle (self);
         }
 }
 
@@ -714,9 +733,7 @@ gsd_wwan_manager_set_unlock_sim (GsdWwanManager *self, gboolean unlock)
          */
         /* Unlock the first device if no device is being unlocked.  Unlocking
          * the rest will be handled appropriately after this is finished. */
-        if (self->unlock && self->devices_to_unlock->len > 0 && !self->unlocking_device)
-                wwan_manager_unlock_required_cb (self, NULL,
-                                                 self->devices_to_unlock->pdata[0]);
+        wwan_manager_ensure_unlocking (self);
 
         g_object_notify_by_pspec (G_OBJECT (self), props[PROP_UNLOCK_SIM]);
 }
@@ -752,6 +769,9 @@ gsd_wwan_manager_get_property (GObject        *object,
         case PROP_UNLOCK_SIM:
                 g_value_set_boolean (value, self->unlock);
                 break;
+        case PROP_IDLE:
+                g_value_set_boolean (value, self->idle);
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
                 break;
@@ -776,7 +796,10 @@ gsd_wwan_manager_dispose (GObject *object)
         g_clear_pointer (&self->puk_code, gcr_secure_memory_free);
         g_clear_object (&self->prompt);
 
-        g_clear_pointer (&self->devices, g_ptr_array_unref);
+        if (self->modems)
+                wwan_manager_untrack_all (self);
+        g_clear_pointer (&self->modems, g_hash_table_unref);
+        g_clear_pointer (&self->devices, g_hash_table_unref);
         g_clear_pointer (&self->devices_to_unlock, g_ptr_array_unref);
         g_clear_object (&self->settings);
 
@@ -800,13 +823,25 @@ gsd_wwan_manager_class_init (GsdWwanManagerClass *klass)
                                       G_PARAM_READWRITE |
                                       G_PARAM_EXPLICIT_NOTIFY |
                                       G_PARAM_STATIC_STRINGS);
+        /* TRUE while ModemManager exports no modems */
+        props[PROP_IDLE] =
+                g_param_spec_boolean ("idle",
+                                      "idle",
+                                      "Whether there are no modems to manage",
+                                      FALSE,
+                                      G_PARAM_READABLE |
+                                      G_PARAM_EXPLICIT_NOTIFY |
+                                      G_PARAM_STATIC_STRINGS);
         g_object_class_install_properties (object_class, PROP_LAST_PROP, props);
 }
 
 static void
 gsd_wwan_manager_init (GsdWwanManager *self)
 {
-        self->devices = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+        self->modems = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, g_object_unref);
+        self->devices = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, g_object_unref);
         self->devices_to_unlock = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 }
 
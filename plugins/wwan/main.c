@@ -2,6 +2,8 @@
 #define START gsd_wwan_manager_start
 #define STOP gsd_wwan_manager_stop
 #define MANAGER GsdWwanManager
+#define EXIT_WHEN_IDLE
+#define DORMANT_UDEV_PROPERTY "ID_MM_CANDIDATE"
 #include "gsd-wwan-manager.h"
 
 #include "daemon-skeleton.h"
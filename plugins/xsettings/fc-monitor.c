@@ -19,11 +19,25 @@
  * Author:  Behdad Esfahbod, Red Hat, Inc.
  */
 
+#include "config.h"
+
 #include "fc-monitor.h"
 
 #include <gio/gio.h>
 #include <fontconfig/fontconfig.h>
 
+#if HAVE_INOTIFY
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <glib-unix.h>
+
+#define INOTIFY_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+                      IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | \
+                      IN_DELETE_SELF | IN_MOVE_SELF)
+#endif
+
 #define TIMEOUT_MILLISECONDS 1000
 
 static void
@@ -72,11 +86,26 @@ typedef enum {
 struct _FcMonitor {
         GObject parent_instance;
 
-        GPtrArray *monitors;
+        gboolean monitoring;
+#if HAVE_INOTIFY
+        /* One inotify instance for all the watched paths */
+        int inotify_fd;
+        guint inotify_source;
+        GHashTable *wd_by_path;
+        GHashTable *path_by_wd;
+#endif
+        /* Paths watched with a GFileMonitor instead, see add_file_monitor() */
+        GHashTable *monitor_by_path;
 
         guint timeout;
         UpdateState state;
         gboolean notify;
+
+        /* Statistics, reported in debug output */
+        guint n_syncs;
+        guint n_watches_added;
+        guint n_watches_removed;
+        gint64 max_sync_time;
 };
 
 enum {
@@ -88,9 +117,8 @@ enum {
 static guint signals[N_SIGNALS] = { 0, };
 
 static void fc_monitor_finalize (GObject *object);
-static void monitor_files (FcMonitor *self, FcStrList *list);
-static void stuff_changed (GFileMonitor *monitor, GFile *file, GFile *other_file,
-                           GFileMonitorEvent event_type, gpointer data);
+static void sync_watches (FcMonitor *self);
+static void stuff_changed (FcMonitor *self, const gchar *event_name);
 static void start_timeout (FcMonitor *self);
 static gboolean start_update (gpointer data);
 static void update_done (GObject *source_object, GAsyncResult *result, gpointer user_data);
@@ -124,6 +152,9 @@ fc_monitor_new (void)
 static void
 fc_monitor_init (FcMonitor *self G_GNUC_UNUSED)
 {
+#if HAVE_INOTIFY
+        self->inotify_fd = -1;
+#endif
         FcInit ();
 }
 
@@ -136,78 +167,301 @@ fc_monitor_finalize (GObject *object)
                 g_source_remove (self->timeout);
         self->timeout = 0;
 
-        g_clear_pointer (&self->monitors, g_ptr_array_unref);
+        fc_monitor_stop (self);
 
         G_OBJECT_CLASS (fc_monitor_parent_class)->finalize (object);
 }
 
-void
-fc_monitor_start (FcMonitor *self)
+static const gchar *
+get_name (GType enum_type,
+          gint enum_value)
 {
-        g_return_if_fail (FC_IS_MONITOR (self));
-        g_return_if_fail (self->monitors == NULL);
+        GEnumClass *klass = g_type_class_ref (enum_type);
+        GEnumValue *value = g_enum_get_value (klass, enum_value);
+        const gchar *name = value ? value->value_name : "(unknown)";
+        g_type_class_unref (klass);
+        return name;
+}
 
-        self->monitors = g_ptr_array_new_with_free_func (g_object_unref);
+static void
+file_monitor_changed (GFileMonitor *monitor G_GNUC_UNUSED,
+                      GFile *file G_GNUC_UNUSED,
+                      GFile *other_file G_GNUC_UNUSED,
+                      GFileMonitorEvent event_type,
+                      gpointer data)
+{
+        stuff_changed (FC_MONITOR (data), get_name (G_TYPE_FILE_MONITOR_EVENT, event_type));
+}
 
-        monitor_files (self, FcConfigGetConfigFiles (NULL));
-        monitor_files (self, FcConfigGetFontDirs (NULL));
+static void
+file_monitor_free (GFileMonitor *monitor)
+{
+        g_file_monitor_cancel (monitor);
+        g_object_unref (monitor);
 }
 
-void
-fc_monitor_stop (FcMonitor *self)
+/* GFileMonitor keeps watching paths that don't exist yet, so it is
+ * used for those, and for everything when inotify is not usable */
+static void
+add_file_monitor (FcMonitor  *self,
+                  const char *path)
 {
-        g_return_if_fail (FC_IS_MONITOR (self));
-        g_clear_pointer (&self->monitors, g_ptr_array_unref);
+        GFile *file;
+        GFileMonitor *monitor;
+
+        file = g_file_new_for_path (path);
+        monitor = g_file_monitor (file, G_FILE_MONITOR_NONE, NULL, NULL);
+        g_object_unref (file);
+
+        if (!monitor)
+                return;
+
+        g_signal_connect (monitor, "changed", G_CALLBACK (file_monitor_changed), self);
+
+        g_hash_table_insert (self->monitor_by_path, g_strdup (path), monitor);
+        self->n_watches_added++;
+}
+
+#if HAVE_INOTIFY
+static gboolean
+add_inotify_watch (FcMonitor  *self,
+                   const char *path)
+{
+        int wd;
+        char *key;
+
+        if (self->inotify_fd < 0)
+                return FALSE;
+
+        wd = inotify_add_watch (self->inotify_fd, path, INOTIFY_MASK);
+        if (wd < 0) {
+                if (errno != ENOENT)
+                        g_debug ("Failed to watch %s: %s", path, g_strerror (errno));
+                return FALSE;
+        }
+
+        key = g_strdup (path);
+        g_hash_table_insert (self->wd_by_path, key, GINT_TO_POINTER (wd));
+        g_hash_table_insert (self->path_by_wd, GINT_TO_POINTER (wd), key);
+        self->n_watches_added++;
+
+        return TRUE;
+}
+#else
+static gboolean
+add_inotify_watch (FcMonitor  *self G_GNUC_UNUSED,
+                   const char *path G_GNUC_UNUSED)
+{
+        return FALSE;
+}
+#endif
+
+static void
+add_watch (FcMonitor  *self,
+           const char *path)
+{
+        if (!add_inotify_watch (self, path))
+                add_file_monitor (self, path);
+}
+
+#if HAVE_INOTIFY
+static gboolean
+inotify_read_cb (int          fd,
+                 GIOCondition condition G_GNUC_UNUSED,
+                 gpointer     data)
+{
+        FcMonitor *self = FC_MONITOR (data);
+        char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+        const struct inotify_event *event;
+        const char *event_name = NULL;
+        ssize_t len;
+        char *p;
+
+        /* Drain everything that is queued and handle it as a single change */
+        while ((len = read (fd, buf, sizeof (buf))) > 0) {
+                for (p = buf; p < buf + len; p += sizeof (struct inotify_event) + event->len) {
+                        event = (const struct inotify_event *) p;
+
+                        if (event->mask & IN_Q_OVERFLOW) {
+                                event_name = "IN_Q_OVERFLOW";
+                        } else if (event->mask & IN_IGNORED) {
+                                char *path;
+
+                                /* The watched inode went away (e.g. a config
+                                 * file was replaced), watch the new one or
+                                 * wait for it to come back.  Watches we
+                                 * removed ourselves are already gone from
+                                 * the table. */
+                                path = g_hash_table_lookup (self->path_by_wd, GINT_TO_POINTER (event->wd));
+                                if (path == NULL)
+                                        continue;
+
+                                g_hash_table_steal (self->path_by_wd, GINT_TO_POINTER (event->wd));
+                                g_hash_table_steal (self->wd_by_path, path);
+                                self->n_watches_removed++;
+                                add_watch (self, path);
+                                g_free (path);
+                        } else if (event_name == NULL) {
+                                event_name = (event->mask & IN_ISDIR) ? "directory event" : "file event";
+                        }
+                }
+        }
+
+        if (len < 0 && errno != EAGAIN && errno != EINTR) {
+                g_warning ("Failed to read inotify events: %s", g_strerror (errno));
+                self->inotify_source = 0;
+                return G_SOURCE_REMOVE;
+        }
+
+        if (event_name)
+                stuff_changed (self, event_name);
+
+        return G_SOURCE_CONTINUE;
 }
+#endif
 
 static void
-monitor_files (FcMonitor *self,
-               FcStrList *list)
+collect_paths (GHashTable *paths,
+               FcStrList  *list)
 {
         const char *str;
 
-        while ((str = (const char *) FcStrListNext (list))) {
-                GFile *file;
-                GFileMonitor *monitor;
+        while ((str = (const char *) FcStrListNext (list)))
+                g_hash_table_add (paths, g_strdup (str));
+
+        FcStrListDone (list);
+}
 
-                file = g_file_new_for_path (str);
+/* Diff the watches against the current fontconfig paths, so that only
+ * paths which appeared or went away are touched */
+static void
+sync_watches (FcMonitor *self)
+{
+        g_autoptr(GHashTable) paths = NULL;
+        GHashTableIter iter;
+        gpointer key;
+        guint n_added, n_removed, n_watched;
+        gint64 start, elapsed;
+
+        start = g_get_monotonic_time ();
+        n_added = self->n_watches_added;
+        n_removed = self->n_watches_removed;
+
+        paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        collect_paths (paths, FcConfigGetConfigFiles (NULL));
+        collect_paths (paths, FcConfigGetFontDirs (NULL));
+
+#if HAVE_INOTIFY
+        if (self->inotify_fd >= 0) {
+                gpointer value;
+
+                g_hash_table_iter_init (&iter, self->wd_by_path);
+                while (g_hash_table_iter_next (&iter, &key, &value)) {
+                        if (g_hash_table_contains (paths, key))
+                                continue;
+
+                        inotify_rm_watch (self->inotify_fd, GPOINTER_TO_INT (value));
+                        g_hash_table_remove (self->path_by_wd, value);
+                        g_hash_table_iter_remove (&iter);
+                        self->n_watches_removed++;
+                }
+        }
+#endif
 
-                monitor = g_file_monitor (file, G_FILE_MONITOR_NONE, NULL, NULL);
+        /* Also move the paths that exist by now over to inotify */
+        g_hash_table_iter_init (&iter, self->monitor_by_path);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                if (g_hash_table_contains (paths, key) &&
+                    !add_inotify_watch (self, key))
+                        continue;
 
-                g_object_unref (file);
+                g_hash_table_iter_remove (&iter);
+                self->n_watches_removed++;
+        }
 
-                if (!monitor)
+        g_hash_table_iter_init (&iter, paths);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+#if HAVE_INOTIFY
+                if (self->wd_by_path != NULL &&
+                    g_hash_table_contains (self->wd_by_path, key))
                         continue;
+#endif
+                if (!g_hash_table_contains (self->monitor_by_path, key))
+                        add_watch (self, key);
+        }
 
-                g_signal_connect (monitor, "changed", G_CALLBACK (stuff_changed), self);
+        n_watched = g_hash_table_size (self->monitor_by_path);
+#if HAVE_INOTIFY
+        if (self->wd_by_path != NULL)
+                n_watched += g_hash_table_size (self->wd_by_path);
+#endif
+
+        elapsed = g_get_monotonic_time () - start;
+        self->max_sync_time = MAX (self->max_sync_time, elapsed);
+        self->n_syncs++;
+
+        g_debug ("Watching %u fontconfig paths (%u added, %u removed, %u with file monitors) "
+                 "in %" G_GINT64_FORMAT " µs; %u syncs so far, slowest took %" G_GINT64_FORMAT " µs",
+                 n_watched,
+                 self->n_watches_added - n_added,
+                 self->n_watches_removed - n_removed,
+                 g_hash_table_size (self->monitor_by_path),
+                 elapsed, self->n_syncs, self->max_sync_time);
+}
 
-                g_ptr_array_add (self->monitors, monitor);
+void
+fc_monitor_start (FcMonitor *self)
+{
+        g_return_if_fail (FC_IS_MONITOR (self));
+        g_return_if_fail (!self->monitoring);
+
+        self->monitoring = TRUE;
+        self->monitor_by_path = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                       g_free, (GDestroyNotify) file_monitor_free);
+
+#if HAVE_INOTIFY
+        self->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+        if (self->inotify_fd >= 0) {
+                self->wd_by_path = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+                self->path_by_wd = g_hash_table_new (g_direct_hash, g_direct_equal);
+                self->inotify_source = g_unix_fd_add (self->inotify_fd, G_IO_IN, inotify_read_cb, self);
+                g_source_set_name_by_id (self->inotify_source, "[gnome-settings-daemon] fontconfig inotify");
+        } else {
+                /* e.g. the per-user instance limit was hit */
+                g_warning ("Failed to initialise inotify, using file monitors: %s",
+                           g_strerror (errno));
         }
+#endif
 
-        FcStrListDone (list);
+        sync_watches (self);
 }
 
-static const gchar *
-get_name (GType enum_type,
-          gint enum_value)
+void
+fc_monitor_stop (FcMonitor *self)
 {
-        GEnumClass *klass = g_type_class_ref (enum_type);
-        GEnumValue *value = g_enum_get_value (klass, enum_value);
-        const gchar *name = value ? value->value_name : "(unknown)";
-        g_type_class_unref (klass);
-        return name;
+        g_return_if_fail (FC_IS_MONITOR (self));
+
+        self->monitoring = FALSE;
+
+#if HAVE_INOTIFY
+        if (self->inotify_source)
+                g_source_remove (self->inotify_source);
+        self->inotify_source = 0;
+
+        if (self->inotify_fd >= 0)
+                close (self->inotify_fd);
+        self->inotify_fd = -1;
+
+        g_clear_pointer (&self->path_by_wd, g_hash_table_unref);
+        g_clear_pointer (&self->wd_by_path, g_hash_table_unref);
+#endif
+        g_clear_pointer (&self->monitor_by_path, g_hash_table_unref);
 }
 
 static void
-stuff_changed (GFileMonitor *monitor G_GNUC_UNUSED,
-               GFile *file G_GNUC_UNUSED,
-               GFile *other_file G_GNUC_UNUSED,
-               GFileMonitorEvent event_type,
-               gpointer data)
+stuff_changed (FcMonitor   *self,
+               const gchar *event_name)
 {
-        FcMonitor *self = FC_MONITOR (data);
-        const gchar *event_name = get_name (G_TYPE_FILE_MONITOR_EVENT, event_type);
-
         switch (self->state) {
         case UPDATE_IDLE:
                 g_debug ("Got %-38s: starting fontconfig update timeout", event_name);
@@ -281,10 +535,8 @@ update_done (GObject *source_object G_GNUC_UNUSED,
         } else if (self->notify) {
                 self->notify = FALSE;
 
-                if (self->monitors) {
-                        fc_monitor_stop (self);
-                        fc_monitor_start (self);
-                }
+                if (self->monitoring)
+                        sync_watches (self);
 
                 /* we finish modifying self before emitting the signal,
                  * allowing the callback to stop us if it decides to. */
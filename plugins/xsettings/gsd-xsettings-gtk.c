@@ -36,6 +36,14 @@ enum {
         PROP_GTK_MODULES
 };
 
+typedef struct {
+        guint64  mtime;
+        char    *module_name;
+        /* Set for modules that are only enabled by a GSettings key */
+        char    *schema;
+        char    *key;
+} ModuleFile;
+
 struct _GsdXSettingsGtk {
         GObject            parent;
 
@@ -44,9 +52,11 @@ struct _GsdXSettingsGtk {
 
         GSettings         *settings;
 
-        guint64            dir_mtime;
         GFileMonitor      *monitor;
-        GList             *cond_settings;
+        /* Parsed module files, keyed by file name */
+        GHashTable        *module_files;
+        /* GSettings for conditional modules, shared per schema */
+        GHashTable        *cond_settings;
 };
 
 G_DEFINE_TYPE(GsdXSettingsGtk, gsd_xsettings_gtk, G_TYPE_OBJECT)
@@ -54,15 +64,33 @@ G_DEFINE_TYPE(GsdXSettingsGtk, gsd_xsettings_gtk, G_TYPE_OBJECT)
 static void update_gtk_modules (GsdXSettingsGtk *gtk);
 
 static void
-empty_cond_settings_list (GsdXSettingsGtk *gtk)
+module_file_free (ModuleFile *file)
 {
-        if (gtk->cond_settings == NULL)
-                return;
+        g_free (file->module_name);
+        g_free (file->schema);
+        g_free (file->key);
+        g_free (file);
+}
+
+static void
+update_dir_modules (GsdXSettingsGtk *gtk)
+{
+        GHashTableIter iter;
+        ModuleFile *file;
+        GSettings *settings;
+
+        g_hash_table_remove_all (gtk->dir_modules);
+
+        g_hash_table_iter_init (&iter, gtk->module_files);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &file)) {
+                if (file->schema != NULL) {
+                        settings = g_hash_table_lookup (gtk->cond_settings, file->schema);
+                        if (!g_settings_get_boolean (settings, file->key))
+                                continue;
+                }
 
-        /* Empty the list of settings */
-        g_list_foreach (gtk->cond_settings, (GFunc) g_object_unref, NULL);
-        g_list_free (gtk->cond_settings);
-        gtk->cond_settings = NULL;
+                g_hash_table_add (gtk->dir_modules, g_strdup (file->module_name));
+        }
 }
 
 static void
@@ -70,37 +98,46 @@ cond_setting_changed (GSettings       *settings,
                       const char      *key,
                       GsdXSettingsGtk *gtk)
 {
-        gboolean enabled;
-        const char *module_name;
-
-        module_name = g_object_get_data (G_OBJECT (settings), "module-name");
-
-        enabled = g_settings_get_boolean (settings, key);
-        if (enabled != FALSE) {
-                if (gtk->dir_modules == NULL)
-                        gtk->dir_modules = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-                g_hash_table_insert (gtk->dir_modules, g_strdup (module_name), NULL);
-        } else if (gtk->dir_modules != NULL) {
-                g_hash_table_remove (gtk->dir_modules, module_name);
+        GHashTableIter iter;
+        ModuleFile *file;
+
+        /* Only react to the keys modules actually depend on */
+        g_hash_table_iter_init (&iter, gtk->module_files);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &file)) {
+                if (file->key != NULL &&
+                    g_str_equal (file->key, key) &&
+                    g_hash_table_lookup (gtk->cond_settings, file->schema) == settings) {
+                        update_dir_modules (gtk);
+                        update_gtk_modules (gtk);
+                        return;
+                }
         }
+}
 
-        update_gtk_modules (gtk);
+static void
+ensure_cond_settings (GsdXSettingsGtk *gtk,
+                      const char      *schema)
+{
+        GSettings *settings;
+
+        if (g_hash_table_contains (gtk->cond_settings, schema))
+                return;
+
+        settings = g_settings_new (schema);
+        g_signal_connect_object (G_OBJECT (settings), "changed", G_CALLBACK (cond_setting_changed), gtk, 0);
+        g_hash_table_insert (gtk->cond_settings, g_strdup (schema), settings);
 }
 
-static char *
+static ModuleFile *
 process_desktop_file (const char      *path,
                       GsdXSettingsGtk *gtk)
 {
         GKeyFile *keyfile;
-        char *retval;
+        ModuleFile *retval;
         char *module_name;
 
         retval = NULL;
 
-        if (g_str_has_suffix (path, ".desktop") == FALSE &&
-            g_str_has_suffix (path, ".gtk-module") == FALSE)
-                return retval;
-
         keyfile = g_key_file_new ();
         if (g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL) == FALSE)
                 goto bail;
@@ -112,100 +149,116 @@ process_desktop_file (const char      *path,
         if (module_name == NULL)
                 goto bail;
 
-        if (g_key_file_has_key (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL) != FALSE) {
-                char *schema;
-                char *key;
-                gboolean enabled;
-                GSettings *settings;
-                char *signal;
-
-                schema = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL);
-                key = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Key", NULL);
-
-                settings = g_settings_new (schema);
-
-                gtk->cond_settings = g_list_prepend (gtk->cond_settings, settings);
+        retval = g_new0 (ModuleFile, 1);
+        retval->module_name = module_name;
 
-                g_object_set_data_full (G_OBJECT (settings), "module-name", g_strdup (module_name), (GDestroyNotify) g_free);
-
-                signal = g_strdup_printf ("changed::%s", key);
-                g_signal_connect_object (G_OBJECT (settings), signal, G_CALLBACK (cond_setting_changed), gtk, 0);
-                enabled = g_settings_get_boolean (settings, key);
-                g_free (signal);
-                g_free (schema);
-                g_free (key);
-
-                if (enabled != FALSE)
-                        retval = g_strdup (module_name);
-        } else {
-                retval = g_strdup (module_name);
+        if (g_key_file_has_key (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL) != FALSE) {
+                retval->schema = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL);
+                retval->key = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Key", NULL);
+
+                if (retval->schema != NULL && retval->key != NULL) {
+                        ensure_cond_settings (gtk, retval->schema);
+                } else {
+                        g_clear_pointer (&retval->schema, g_free);
+                        g_clear_pointer (&retval->key, g_free);
+                }
         }
 
-	g_free (module_name);
-
 bail:
         g_key_file_free (keyfile);
         return retval;
 }
 
 static void
-get_gtk_modules_from_dir (GsdXSettingsGtk *gtk)
+prune_cond_settings (GsdXSettingsGtk *gtk)
 {
-        GFile *file;
-        GFileInfo *info;
-        GHashTable *ht;
+        GHashTableIter iter, files_iter;
+        const char *schema;
+        ModuleFile *file;
 
-        file = g_file_new_for_path (modules_path);
-        info = g_file_query_info (file,
-                                  G_FILE_ATTRIBUTE_TIME_MODIFIED,
-                                  G_FILE_QUERY_INFO_NONE,
-                                  NULL,
-                                  NULL);
-        if (info != NULL) {
-                guint64 dir_mtime;
-
-                dir_mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
-                if (gtk->dir_mtime == 0 ||
-                    dir_mtime > gtk->dir_mtime) {
-                        GDir *dir;
-                        const char *name;
-
-                        empty_cond_settings_list (gtk);
-
-                        gtk->dir_mtime = dir_mtime;
-
-                        if (gtk->dir_modules != NULL) {
-                                g_hash_table_destroy (gtk->dir_modules);
-                                gtk->dir_modules = NULL;
-                        }
+        g_hash_table_iter_init (&iter, gtk->cond_settings);
+        while (g_hash_table_iter_next (&iter, (gpointer *) &schema, NULL)) {
+                gboolean used = FALSE;
 
-                        dir = g_dir_open (modules_path, 0, NULL);
-                        if (dir == NULL)
-                                goto bail;
+                g_hash_table_iter_init (&files_iter, gtk->module_files);
+                while (!used && g_hash_table_iter_next (&files_iter, NULL, (gpointer *) &file))
+                        used = g_strcmp0 (file->schema, schema) == 0;
 
-                        ht = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+                if (!used)
+                        g_hash_table_iter_remove (&iter);
+        }
+}
 
-                        while ((name = g_dir_read_name (dir)) != NULL) {
-                                char *path;
-                                char *module;
+static void
+get_gtk_modules_from_dir (GsdXSettingsGtk *gtk)
+{
+        GFile *dir;
+        GFileEnumerator *enumerator;
+        GFileInfo *info;
+        GHashTable *seen;
+        GHashTableIter iter;
+        const char *name;
+
+        dir = g_file_new_for_path (modules_path);
+        enumerator = g_file_enumerate_children (dir,
+                                                G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                                G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                                                G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                                                G_FILE_QUERY_INFO_NONE,
+                                                NULL,
+                                                NULL);
+        seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+        while (enumerator != NULL &&
+               (info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL) {
+                ModuleFile *file;
+                guint64 mtime;
+                char *path;
+
+                name = g_file_info_get_name (info);
+                if (g_str_has_suffix (name, ".desktop") == FALSE &&
+                    g_str_has_suffix (name, ".gtk-module") == FALSE) {
+                        g_object_unref (info);
+                        continue;
+                }
 
-                                path = g_build_filename (modules_path, name, NULL);
-                                module = process_desktop_file (path, gtk);
-                                if (module != NULL)
-                                        g_hash_table_insert (ht, module, NULL);
-                                g_free (path);
+                mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+                        g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+
+                /* Only reparse files that changed since the last scan */
+                file = g_hash_table_lookup (gtk->module_files, name);
+                if (file == NULL || file->mtime != mtime) {
+                        path = g_build_filename (modules_path, name, NULL);
+                        file = process_desktop_file (path, gtk);
+                        g_free (path);
+
+                        if (file != NULL) {
+                                file->mtime = mtime;
+                                g_hash_table_insert (gtk->module_files, g_strdup (name), file);
+                        } else {
+                                g_hash_table_remove (gtk->module_files, name);
                         }
-                        g_dir_close (dir);
-
-                        gtk->dir_modules = ht;
                 }
+
+                if (file != NULL)
+                        g_hash_table_add (seen, g_strdup (name));
+
                 g_object_unref (info);
-        } else {
-                empty_cond_settings_list (gtk);
         }
 
-bail:
-        g_object_unref (file);
+        /* Forget files that were removed */
+        g_hash_table_iter_init (&iter, gtk->module_files);
+        while (g_hash_table_iter_next (&iter, (gpointer *) &name, NULL)) {
+                if (!g_hash_table_contains (seen, name))
+                        g_hash_table_iter_remove (&iter);
+        }
+
+        g_hash_table_destroy (seen);
+        g_clear_object (&enumerator);
+        g_object_unref (dir);
+
+        prune_cond_settings (gtk);
+        update_dir_modules (gtk);
 }
 
 static void
@@ -223,6 +276,7 @@ update_gtk_modules (GsdXSettingsGtk *gtk)
 {
         char **enabled, **disabled;
         GHashTable *ht;
+        GList *list, *l;
         guint i;
         GString *str;
         char *modules;
@@ -232,15 +286,10 @@ update_gtk_modules (GsdXSettingsGtk *gtk)
 
         ht = g_hash_table_new (g_str_hash, g_str_equal);
 
-        if (gtk->dir_modules != NULL) {
-                GList *list, *l;
-
-                list = g_hash_table_get_keys (gtk->dir_modules);
-                for (l = list; l != NULL; l = l->next) {
-                        g_hash_table_insert (ht, l->data, NULL);
-                }
-                g_list_free (list);
-        }
+        list = g_hash_table_get_keys (gtk->dir_modules);
+        for (l = list; l != NULL; l = l->next)
+                g_hash_table_insert (ht, l->data, NULL);
+        g_list_free (list);
 
         for (i = 0; enabled[i] != NULL; i++)
                 g_hash_table_insert (ht, enabled[i], NULL);
@@ -287,6 +336,11 @@ gsd_xsettings_gtk_init (GsdXSettingsGtk *gtk)
         g_debug ("GsdXSettingsGtk initializing");
 
         gtk->settings = g_settings_new (XSETTINGS_PLUGIN_SCHEMA);
+        gtk->dir_modules = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        gtk->module_files = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, (GDestroyNotify) module_file_free);
+        gtk->cond_settings = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free, g_object_unref);
 
         modules_path = g_getenv ("GSD_gtk_modules_dir");
         if (modules_path == NULL)
@@ -323,18 +377,15 @@ gsd_xsettings_gtk_finalize (GObject *object)
         g_free (gtk->modules);
         gtk->modules = NULL;
 
-        if (gtk->dir_modules != NULL) {
-                g_hash_table_destroy (gtk->dir_modules);
-                gtk->dir_modules = NULL;
-        }
+        g_clear_pointer (&gtk->dir_modules, g_hash_table_destroy);
+        g_clear_pointer (&gtk->module_files, g_hash_table_destroy);
+        g_clear_pointer (&gtk->cond_settings, g_hash_table_destroy);
 
         g_object_unref (gtk->settings);
 
         if (gtk->monitor != NULL)
                 g_object_unref (gtk->monitor);
 
-        empty_cond_settings_list (gtk);
-
         G_OBJECT_CLASS (gsd_xsettings_gtk_parent_class)->finalize (object);
 }
 
@@ -44,6 +44,7 @@
 #include "gnome-settings-bus.h"
 #include "xsettings-manager.h"
 #include "fc-monitor.h"
+#include "gsd-xwayland-launcher.h"
 #include "gsd-remote-display-manager.h"
 #include "wm-button-layout-translation.h"
 
@@ -58,6 +59,8 @@
 
 #define XSETTINGS_PLUGIN_SCHEMA "org.gnome.settings-daemon.plugins.xsettings"
 #define XSETTINGS_OVERRIDE_KEY  "overrides"
+#define XWAYLAND_MAX_JOBS_KEY   "xwayland-session-max-jobs"
+#define XWAYLAND_TIMEOUT_KEY    "xwayland-session-timeout"
 
 #define GTK_MODULES_DISABLED_KEY "disabled-gtk-modules"
 #define GTK_MODULES_ENABLED_KEY  "enabled-gtk-modules"
@@ -283,6 +286,10 @@ struct _GsdXSettingsManager
 
         guint              display_config_watch_id;
         guint              monitors_changed_id;
+        /* Legacy UI scale from the last DisplayConfig state we got */
+        int                window_scale;
+        gboolean           have_window_scale;
+        GCancellable      *display_config_cancellable;
 
         guint              shell_name_watch_id;
         gboolean           have_shell;
@@ -292,6 +299,15 @@ struct _GsdXSettingsManager
         GDBusNodeInfo     *introspection_data;
         GDBusConnection   *dbus_connection;
         guint              gtk_settings_name_id;
+
+        GCancellable      *xwayland_cancellable;
+        gboolean           xwayland_services_done;
+        gboolean           ready;
+};
+
+enum {
+        PROP_0,
+        PROP_READY,
 };
 
 #define GSD_XSETTINGS_ERROR gsd_xsettings_error_quark ()
@@ -305,6 +321,7 @@ static void     gsd_xsettings_manager_init        (GsdXSettingsManager      *xse
 static void     gsd_xsettings_manager_finalize    (GObject                  *object);
 
 static void     register_manager_dbus             (GsdXSettingsManager *manager);
+static void     update_ready                      (GsdXSettingsManager *manager);
 
 G_DEFINE_TYPE (GsdXSettingsManager, gsd_xsettings_manager, G_TYPE_OBJECT)
 
@@ -513,6 +530,11 @@ queue_notify (GsdXSettingsManager *manager)
         if (manager->notify_idle_id != 0)
                 return;
 
+        /* Nothing is published before the scale is known, the scaled
+         * settings would be wrong; see set_window_scale() */
+        if (!manager->have_window_scale)
+                return;
+
         manager->notify_idle_id = g_idle_add (notify_idle, manager);
         g_source_set_name_by_id (manager->notify_idle_id, "[gnome-settings-daemon] notify_idle");
 }
@@ -616,40 +638,7 @@ get_legacy_ui_scale (GVariantIter *properties,
 static int
 get_window_scale (GsdXSettingsManager *manager)
 {
-        g_autoptr(GError) error = NULL;
-        g_autoptr(GVariant) current_state = NULL;
-        g_autoptr(GVariantIter) properties = NULL;
-        int scale = 1;
-
-        current_state =
-                g_dbus_connection_call_sync (manager->dbus_connection,
-                                             "org.gnome.Mutter.DisplayConfig",
-                                             "/org/gnome/Mutter/DisplayConfig",
-                                             "org.gnome.Mutter.DisplayConfig",
-                                             "GetCurrentState",
-                                             NULL,
-                                             NULL,
-                                             G_DBUS_CALL_FLAGS_NO_AUTO_START,
-                                             -1,
-                                             NULL,
-                                             &error);
-        if (!current_state) {
-                g_warning ("Failed to get current display configuration state: %s",
-                           error->message);
-                return 1;
-        }
-
-        g_variant_get (current_state,
-                       CURRENT_STATE_FORMAT,
-                       NULL,
-                       NULL,
-                       NULL,
-                       &properties);
-
-        if (!get_legacy_ui_scale (properties, &scale))
-                g_warning ("Failed to get current UI legacy scaling factor");
-
-        return scale;
+        return manager->window_scale;
 }
 
 typedef struct {
@@ -1075,10 +1064,92 @@ setup_xsettings_managers (GsdXSettingsManager *manager)
 }
 
 static void
-monitors_changed (GsdXSettingsManager *manager)
+set_window_scale (GsdXSettingsManager *manager,
+                  int                  scale)
 {
+        gboolean first = !manager->have_window_scale;
+
+        manager->have_window_scale = TRUE;
+
+        if (scale != manager->window_scale) {
+                g_debug ("Window scale changed from %d to %d", manager->window_scale, scale);
+                manager->window_scale = scale;
+        } else if (!first) {
+                return;
+        }
+
         update_xft_settings (manager);
         queue_notify (manager);
+
+        if (first)
+                update_ready (manager);
+}
+
+static void
+on_current_state_ready (GObject      *source_object,
+                        GAsyncResult *res,
+                        gpointer      data)
+{
+        GsdXSettingsManager *manager;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) current_state = NULL;
+        g_autoptr(GVariantIter) properties = NULL;
+        int scale = 1;
+
+        current_state = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                                       res, &error);
+        if (!current_state) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        return;
+
+                g_warning ("Failed to get current display configuration state: %s",
+                           error->message);
+
+                /* Keep the current scale, 1 if we never got one */
+                manager = GSD_XSETTINGS_MANAGER (data);
+                g_clear_object (&manager->display_config_cancellable);
+                set_window_scale (manager, manager->window_scale);
+                return;
+        }
+
+        manager = GSD_XSETTINGS_MANAGER (data);
+        g_clear_object (&manager->display_config_cancellable);
+
+        g_variant_get (current_state,
+                       CURRENT_STATE_FORMAT,
+                       NULL,
+                       NULL,
+                       NULL,
+                       &properties);
+
+        if (!get_legacy_ui_scale (properties, &scale))
+                g_warning ("Failed to get current UI legacy scaling factor");
+
+        /* The scale is the only thing we use from the display state */
+        set_window_scale (manager, scale);
+}
+
+static void
+monitors_changed (GsdXSettingsManager *manager)
+{
+        /* Only the latest state matters */
+        if (manager->display_config_cancellable != NULL)
+                g_cancellable_cancel (manager->display_config_cancellable);
+        g_clear_object (&manager->display_config_cancellable);
+        manager->display_config_cancellable = g_cancellable_new ();
+
+        g_dbus_connection_call (manager->dbus_connection,
+                                "org.gnome.Mutter.DisplayConfig",
+                                "/org/gnome/Mutter/DisplayConfig",
+                                "org.gnome.Mutter.DisplayConfig",
+                                "GetCurrentState",
+                                NULL,
+                                G_VARIANT_TYPE (CURRENT_STATE_FORMAT),
+                                G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                -1,
+                                manager->display_config_cancellable,
+                                on_current_state_ready,
+                                manager);
 }
 
 static void
@@ -1104,6 +1175,20 @@ on_display_config_name_appeared_handler (GDBusConnection *connection,
         monitors_changed (manager);
 }
 
+static void
+on_display_config_name_vanished_handler (GDBusConnection *connection,
+                                         const gchar     *name,
+                                         gpointer         data)
+{
+        GsdXSettingsManager *manager = data;
+
+        /* Don't wait forever for a state we won't get */
+        if (!manager->have_window_scale) {
+                g_debug ("No display configuration service, using a window scale of 1");
+                set_window_scale (manager, 1);
+        }
+}
+
 static void
 animations_enabled_changed (GsdXSettingsManager *manager)
 {
@@ -1168,98 +1253,66 @@ on_shell_introspect_name_appeared_handler (GDBusConnection *connection,
 }
 
 static void
-launch_xwayland_services_on_dir (const gchar *path)
+update_ready (GsdXSettingsManager *manager)
 {
-        GFileEnumerator *enumerator;
-        GError *error = NULL;
-        GList *l, *scripts = NULL;
-        GFile *dir;
-
-        g_debug ("launch_xwayland_services_on_dir: %s", path);
-
-        dir = g_file_new_for_path (path);
-        enumerator = g_file_enumerate_children (dir,
-                                                G_FILE_ATTRIBUTE_STANDARD_NAME ","
-                                                G_FILE_ATTRIBUTE_ACCESS_CAN_EXECUTE ","
-                                                G_FILE_ATTRIBUTE_STANDARD_TYPE,
-                                                G_FILE_QUERY_INFO_NONE,
-                                                NULL, &error);
-        g_object_unref (dir);
-
-        if (!enumerator) {
-                if (!g_error_matches (error,
-                                      G_IO_ERROR,
-                                      G_IO_ERROR_NOT_FOUND)) {
-                        g_warning ("Error opening '%s': %s",
-                                   path, error->message);
-                }
-
-                g_error_free (error);
+        if (manager->ready)
                 return;
-        }
 
-        while (TRUE) {
-                GFileInfo *info;
-                GFile *child;
-
-                if (!g_file_enumerator_iterate (enumerator,
-                                                &info, &child,
-                                                NULL, &error)) {
-                        g_warning ("Error iterating on '%s': %s",
-                                   path, error->message);
-                        g_error_free (error);
-                        break;
-                }
-
-                if (!info)
-                        break;
+        /* Both the Xwayland services and the first display state (so the
+         * published settings are scaled right) are needed */
+        if (!manager->xwayland_services_done || !manager->have_window_scale)
+                return;
 
-                if (g_file_info_get_file_type (info) != G_FILE_TYPE_REGULAR ||
-                    !g_file_info_get_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_EXECUTE))
-                        continue;
+        register_manager_dbus (manager);
 
-                scripts = g_list_prepend (scripts, g_file_get_path (child));
-        }
+        manager->ready = TRUE;
+        g_object_notify (G_OBJECT (manager), "ready");
+}
 
-        scripts = g_list_sort (scripts, (GCompareFunc) strcmp);
+static void
+xwayland_services_done_cb (GObject      *source_object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+        GsdXSettingsManager *manager;
+        g_autoptr(GError) error = NULL;
 
-        for (l = scripts; l; l = l->next) {
-                gchar *args[2] = { l->data, NULL };
+        if (!gsd_xwayland_launcher_run_finish (result, &error) &&
+            g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                return;
 
-                g_debug ("launch_xwayland_services_on_dir: Spawning '%s'", args[0]);
-                if (!g_spawn_sync (NULL, args, NULL,
-                                   G_SPAWN_DEFAULT,
-                                   NULL, NULL,
-                                   NULL, NULL, NULL,
-                                   &error)) {
-                        g_warning ("Error when spawning '%s': %s",
-                                   args[0], error->message);
-                        g_clear_error (&error);
-                }
-        }
+        manager = GSD_XSETTINGS_MANAGER (user_data);
+        g_clear_object (&manager->xwayland_cancellable);
 
-        g_object_unref (enumerator);
-        g_list_free_full (scripts, g_free);
+        g_debug ("Xwayland services launched");
+        manager->xwayland_services_done = TRUE;
+        update_ready (manager);
 }
 
 static void
-launch_xwayland_services (void)
+launch_xwayland_services (GsdXSettingsManager *manager)
 {
         const gchar * const * config_dirs;
+        g_autoptr(GPtrArray) dirs = NULL;
         gint i;
 
         config_dirs = g_get_system_config_dirs ();
+        dirs = g_ptr_array_new_with_free_func (g_free);
 
         for (i = 0; config_dirs[i] != NULL; i++) {
-                gchar *config_dir;
-
-                config_dir = g_build_filename (config_dirs[i],
-                                               "Xwayland-session.d",
-                                               NULL);
-
-                launch_xwayland_services_on_dir (config_dir);
-                g_free (config_dir);
+                g_ptr_array_add (dirs, g_build_filename (config_dirs[i],
+                                                         "Xwayland-session.d",
+                                                         NULL));
         }
+        g_ptr_array_add (dirs, NULL);
+
+        manager->xwayland_cancellable = g_cancellable_new ();
+        gsd_xwayland_launcher_run ((const gchar * const *) dirs->pdata,
+                                   g_settings_get_uint (manager->plugin_settings, XWAYLAND_MAX_JOBS_KEY),
+                                   g_settings_get_uint (manager->plugin_settings, XWAYLAND_TIMEOUT_KEY),
+                                   manager->xwayland_cancellable,
+                                   xwayland_services_done_cb,
+                                   manager);
 }
 
 gboolean
@@ -1297,7 +1350,7 @@ gsd_xsettings_manager_start (GsdXSettingsManager *manager,
                                                 "org.gnome.Mutter.DisplayConfig",
                                                 G_BUS_NAME_WATCHER_FLAGS_NONE,
                                                 on_display_config_name_appeared_handler,
-                                                NULL,
+                                                on_display_config_name_vanished_handler,
                                                 manager,
                                                 NULL);
 
@@ -1390,14 +1443,15 @@ gsd_xsettings_manager_start (GsdXSettingsManager *manager,
                           G_CALLBACK (gtk_modules_callback), manager);
         gtk_modules_callback (manager->gtk, NULL, manager);
 
-        /* Xft settings */
+        /* Xft settings, published once the window scale is known */
         update_xft_settings (manager);
 
-        /* Launch Xwayland services */
+        /* Launch Xwayland services, we are only ready once they ran */
         if (gnome_settings_is_wayland ())
-                launch_xwayland_services ();
-
-        register_manager_dbus (manager);
+                launch_xwayland_services (manager);
+        else
+                manager->xwayland_services_done = TRUE;
+        update_ready (manager);
 
         start_fontconfig_monitor (manager);
 
@@ -1417,6 +1471,11 @@ gsd_xsettings_manager_stop (GsdXSettingsManager *manager)
 {
         g_debug ("Stopping xsettings manager");
 
+        if (manager->xwayland_cancellable != NULL) {
+                g_cancellable_cancel (manager->xwayland_cancellable);
+                g_clear_object (&manager->xwayland_cancellable);
+        }
+
         if (manager->introspect_properties_changed_id) {
                 g_dbus_connection_signal_unsubscribe (manager->dbus_connection,
                                                       manager->introspect_properties_changed_id);
@@ -1439,6 +1498,11 @@ gsd_xsettings_manager_stop (GsdXSettingsManager *manager)
                 manager->display_config_watch_id = 0;
         }
 
+        if (manager->display_config_cancellable != NULL) {
+                g_cancellable_cancel (manager->display_config_cancellable);
+                g_clear_object (&manager->display_config_cancellable);
+        }
+
         if (manager->shell_name_watch_id > 0) {
                 g_bus_unwatch_name (manager->shell_name_watch_id);
                 manager->shell_name_watch_id = 0;
@@ -1478,12 +1542,35 @@ gsd_xsettings_manager_stop (GsdXSettingsManager *manager)
         }
 }
 
+static void
+gsd_xsettings_manager_get_property (GObject    *object,
+                                    guint       prop_id,
+                                    GValue     *value,
+                                    GParamSpec *pspec)
+{
+        GsdXSettingsManager *manager = GSD_XSETTINGS_MANAGER (object);
+
+        switch (prop_id) {
+        case PROP_READY:
+                g_value_set_boolean (value, manager->ready);
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+                break;
+        }
+}
+
 static void
 gsd_xsettings_manager_class_init (GsdXSettingsManagerClass *klass)
 {
         GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+        object_class->get_property = gsd_xsettings_manager_get_property;
         object_class->finalize = gsd_xsettings_manager_finalize;
+
+        g_object_class_install_property (object_class, PROP_READY,
+                                         g_param_spec_boolean ("ready", NULL, NULL,
+                                                               FALSE, G_PARAM_READABLE));
 }
 
 static void
@@ -1491,6 +1578,7 @@ gsd_xsettings_manager_init (GsdXSettingsManager *manager)
 {
         GError *error = NULL;
 
+        manager->window_scale = 1;
         manager->dbus_connection = g_bus_get_sync (G_BUS_TYPE_SESSION,
                                                          NULL, &error);
         if (!manager->dbus_connection)
@@ -0,0 +1,401 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Runs the executables found in Xwayland-session.d directories
+ * asynchronously, with at most max_jobs of them at the same time.
+ *
+ * Scripts whose name starts with a number (e.g. "00-xrdb") are run in
+ * groups: all the scripts sharing the same numeric prefix may run
+ * concurrently, but a group only starts once every script of the
+ * previous group exited.  Scripts without a numeric prefix have no
+ * ordering constraints at all.
+ *
+ * When cancelled, the scripts that did not start yet are dropped, the
+ * running ones are killed, and the operation returns right away.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "gsd-xwayland-launcher.h"
+
+typedef struct {
+        GTask       *task;
+        gchar       *path;
+        gint64       prefix;    /* -1 if the name has no numeric prefix */
+        GSubprocess *subprocess;
+        gint64       start_time;
+        guint        timeout_id;
+} Script;
+
+typedef struct {
+        GQueue   unordered;
+        GQueue   ordered;
+        GQueue   running;
+        gint64   running_prefix;
+        guint    n_running;
+        guint    n_running_ordered;
+        guint    max_jobs;
+        guint    timeout_secs;
+        gint64   start_time;
+        GSource *cancel_source;
+        gboolean returned;
+} LaunchData;
+
+static void launcher_schedule (GTask *task);
+
+static void
+script_free (Script *script)
+{
+        g_clear_handle_id (&script->timeout_id, g_source_remove);
+        g_clear_object (&script->subprocess);
+        g_free (script->path);
+        g_free (script);
+}
+
+static void
+launch_data_free (LaunchData *data)
+{
+        g_queue_foreach (&data->unordered, (GFunc) script_free, NULL);
+        g_queue_clear (&data->unordered);
+        g_queue_foreach (&data->ordered, (GFunc) script_free, NULL);
+        g_queue_clear (&data->ordered);
+        /* running scripts hold a reference on the task */
+        g_assert (g_queue_is_empty (&data->running));
+        if (data->cancel_source != NULL) {
+                g_source_destroy (data->cancel_source);
+                g_source_unref (data->cancel_source);
+        }
+        g_free (data);
+}
+
+static gint
+script_compare (const Script *a,
+                const Script *b,
+                gpointer      user_data G_GNUC_UNUSED)
+{
+        g_autofree gchar *name_a = NULL;
+        g_autofree gchar *name_b = NULL;
+        gint ret;
+
+        if (a->prefix != b->prefix)
+                return a->prefix < b->prefix ? -1 : 1;
+
+        name_a = g_path_get_basename (a->path);
+        name_b = g_path_get_basename (b->path);
+        ret = strcmp (name_a, name_b);
+        if (ret != 0)
+                return ret;
+
+        return strcmp (a->path, b->path);
+}
+
+static void
+collect_scripts (LaunchData  *data,
+                 const gchar *path)
+{
+        GFileEnumerator *enumerator;
+        GError *error = NULL;
+        GFile *dir;
+
+        g_debug ("Looking for Xwayland session scripts in %s", path);
+
+        dir = g_file_new_for_path (path);
+        enumerator = g_file_enumerate_children (dir,
+                                                G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                                G_FILE_ATTRIBUTE_ACCESS_CAN_EXECUTE ","
+                                                G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                                G_FILE_QUERY_INFO_NONE,
+                                                NULL, &error);
+        g_object_unref (dir);
+
+        if (!enumerator) {
+                if (!g_error_matches (error,
+                                      G_IO_ERROR,
+                                      G_IO_ERROR_NOT_FOUND)) {
+                        g_warning ("Error opening '%s': %s",
+                                   path, error->message);
+                }
+
+                g_error_free (error);
+                return;
+        }
+
+        while (TRUE) {
+                GFileInfo *info;
+                GFile *child;
+                const gchar *name;
+                Script *script;
+
+                if (!g_file_enumerator_iterate (enumerator,
+                                                &info, &child,
+                                                NULL, &error)) {
+                        g_warning ("Error iterating on '%s': %s",
+                                   path, error->message);
+                        g_error_free (error);
+                        break;
+                }
+
+                if (!info)
+                        break;
+
+                if (g_file_info_get_file_type (info) != G_FILE_TYPE_REGULAR ||
+                    !g_file_info_get_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_EXECUTE))
+                        continue;
+
+                name = g_file_info_get_name (info);
+
+                script = g_new0 (Script, 1);
+                script->path = g_file_get_path (child);
+                script->prefix = g_ascii_isdigit (name[0]) ? g_ascii_strtoll (name, NULL, 10) : -1;
+
+                if (script->prefix < 0)
+                        g_queue_push_tail (&data->unordered, script);
+                else
+                        g_queue_insert_sorted (&data->ordered, script,
+                                               (GCompareDataFunc) script_compare, NULL);
+        }
+
+        g_object_unref (enumerator);
+}
+
+static gboolean
+script_timeout_cb (gpointer user_data)
+{
+        Script *script = user_data;
+        LaunchData *data = g_task_get_task_data (script->task);
+
+        g_warning ("Xwayland session script '%s' did not finish within %u seconds, killing it",
+                   script->path, data->timeout_secs);
+        g_subprocess_force_exit (script->subprocess);
+        script->timeout_id = 0;
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+script_exited_cb (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+        Script *script = user_data;
+        GTask *task = script->task;
+        LaunchData *data = g_task_get_task_data (task);
+        g_autoptr(GError) error = NULL;
+
+        g_debug ("Xwayland session script '%s' exited after %" G_GINT64_FORMAT " ms",
+                 script->path, (g_get_monotonic_time () - script->start_time) / 1000);
+
+        /* scripts killed on cancellation are expected to fail */
+        if (!g_subprocess_wait_check_finish (script->subprocess, result, &error) &&
+            !data->returned)
+                g_warning ("Xwayland session script '%s' failed: %s",
+                           script->path, error->message);
+
+        g_queue_remove (&data->running, script);
+        data->n_running--;
+        if (script->prefix >= 0)
+                data->n_running_ordered--;
+        script_free (script);
+
+        launcher_schedule (task);
+
+        /* Release the reference taken in script_spawn() */
+        g_object_unref (task);
+}
+
+static gboolean
+script_spawn (GTask  *task,
+              Script *script)
+{
+        LaunchData *data = g_task_get_task_data (task);
+        const gchar *args[2] = { script->path, NULL };
+        GError *error = NULL;
+
+        g_debug ("Spawning Xwayland session script '%s'", script->path);
+
+        script->subprocess = g_subprocess_newv (args, G_SUBPROCESS_FLAGS_NONE, &error);
+        if (script->subprocess == NULL) {
+                g_warning ("Error when spawning '%s': %s",
+                           script->path, error->message);
+                g_error_free (error);
+                script_free (script);
+                return FALSE;
+        }
+
+        script->task = g_object_ref (task);
+        script->start_time = g_get_monotonic_time ();
+        g_queue_push_tail (&data->running, script);
+        /* not cancellable, the script is always waited for */
+        g_subprocess_wait_check_async (script->subprocess, NULL, script_exited_cb, script);
+        if (data->timeout_secs > 0) {
+                script->timeout_id = g_timeout_add_seconds (data->timeout_secs, script_timeout_cb, script);
+                g_source_set_name_by_id (script->timeout_id, "[gnome-settings-daemon] script_timeout_cb");
+        }
+
+        data->n_running++;
+        if (script->prefix >= 0) {
+                data->running_prefix = script->prefix;
+                data->n_running_ordered++;
+        }
+
+        return TRUE;
+}
+
+static void
+launcher_return (GTask *task)
+{
+        LaunchData *data = g_task_get_task_data (task);
+
+        data->returned = TRUE;
+        if (data->cancel_source != NULL) {
+                g_source_destroy (data->cancel_source);
+                g_clear_pointer (&data->cancel_source, g_source_unref);
+        }
+
+        if (!g_task_return_error_if_cancelled (task))
+                g_task_return_boolean (task, TRUE);
+}
+
+static void
+launcher_cancel (GTask *task)
+{
+        LaunchData *data = g_task_get_task_data (task);
+        Script *script;
+        GList *l;
+
+        g_debug ("Xwayland session scripts cancelled, killing %u running ones",
+                 data->n_running);
+
+        while ((script = g_queue_pop_head (&data->unordered)) != NULL)
+                script_free (script);
+        while ((script = g_queue_pop_head (&data->ordered)) != NULL)
+                script_free (script);
+
+        /* they are still reaped as they exit */
+        for (l = data->running.head; l != NULL; l = l->next) {
+                script = l->data;
+                g_subprocess_force_exit (script->subprocess);
+        }
+
+        launcher_return (task);
+}
+
+static gboolean
+launcher_cancelled_cb (GCancellable *cancellable,
+                       gpointer      user_data)
+{
+        GTask *task = user_data;
+        LaunchData *data = g_task_get_task_data (task);
+
+        if (!data->returned)
+                launcher_cancel (task);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+launcher_schedule (GTask *task)
+{
+        LaunchData *data = g_task_get_task_data (task);
+
+        if (data->returned)
+                return;
+
+        if (g_cancellable_is_cancelled (g_task_get_cancellable (task))) {
+                launcher_cancel (task);
+                return;
+        }
+
+        while (data->n_running < data->max_jobs) {
+                Script *script;
+
+                script = g_queue_pop_head (&data->unordered);
+                if (script == NULL) {
+                        script = g_queue_peek_head (&data->ordered);
+                        if (script == NULL)
+                                break;
+
+                        /* The next group waits for the current one to finish */
+                        if (data->n_running_ordered > 0 &&
+                            script->prefix != data->running_prefix)
+                                break;
+
+                        g_queue_pop_head (&data->ordered);
+                }
+
+                script_spawn (task, script);
+        }
+
+        if (data->n_running == 0 &&
+            g_queue_is_empty (&data->unordered) &&
+            g_queue_is_empty (&data->ordered)) {
+                g_debug ("All Xwayland session scripts finished in %" G_GINT64_FORMAT " ms",
+                         (g_get_monotonic_time () - data->start_time) / 1000);
+
+                launcher_return (task);
+        }
+}
+
+void
+gsd_xwayland_launcher_run (const gchar * const *dirs,
+                           guint                max_jobs,
+                           guint                timeout_secs,
+                           GCancellable        *cancellable,
+                           GAsyncReadyCallback  callback,
+                           gpointer             user_data)
+{
+        g_autoptr(GTask) task = NULL;
+        LaunchData *data;
+        guint i;
+
+        task = g_task_new (NULL, cancellable, callback, user_data);
+        g_task_set_source_tag (task, gsd_xwayland_launcher_run);
+
+        data = g_new0 (LaunchData, 1);
+        g_queue_init (&data->unordered);
+        g_queue_init (&data->ordered);
+        g_queue_init (&data->running);
+        data->max_jobs = MAX (max_jobs, 1);
+        data->timeout_secs = timeout_secs;
+        data->start_time = g_get_monotonic_time ();
+        g_task_set_task_data (task, data, (GDestroyNotify) launch_data_free);
+
+        for (i = 0; dirs[i] != NULL; i++)
+                collect_scripts (data, dirs[i]);
+
+        if (cancellable != NULL) {
+                data->cancel_source = g_cancellable_source_new (cancellable);
+                g_source_set_callback (data->cancel_source,
+                                       (GSourceFunc) launcher_cancelled_cb,
+                                       task, NULL);
+                g_source_attach (data->cancel_source, g_main_context_get_thread_default ());
+        }
+
+        launcher_schedule (task);
+}
+
+gboolean
+gsd_xwayland_launcher_run_finish (GAsyncResult  *result,
+                                  GError       **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+        return g_task_propagate_boolean (G_TASK (result), error);
+}
@@ -0,0 +1,36 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_XWAYLAND_LAUNCHER_H__
+#define __GSD_XWAYLAND_LAUNCHER_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+void     gsd_xwayland_launcher_run        (const gchar * const *dirs,
+                                           guint                max_jobs,
+                                           guint                timeout_secs,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data);
+gboolean gsd_xwayland_launcher_run_finish (GAsyncResult        *result,
+                                           GError             **error);
+
+G_END_DECLS
+
+#endif /* __GSD_XWAYLAND_LAUNCHER_H__ */
@@ -3,6 +3,7 @@
 #define STOP gsd_xsettings_manager_stop
 #define MANAGER GsdXSettingsManager
 #define GDK_BACKEND "x11"
+#define WAIT_FOR_READY
 #include "gsd-xsettings-manager.h"
 
 #include "daemon-skeleton-gtk.h"
@@ -20,6 +20,7 @@ builddir = os.environ.get('BUILDDIR', os.path.dirname(__file__))
 sys.path.insert(0, os.path.join(project_root, 'tests'))
 sys.path.insert(0, builddir)
 import gsdtestcase
+import gsdbenchmark
 import dbus
 import dbusmock
 
@@ -205,5 +206,25 @@ class XsettingsPluginTest(gsdtestcase.GSDTestCase):
         after = self.obj_xsettings_props.Get('org.gtk.Settings', 'FontconfigTimestamp')
         self.assertTrue(after > before)
 
+@gsdbenchmark.skip_unless_enabled
+class XsettingsPluginBenchmark(XsettingsPluginTest, gsdbenchmark.BenchmarkMixin):
+    BENCHMARK_SUITE = 'xsettings'
+
+    def test_benchmark(self):
+        self.record_startup(self.plugin_log_write.name)
+        self.record_idle()
+
+        if not GLib.find_program_in_path('xrandr'):
+            self.skipTest('xrandr is needed for the RandR benchmark')
+
+        # Xvfb only has a single output, so churn through RandR 1.5
+        # monitors instead, which GDK reports the same way
+        def churn(i):
+            subprocess.check_call(['xrandr', '--setmonitor', 'BENCH-%d' % i,
+                                   '25/7x25/7+%d+0' % (i * 25), 'none'])
+            subprocess.check_call(['xrandr', '--delmonitor', 'BENCH-%d' % i])
+
+        self.record_storm('randr-churn', 50, churn, self.wait_until_quiet)
+
 # avoid writing to stderr
 unittest.main(testRunner=unittest.TextTestRunner(stream=sys.stdout, verbosity=2))
@@ -0,0 +1,175 @@
+'''GNOME settings daemon benchmark helpers
+
+The plugin test suites contain benchmark test cases which are skipped
+unless $GSD_BENCHMARK_OUTPUT is set. They run the plugins against the
+same python-dbusmock stand-ins as the regular tests, and append their
+results to that file as JSON, one object per line:
+
+  {"suite": "power", "name": "startup", "value": 123.4, "unit": "ms",
+   "version": "3.38.1"}
+
+so that the results of several suites can simply be concatenated.
+'''
+
+__license__ = 'GPL v2 or later'
+
+import json
+import os
+import os.path
+import re
+import time
+import unittest
+
+OUTPUT_ENV = 'GSD_BENCHMARK_OUTPUT'
+
+# How long the idle wakeups are counted for
+IDLE_SECONDS = 10
+
+def enabled():
+    '''Whether benchmarks were requested'''
+
+    return bool(os.environ.get(OUTPUT_ENV))
+
+def skip_unless_enabled(klass):
+    '''Class decorator skipping benchmarks in regular test runs'''
+
+    return unittest.skipUnless(enabled(), '$%s is not set' % OUTPUT_ENV)(klass)
+
+def read_proc_status(pid, tid=None):
+    '''Return /proc/<pid>[/task/<tid>]/status as a dict'''
+
+    if tid is None:
+        path = '/proc/%d/status' % pid
+    else:
+        path = '/proc/%d/task/%d/status' % (pid, tid)
+
+    status = {}
+    with open(path) as f:
+        for line in f:
+            key, _, value = line.partition(':')
+            status[key] = value.strip()
+    return status
+
+def rss_kb(pid):
+    '''Resident set size of a process, in kB'''
+
+    return int(read_proc_status(pid)['VmRSS'].split()[0])
+
+def context_switches(pid):
+    '''Number of times any thread of a process was scheduled in'''
+
+    total = 0
+    for tid in os.listdir('/proc/%d/task' % pid):
+        try:
+            status = read_proc_status(pid, int(tid))
+        except FileNotFoundError:
+            # thread exited meanwhile
+            continue
+        total += int(status['voluntary_ctxt_switches'])
+        total += int(status['nonvoluntary_ctxt_switches'])
+    return total
+
+def cpu_time_ms(pid):
+    '''User and system CPU time used by a process, in ms'''
+
+    with open('/proc/%d/stat' % pid) as f:
+        # The command name can contain spaces, skip past it
+        fields = f.read().rpartition(')')[2].split()
+    # utime and stime are fields 14 and 15, the split started at field 3
+    ticks = int(fields[11]) + int(fields[12])
+    return ticks * 1000.0 / os.sysconf('SC_CLK_TCK')
+
+
+class BenchmarkMixin(object):
+    '''Measurements for GSDTestCase based benchmarks
+
+    Set BENCHMARK_SUITE to the name of the plugin, and self.daemon to the
+    plugin's subprocess.Popen.
+    '''
+
+    BENCHMARK_SUITE = None
+
+    def record(self, name, value, unit):
+        '''Append one measurement to the output file'''
+
+        result = {
+            'suite': self.BENCHMARK_SUITE,
+            'name': name,
+            'value': round(value, 3),
+            'unit': unit,
+        }
+        if 'GSD_VERSION' in os.environ:
+            result['version'] = os.environ['GSD_VERSION']
+
+        with open(os.environ[OUTPUT_ENV], 'a') as f:
+            f.write(json.dumps(result, sort_keys=True) + '\n')
+
+    def record_startup(self, log_path, timeout=10):
+        '''Record the startup time the daemon logged with --verbose'''
+
+        pattern = re.compile(rb' started in (\d+) ms')
+        while timeout > 0:
+            with open(log_path, 'rb') as f:
+                match = pattern.search(f.read())
+            if match:
+                break
+            time.sleep(0.1)
+            timeout -= 0.1
+        else:
+            self.fail('timed out waiting for the daemon to start')
+
+        self.record('startup', int(match.group(1)), 'ms')
+
+    def record_idle(self, seconds=IDLE_SECONDS):
+        '''Record the memory usage and the wakeups of an idle daemon'''
+
+        pid = self.daemon.pid
+
+        self.record('rss', rss_kb(pid), 'kB')
+
+        before = context_switches(pid)
+        time.sleep(seconds)
+        self.record('idle-wakeups', (context_switches(pid) - before) / seconds, 'Hz')
+
+    def wait_until_quiet(self, quiet=0.5, timeout=30):
+        '''Wait until the daemon did not use any CPU for quiet seconds
+
+        Returns the time.monotonic() at which it last did.
+        '''
+
+        pid = self.daemon.pid
+        start = last_change = time.monotonic()
+        last_cpu = cpu_time_ms(pid)
+        while time.monotonic() - last_change < quiet:
+            if time.monotonic() - start > timeout:
+                self.fail('daemon still busy after %d seconds' % timeout)
+            time.sleep(0.02)
+            cpu = cpu_time_ms(pid)
+            if cpu != last_cpu:
+                last_cpu = cpu
+                last_change = time.monotonic()
+
+        return last_change
+
+    def record_storm(self, name, count, func, settle=None):
+        '''Record how long the daemon takes to process count events
+
+        func(i) generates the i-th event, settle(), when given, only returns
+        once the daemon processed all of them, optionally returning the
+        time.monotonic() at which it did. Both the wall time and the CPU
+        time the daemon used are recorded.
+        '''
+
+        pid = self.daemon.pid
+
+        cpu_before = cpu_time_ms(pid)
+        start = time.monotonic()
+        for i in range(count):
+            func(i)
+        end = settle() if settle is not None else None
+        if end is None:
+            end = time.monotonic()
+        elapsed = (end - start) * 1000
+
+        self.record(name + '-latency', elapsed / count, 'ms')
+        self.record(name + '-cpu', cpu_time_ms(pid) - cpu_before, 'ms')